@@ -35,6 +35,7 @@ HEADERS += \
     WebCrawler.h \
     socketlearn/socketlearn.h \
     socketlearn/classlist.h \
+    serve/Serve/wireschema.h \
     player.h \
     NovelRecommender.h \
     AllNovelManager.h \
@@ -44,9 +45,13 @@ FORMS += \
     mainwindow.ui
     
 INCLUDEPATH += \
-    socketlearn
+    socketlearn \
+    serve/Serve
 
 LIBS += -l$$PWD/socketlearn -lsocketlearn_static
+# 聊天记录需要按 socketlearn.cpp 当前源码重新编译的 socketlearn_static.lib（能完整读取 history_msg 帧），
+# 换上新库之后再打开
+#DEFINES += CHAT_HISTORY
 RC_ICONS = logo.ico
 DEFINES += PROJECT_DIR=\\\"$$PWD\\\"
 # Default rules for deployment.
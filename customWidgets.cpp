@@ -988,6 +988,10 @@ MessageDisplay::MessageDisplay(QWidget *parent)
     scrollArea->setWidget(container);
     mainLayout->addWidget(scrollArea);
     setLayout(mainLayout);
+
+    connect(scrollArea->verticalScrollBar(), &QScrollBar::valueChanged, this, [=](int value){
+        if(value == scrollArea->verticalScrollBar()->minimum()) emit reachedTop();
+    });
 }
 
 void MessageDisplay::addMessage(MessageItem *item) {
@@ -1005,6 +1009,17 @@ void MessageDisplay::addMessage(MessageItem *item) {
     });
 }
 
+void MessageDisplay::prependMessage(MessageItem *item) {
+    // 按到底部的距离恢复滚动位置，插入的内容出现在视口上方
+    QScrollBar *bar = scrollArea->verticalScrollBar();
+    int distanceToBottom = bar->maximum() - bar->value();
+    layout->insertWidget(0, item);
+
+    QTimer::singleShot(100, this, [=](){
+        bar->setValue(bar->maximum() - distanceToBottom);
+    });
+}
+
 //*********************************************************//
 // TransparentNavTextBrowser 类实现
 //*********************************************************//
@@ -304,6 +304,12 @@ public:
     explicit MessageDisplay(QWidget *parent = nullptr);
     
     void addMessage(MessageItem *item);
+    // 在最上方插入更早的消息，保持当前的阅读位置
+    void prependMessage(MessageItem *item);
+
+signals:
+    // 滚动到顶部，可以加载更早的消息
+    void reachedTop();
 
 private:
     QScrollArea *scrollArea;
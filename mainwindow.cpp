@@ -5,12 +5,36 @@
 #include <QRegion>
 #include <QTimer>
 #include <QMessageBox>
+#include "wireschema.h"
 
 #if (QT_VERSION > QT_VERSION_CHECK(6,3,0))
 #include <QFileDialog>
 #endif
 
 
+// 按二进制字段编码登录/注册载荷，并在帧前加上协商字节
+static vector<char> generateCredentialMessage(socketlearn *socket, MessageType type, const QString &username, const QString &password){
+    WireWriter writer;
+    writer.PutString(kCredentialUsername, username.toStdString());
+    writer.PutString(kCredentialPassword, password.toStdString());
+    vector<char> data = socket->GenerateMessage(type, writer.Take());
+    data.insert(data.begin(), static_cast<char>(kWireHello | kWireVersion));
+    return data;
+}
+
+// 转发消息的载荷是二进制字段，转成 发送者|消息体 交给界面，消息体按 Latin-1 逐字节保留
+static QString decodeReceived(const std::string &msg, MessageType type){
+    if(type == MessageType::forward_msg){
+        WireView from, body;
+        if(!DecodeWirePair(msg, kForwardPeer, kForwardBody, from, body)) return QString();
+        return QString::fromUtf8(from.data, static_cast<int>(from.size)) + "|" + QString::fromLatin1(body.data, static_cast<int>(body.size));
+    }
+    if(type == MessageType::history_msg){
+        return QString::fromLatin1(msg.data(), static_cast<int>(msg.size()));
+    }
+    return QString::fromStdString(msg);
+}
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
@@ -244,7 +268,7 @@ void MainWindow::Init(){
             return;
         }
         socket->setReceiveCallback([this](const std::string &msg, MessageType type){
-         emit receiveMessage(QString::fromStdString(msg), type);
+         emit receiveMessage(decodeReceived(msg, type), type);
         });
         connect(this, &MainWindow::receiveMessage, this, &MainWindow::on_receiveMessage);
         QString username = usernameSel->value();
@@ -256,9 +280,7 @@ void MainWindow::Init(){
          return;
         }
         MessageType type = MessageType::login;
-        QString loginPayload = username + "|" + password;
-        vector<char> data = socket->GenerateMessage(type, loginPayload.toStdString());
-        socket->SendData(data);
+        vector<char> data = generateCredentialMessage(socket, type, username, password);
         if(!socket->SendData(data)) {
             QMessageBox::warning(this, "错误", QString::fromStdString(socket->GetLastError()));
             return;
@@ -290,15 +312,13 @@ void MainWindow::Init(){
             return;
         }
         MessageType type = MessageType::register_user;
-        QString registerPayload = username + "|" + password;
-        vector<char> data = socket->GenerateMessage(type, registerPayload.toStdString());
-        socket->SendData(data);
+        vector<char> data = generateCredentialMessage(socket, type, username, password);
         if(!socket->SendData(data)) {
             QMessageBox::warning(this, "错误", QString::fromStdString(socket->GetLastError()));
             return;
         }
         socket->setReceiveCallback([this](const std::string &msg, MessageType type){
-            emit receiveMessage(QString::fromStdString(msg), type);
+            emit receiveMessage(decodeReceived(msg, type), type);
         });
         connect(this, &MainWindow::receiveMessage, this, &MainWindow::on_receiveMessage);
         socket->startListening();
@@ -549,9 +569,7 @@ void MainWindow::on_receiveMessage(const QString &message, const MessageType &ty
         connect(this, &MainWindow::receiveMessage, newCanvas, &MyCanvas::on_receiveMessage);
         connect(newCanvas, &MyCanvas::setDel, this, [=](MyCanvas *c){curLayersPage->slideOut();deleteCanvas(c);});
         disconnect(this, &MainWindow::receiveMessage, this, &MainWindow::on_receiveMessage);
-        uint32_t instruction = static_cast<uint32_t>(InstructionType::get_all_online_users);
-        vector<char> data = socket->GenerateMessage(MessageType::instruction, instruction);
-        socket->SendData(data);
+        newCanvas->subscribePresence();
         newCanvas->socketTimerout->start(10000);
     }else if(type == MessageType::return_msg && message.contains("login:")){
         timeout->stop();
@@ -333,8 +333,10 @@ void MyCanvas::Init(){
                 QMessageBox::warning(this, "错误", "请先选择一个用户");
                 return;
             }
-            std::string sedmsg = g_links.ConnectName.toStdString() + "|" + msgdata.toStdString();
-            vector<char> data = socket->GenerateMessage(MessageType::forward_msg, sedmsg);
+            WireWriter writer;
+            writer.PutString(kForwardPeer, g_links.ConnectName.toStdString());
+            writer.PutBytes(kForwardBody, msgdata.constData(), static_cast<size_t>(msgdata.size()));
+            vector<char> data = socket->GenerateMessage(MessageType::forward_msg, writer.Take());
             socket->SendData(data);
             socketTimerout->start(1000);
             currentMessageDisplay->addMessage(new MessageItem("我", text, QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"), MessageItem::Right));
@@ -385,6 +387,7 @@ void MyCanvas::on_receiveMessage(const QString &message, const MessageType &type
                             userMap[item->name()] = {currentMessageDisplay, item};
                             currentMessageDisplay->show();
                             defTextLayout->addWidget(currentMessageDisplay);
+                            attachHistory(item->name(), currentMessageDisplay);
                         }
                     });
                     locker.unlock();
@@ -409,6 +412,7 @@ void MyCanvas::on_receiveMessage(const QString &message, const MessageType &type
                         userMap[item->name()] = {currentMessageDisplay, item};
                         currentMessageDisplay->show();
                         defTextLayout->addWidget(currentMessageDisplay);
+                        attachHistory(item->name(), currentMessageDisplay);
                     }
                 });
                 locker.unlock();
@@ -422,10 +426,32 @@ void MyCanvas::on_receiveMessage(const QString &message, const MessageType &type
                     userMap.erase(user);
                 }
                 locker.unlock();
+            }else if(pos != -1 && message.left(pos) == "presence_snapshot")
+            {
+                // 全量快照，格式 版本号:a|b|
+                int versionEnd = message.indexOf(":", pos + 1);
+                if(versionEnd == -1) return;
+                presenceVersion = message.mid(pos + 1, versionEnd - pos - 1).toULongLong();
+                on_receiveMessage("all_online_users:" + message.mid(versionEnd + 1), MessageType::return_msg);
+            }else if(pos != -1 && message.left(pos) == "presence_delta")
+            {
+                // 服务端合并后的上线/下线增量，格式 版本号:+a|-b|；版本号不连续说明漏了增量，重新订阅
+                int versionEnd = message.indexOf(":", pos + 1);
+                if(versionEnd == -1) return;
+                quint64 version = message.mid(pos + 1, versionEnd - pos - 1).toULongLong();
+                if(version <= presenceVersion) return;
+                if(presenceVersion == 0 || version != presenceVersion + 1){
+                    subscribePresence();
+                    return;
+                }
+                presenceVersion = version;
+                applyPresenceChanges(message.mid(versionEnd + 1));
             }
         }
     }else if(type == MessageType::forward_msg){
         handleReadyRead(message);
+    }else if(type == MessageType::history_msg){
+        applyHistoryPage(message);
     }else if(type == MessageType::error){
         if(message == "disconnect"){
             delete socket;
@@ -436,12 +462,106 @@ void MyCanvas::on_receiveMessage(const QString &message, const MessageType &type
     }
 }
 
+void MyCanvas::applyPresenceChanges(const QString &changes){
+    // 逐条按单独的上线/下线通知处理
+    QStringList list = changes.split("|", Qt::SkipEmptyParts);
+    for(const QString &change : list){
+        if(change.length() < 2) continue;
+        if(change.at(0) == '+'){
+            on_receiveMessage("user_online:" + change.mid(1), MessageType::return_msg);
+        }else if(change.at(0) == '-'){
+            on_receiveMessage("user_offline:" + change.mid(1), MessageType::return_msg);
+        }
+    }
+}
+
+void MyCanvas::subscribePresence(){
+    // 指令后跟 长度 + 十进制版本号
+    uint32_t instruction = static_cast<uint32_t>(InstructionType::subscribe_presence);
+    vector<char> data = socket->GenerateMessage(MessageType::instruction, instruction);
+    std::string version = std::to_string(presenceVersion);
+    uint32_t length = htonl(static_cast<uint32_t>(version.size()));
+    data.insert(data.end(), reinterpret_cast<char*>(&length), reinterpret_cast<char*>(&length) + sizeof(length));
+    data.insert(data.end(), version.begin(), version.end());
+    socket->SendData(data);
+}
+
+void MyCanvas::attachHistory(const QString &peer, MessageDisplay *display){
+#ifdef CHAT_HISTORY
+    // 打开会话时取最新一页，滚动到顶部时继续向前翻页
+    connect(display, &MessageDisplay::reachedTop, this, [=](){ fetchHistory(peer); });
+    fetchHistory(peer);
+#else
+    // 旧的 socketlearn_static.lib 不会读取 history_msg 帧的长度和载荷，收到后整个连接错位
+    Q_UNUSED(peer);
+    Q_UNUSED(display);
+#endif
+}
+
+void MyCanvas::fetchHistory(const QString &peer){
+    historyState &state = historyMap[peer];
+    if(state.pending || (state.loaded && state.cursor == 0)) return;
+    // 指令后跟 长度 + 二进制查询载荷
+    WireWriter writer;
+    writer.PutString(kHistoryPeer, peer.toStdString());
+    writer.PutVarint(kHistoryBefore, state.cursor);
+    writer.PutVarint(kHistoryLimit, 50);
+    std::string query = writer.Take();
+    uint32_t instruction = static_cast<uint32_t>(InstructionType::fetch_history);
+    vector<char> data = socket->GenerateMessage(MessageType::instruction, instruction);
+    uint32_t length = htonl(static_cast<uint32_t>(query.size()));
+    data.insert(data.end(), reinterpret_cast<char*>(&length), reinterpret_cast<char*>(&length) + sizeof(length));
+    data.insert(data.end(), query.begin(), query.end());
+    socket->SendData(data);
+    state.pending = true;
+}
+
+void MyCanvas::applyHistoryPage(const QString &message){
+    // 载荷按 Latin-1 逐字节转成了字符串，还原成字节后解码
+    QByteArray payload = message.toLatin1();
+    WireReader reader(payload.constData(), static_cast<size_t>(payload.size()));
+    WireReader::Field field;
+    QString peer;
+    quint64 cursor = 0;
+    vector<WireView> entries;
+    while(reader.Next(field)){
+        if(field.number == kHistoryPagePeer && field.type == kBytes) peer = QString::fromUtf8(field.bytes.data, static_cast<int>(field.bytes.size));
+        else if(field.number == kHistoryPageCursor && field.type == kVarint) cursor = field.value;
+        else if(field.number == kHistoryPageEntry && field.type == kBytes) entries.push_back(field.bytes);
+    }
+    if(reader.Error() || peer.isEmpty()) return;
+    historyState &state = historyMap[peer];
+    state.pending = false;
+    state.loaded = true;
+    state.cursor = cursor;
+
+    QMutexLocker locker(&mutex);
+    if(userMap.find(peer) == userMap.end()) return;
+    MessageDisplay *messageDisplay = userMap[peer].messageDisplay;
+    // 条目按时间升序，倒序逐条插到最上方
+    for(auto it = entries.rbegin(); it != entries.rend(); ++it){
+        WireReader entryReader(it->data, it->size);
+        QString from;
+        QByteArray body;
+        while(entryReader.Next(field)){
+            if(field.number == kHistoryEntrySender && field.type == kBytes) from = QString::fromUtf8(field.bytes.data, static_cast<int>(field.bytes.size));
+            else if(field.number == kHistoryEntryBody && field.type == kBytes) body = QByteArray(field.bytes.data, static_cast<int>(field.bytes.size));
+        }
+        Message msg = Message::deserialize(body);
+        if(msg.type != fileType::Text) continue;
+        if(from == g_links.CurrentLogin)
+            messageDisplay->prependMessage(new MessageItem("我", QString::fromUtf8(msg.data.data()), msg.timestamp, MessageItem::Right));
+        else
+            messageDisplay->prependMessage(new MessageItem(from, QString::fromUtf8(msg.data.data()), msg.timestamp, MessageItem::Left));
+    }
+}
+
 void MyCanvas::handleReadyRead(QString message){
-    QStringList parts = message.split("|");
-    if(parts.size() < 2) return;
-    QString from = parts.at(0);
-    QString data = parts.at(1);
-    QByteArray messageData = data.toUtf8();
+    // 发送者|消息体，消息体本身可能含有 '|'，只按第一个分隔
+    int sep = message.indexOf("|");
+    if(sep == -1) return;
+    QString from = message.left(sep);
+    QByteArray messageData = message.mid(sep + 1).toLatin1();
     Message msg = Message::deserialize(messageData);
     if(msg.type == fileType::Text){
         MessageDisplay *messageDisplay;
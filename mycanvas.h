@@ -7,6 +7,7 @@
 #include <QTextBrowser>
 #include "WebCrawler.h"
 #include "socketlearn.h"
+#include "wireschema.h"
 #include "links.h"
 #include <QMessageBox>
 #include "player.h"
@@ -28,6 +29,12 @@ private:
         MessageDisplay *messageDisplay;
         selectionItem *selectItem;
     };
+    // 每个会话的聊天记录翻页状态
+    struct historyState{
+        quint64 cursor;  // 下一页的游标，0 且 loaded 表示没有更早的消息
+        bool loaded;
+        bool pending;    // 请求已发出尚未收到响应
+    };
     QString canvasName;
     QString canvasDescription = "";
 
@@ -49,6 +56,8 @@ private:
     int type;
     bool generateForest = false;
     unordered_map<QString, onlineUser> userMap;
+    unordered_map<QString, historyState> historyMap;
+    quint64 presenceVersion = 0; // 最后应用的在线状态版本号，0 表示尚未收到快照
     MessageDisplay *currentMessageDisplay;
 
     // Novel manager
@@ -63,6 +72,10 @@ private:
     void Init();
     void SaveToFile(const QString &path);
     void handleReadyRead(QString message);
+    void applyPresenceChanges(const QString &changes);
+    void attachHistory(const QString &peer, MessageDisplay *display);
+    void fetchHistory(const QString &peer);
+    void applyHistoryPage(const QString &message);
 
 public:
     explicit MyCanvas(int radius, QString name = "", socketlearn *socket = nullptr, QWidget *parent = nullptr);
@@ -73,6 +86,8 @@ public:
     SlidePage *CavlayerPage(){return layerPage;}
 
     QTimer *socketTimerout;
+    // 带着最后看到的版本号订阅在线状态，服务端只补发缺失的增量
+    void subscribePresence();
 public slots:
     void on_receiveMessage(const QString &message, const MessageType &type);
 signals:
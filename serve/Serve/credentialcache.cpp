@@ -0,0 +1,60 @@
+#include "credentialcache.h"
+
+CredentialCache::CredentialCache(size_t shardCount)
+    : shards_(new Shard[shardCount > 0 ? shardCount : 1]),
+      shard_count_(shardCount > 0 ? shardCount : 1),
+      size_(0)
+{
+}
+
+CredentialCache::Shard &CredentialCache::ShardFor(const std::string &username) const
+{
+    return shards_[std::hash<std::string>()(username) % shard_count_];
+}
+
+bool CredentialCache::Lookup(const std::string &username, std::string &stored) const
+{
+    Shard &shard = ShardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.users.find(username);
+    if(it == shard.users.end()) return false;
+    stored = it->second;
+    return true;
+}
+
+bool CredentialCache::Contains(const std::string &username) const
+{
+    Shard &shard = ShardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.users.find(username) != shard.users.end();
+}
+
+void CredentialCache::Put(const std::string &username, const std::string &stored)
+{
+    Shard &shard = ShardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto result = shard.users.emplace(username, stored);
+    if(result.second) {
+        size_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        result.first->second = stored;
+    }
+}
+
+void CredentialCache::Erase(const std::string &username)
+{
+    Shard &shard = ShardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if(shard.users.erase(username) > 0) {
+        size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void CredentialCache::Clear()
+{
+    for(size_t i = 0; i < shard_count_; ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        size_.fetch_sub(shards_[i].users.size(), std::memory_order_relaxed);
+        shards_[i].users.clear();
+    }
+}
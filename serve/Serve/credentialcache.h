@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+// 内存中的账号表：用户名 -> 口令存储值（PasswordHasher 格式，或尚未迁移的明文），启动时从数据库整表加载，
+// 注册/改密/注销/迁移成功落库后同步更新。登录只在这里取存储值，不再访问数据库；
+// 按用户名哈希分条带加锁，与在线用户表相同。
+class CredentialCache {
+public:
+    explicit CredentialCache(size_t shardCount = 64);
+
+    // 取口令存储值，用户不存在时返回 false
+    bool Lookup(const std::string &username, std::string &stored) const;
+    bool Contains(const std::string &username) const;
+
+    // 新增或覆盖；由存储层的完成回调按落库顺序调用，与数据库保持一致
+    void Put(const std::string &username, const std::string &stored);
+    void Erase(const std::string &username);
+    void Clear();
+
+    size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, std::string> users;
+        char pad[64]; // 相邻条带的锁放在不同缓存行
+    };
+
+    Shard &ShardFor(const std::string &username) const;
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_count_;
+    std::atomic<size_t> size_;
+};
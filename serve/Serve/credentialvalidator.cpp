@@ -0,0 +1,69 @@
+#include "credentialvalidator.h"
+#include <cstdint>
+
+namespace {
+
+// 字节分类表：ASCII 字母数字为 kAlnum，可能开启一个目标汉字三字节序列的首字节为 kCjkLead
+enum ByteClass : uint8_t {
+    kInvalid = 0,
+    kAlnum = 1,
+    kCjkLead = 2
+};
+
+struct ByteTable {
+    uint8_t classes[256];
+    ByteTable()
+    {
+        for(int c = 0; c < 256; ++c) {
+            bool alnum = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+            classes[c] = alnum ? kAlnum : kInvalid;
+        }
+        // U+4E00..U+9FA5 的 UTF-8 首字节为 0xE4..0xE9
+        for(int c = 0xE4; c <= 0xE9; ++c) classes[c] = kCjkLead;
+    }
+};
+
+const ByteTable kTable;
+
+inline bool IsContinuation(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+} // namespace
+
+bool CredentialValidator::IsValidPassword(const std::string &password)
+{
+    if(password.empty()) return false;
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(password.data());
+    const unsigned char *end = p + password.size();
+    for(; p != end; ++p) {
+        if(kTable.classes[*p] != kAlnum) return false;
+    }
+    return true;
+}
+
+bool CredentialValidator::IsValidUsername(const std::string &username)
+{
+    if(username.empty()) return false;
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(username.data());
+    const unsigned char *end = p + username.size();
+    while(p != end) {
+        switch(kTable.classes[*p]) {
+            case kAlnum:
+                ++p;
+                break;
+            case kCjkLead:
+                {
+                    // 严格解码一个三字节序列，并检查码点范围
+                    if(end - p < 3 || !IsContinuation(p[1]) || !IsContinuation(p[2])) return false;
+                    uint32_t cp = (static_cast<uint32_t>(p[0] & 0x0F) << 12) |
+                                  (static_cast<uint32_t>(p[1] & 0x3F) << 6) |
+                                  static_cast<uint32_t>(p[2] & 0x3F);
+                    if(cp < 0x4E00 || cp > 0x9FA5) return false;
+                    p += 3;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+// 用户名/密码格式校验，取代每次调用都重新构造的 std::regex。
+// 用户名：英文字母、数字或 CJK 统一汉字（U+4E00..U+9FA5，按 UTF-8 解码判断）；
+// 密码：英文字母和数字。均不能为空。
+// 校验表在静态初始化时建好，之后每个字节只做一次查表。
+class CredentialValidator {
+public:
+    static bool IsValidUsername(const std::string &username);
+    static bool IsValidPassword(const std::string &password);
+};
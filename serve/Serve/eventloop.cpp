@@ -0,0 +1,537 @@
+#include "eventloop.h"
+#include "iouring.h"
+#include "logger.h"
+#include "metrics.h"
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const int kMaxEvents = 256;
+// io_uring 提交队列长度与接收缓冲区：每个循环 512 块 × 4KB，由所有连接共享
+static const unsigned kUringEntries = 1024;
+static const uint16_t kRecvGroup = 0;
+static const unsigned kRecvBuffers = 512;
+static const size_t kRecvBufferSize = 4096;
+// 多发 accept 出错终止（例如 fd 耗尽）后重新提交前的等待时间
+static const int64_t kAcceptRetryMs = 100;
+// 有请求因提交队列已满而等待重试时，等待完成事件的最长时间
+static const int kDeferredRetryMs = 1;
+
+const int EventLoop::kSendChunkIov;
+
+// 当前线程正在运行的事件循环，用于判断调用方是否处于循环线程
+static thread_local EventLoop* t_current_loop = nullptr;
+
+int64_t EventLoop::NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EventLoop::EventLoop(int timerTickMs, Backend backend)
+    : epoll_fd_(-1),
+      wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      quit_(false),
+      looping_(false),
+      calling_pending_functors_(false),
+      timers_(timerTickMs)
+{
+    if(wakeup_fd_ < 0) {
+        LOG_ERROR << "eventfd: " << LogErrno();
+    }
+    if(backend == kUring) {
+        ring_.reset(new IoUring);
+        if(!ring_->Init(kUringEntries)) {
+            LOG_WARN << "io_uring 初始化失败，改用 epoll";
+            ring_.reset();
+        }
+    }
+    if(ring_) {
+        AddFd(wakeup_fd_, EPOLLIN, [this](uint32_t) { HandleWakeup(); });
+        return;
+    }
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd_ < 0) {
+        LOG_ERROR << "epoll_create1: " << LogErrno();
+    }
+    // wakeup fd 使用电平触发，保证跨线程投递的任务一定能被处理
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeup_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+}
+
+EventLoop::~EventLoop()
+{
+    // 先关闭环（内核取消未完成的请求），再释放请求中保存的回调与缓冲
+    ring_.reset();
+    for(auto &pair : uring_ops_) {
+        for(UringOp *op : pair.second) delete op;
+    }
+    for(UringOp *op : retired_ops_) delete op;
+    close(wakeup_fd_);
+    if(epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool EventLoop::UringSupported()
+{
+    return IoUring::Supported();
+}
+
+void EventLoop::Loop()
+{
+    t_current_loop = this;
+    looping_ = true;
+    quit_ = false;
+    if(ring_) {
+        LoopUring();
+        looping_ = false;
+        t_current_loop = nullptr;
+        return;
+    }
+    struct epoll_event events[kMaxEvents];
+
+    while(!quit_) {
+        // 有定时器时最多睡到下一个 tick，否则一直阻塞到有事件为止
+        int timeout = -1;
+        if(timers_.Size() > 0) {
+            timeout = static_cast<int>(timers_.MsUntilNextTick(NowMs()));
+        }
+        int n = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+        Metrics::Increment(Metrics::kNetworkSyscalls);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            LOG_ERROR << "epoll_wait: " << LogErrno();
+            break;
+        }
+        for(int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if(fd == wakeup_fd_) {
+                HandleWakeup();
+                continue;
+            }
+            auto it = handlers_.find(fd);
+            if(it == handlers_.end()) continue;
+            // 先持有回调的引用，回调中可能会 RemoveFd 自身
+            std::shared_ptr<IoCallback> cb = it->second;
+            (*cb)(events[i].events);
+        }
+        DoPendingFunctors();
+        timers_.Advance(NowMs());
+    }
+    DoPendingFunctors();
+    looping_ = false;
+    t_current_loop = nullptr;
+}
+
+void EventLoop::Quit()
+{
+    quit_ = true;
+    if(!IsInLoopThread()) {
+        Wakeup();
+    }
+}
+
+bool EventLoop::IsInLoopThread() const
+{
+    return t_current_loop == this;
+}
+
+void EventLoop::LoopUring()
+{
+    while(!quit_) {
+        int timeout = -1;
+        if(timers_.Size() > 0) {
+            timeout = static_cast<int>(timers_.MsUntilNextTick(NowMs()));
+        }
+        if(!unarmed_ops_.empty() || !uncancelled_ops_.empty()) {
+            timeout = timeout < 0 ? kDeferredRetryMs : std::min(timeout, kDeferredRetryMs);
+        }
+        // 上一轮准备的所有请求（发送、重新提交的多发请求、取消）与等待合并为一次系统调用
+        ring_->Submit(true, timeout);
+        RetryDeferredOps();
+        for(UringOp *op : retired_ops_) delete op;
+        retired_ops_.clear();
+        struct io_uring_cqe *cqe;
+        while((cqe = ring_->PeekCqe()) != nullptr) {
+            UringOp *op = reinterpret_cast<UringOp*>(cqe->user_data);
+            int32_t res = cqe->res;
+            uint32_t flags = cqe->flags;
+            ring_->SeenCqe();
+            // 取消请求自身的完成事件 user_data 为 0
+            if(op) HandleCompletion(op, res, flags);
+        }
+        DoPendingFunctors();
+        timers_.Advance(NowMs());
+    }
+    DoPendingFunctors();
+}
+
+EventLoop::UringOp *EventLoop::NewOp(UringOp::Kind kind, int fd)
+{
+    UringOp *op = new UringOp;
+    op->kind = kind;
+    op->fd = fd;
+    uring_ops_[fd].push_back(op);
+    return op;
+}
+
+void EventLoop::ArmOp(UringOp *op)
+{
+    struct io_uring_sqe *sqe = ring_->GetSqe();
+    if(!sqe) {
+        // 请求仍登记在 uring_ops_ 中，下一次提交之后重新准备，不能就此丢弃，否则该 fd 再也收不到事件
+        LOG_WARN << "io_uring 提交队列已满，fd " << op->fd << " 的请求推迟到下一次提交";
+        op->deferred = true;
+        unarmed_ops_.push_back(op);
+        return;
+    }
+    sqe->fd = op->fd;
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+    switch(op->kind) {
+        case UringOp::kPoll:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->poll32_events = op->events;
+            break;
+        case UringOp::kAccept:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+        case UringOp::kRecv:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = kRecvGroup;
+            break;
+        case UringOp::kSend:
+            break;
+    }
+}
+
+void EventLoop::CancelOp(UringOp *op)
+{
+    if(op->cancelled) return;
+    op->cancelled = true;
+    // 尚未交给内核的请求无需取消，重试时直接释放
+    if(op->deferred) return;
+    struct io_uring_sqe *sqe = ring_->GetSqe();
+    if(!sqe) {
+        LOG_WARN << "io_uring 提交队列已满，fd " << op->fd << " 的取消请求推迟到下一次提交";
+        uncancelled_ops_.push_back(op);
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(op);
+    sqe->user_data = 0;
+}
+
+void EventLoop::ReleaseOp(UringOp *op)
+{
+    auto it = uring_ops_.find(op->fd);
+    if(it != uring_ops_.end()) {
+        std::vector<UringOp*> &ops = it->second;
+        ops.erase(std::remove(ops.begin(), ops.end(), op), ops.end());
+        if(ops.empty()) uring_ops_.erase(it);
+    }
+    uncancelled_ops_.erase(std::remove(uncancelled_ops_.begin(), uncancelled_ops_.end(), op), uncancelled_ops_.end());
+    retired_ops_.push_back(op);
+}
+
+void EventLoop::RetryDeferredOps()
+{
+    std::vector<UringOp*> cancels;
+    cancels.swap(uncancelled_ops_);
+    for(UringOp *op : cancels) {
+        op->cancelled = false;
+        CancelOp(op);
+    }
+    std::vector<UringOp*> ops;
+    ops.swap(unarmed_ops_);
+    for(UringOp *op : ops) {
+        op->deferred = false;
+        if(op->live && !op->cancelled) {
+            ArmOp(op);
+            continue;
+        }
+        // 等待期间被取消：与内核中的请求被取消时一样，recv 以 -ECANCELED 回调一次
+        if(op->live && op->kind == UringOp::kRecv) op->recv(nullptr, -ECANCELED);
+        ReleaseOp(op);
+    }
+}
+
+void EventLoop::HandleCompletion(UringOp *op, int32_t res, uint32_t flags)
+{
+    bool more = (flags & IORING_CQE_F_MORE) != 0;
+    switch(op->kind) {
+        case UringOp::kPoll: {
+            if(op->live && res > 0) {
+                // 先持有回调的引用，回调中可能会 RemoveFd 自身
+                std::shared_ptr<IoCallback> cb = op->io;
+                (*cb)(static_cast<uint32_t>(res));
+            }
+            if(more) return;
+            if(op->live && !op->cancelled && res >= 0) {
+                ArmOp(op);
+            } else {
+                ReleaseOp(op);
+            }
+            return;
+        }
+        case UringOp::kAccept: {
+            if(res >= 0) {
+                if(op->live) {
+                    op->accept(res);
+                } else {
+                    close(res);
+                }
+            } else if(res != -ECANCELED && op->live) {
+                LOG_ERROR << "accept: " << strerror(-res);
+            }
+            if(more) return;
+            if(!op->live || op->cancelled) {
+                ReleaseOp(op);
+            } else if(res >= 0) {
+                ArmOp(op);
+            } else {
+                // 出错终止（例如 fd 耗尽），稍后再接受，避免立即重试空转
+                RunAfter(kAcceptRetryMs, [this, op]() {
+                    if(op->live && !op->cancelled) {
+                        ArmOp(op);
+                    } else {
+                        ReleaseOp(op);
+                    }
+                });
+            }
+            return;
+        }
+        case UringOp::kRecv: {
+            if(flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+                if(res > 0 && op->live) op->recv(ring_->Buffer(bid), res);
+                ring_->RecycleBuffer(bid);
+            } else if(res == -ENOBUFS) {
+                // 共享接收缓冲区暂时用尽，已处理的缓冲区都已归还，下面重新提交
+            } else if(op->live) {
+                op->recv(nullptr, res);
+            }
+            if(more) return;
+            if(op->live && !op->cancelled && (res > 0 || res == -ENOBUFS)) {
+                ArmOp(op);
+            } else {
+                // 已取消的请求恰好以数据或 ENOBUFS 结束时没有 -ECANCELED 完成事件，补一次，调用方据此确认已停止
+                if(op->live && op->cancelled && (res > 0 || res == -ENOBUFS)) op->recv(nullptr, -ECANCELED);
+                ReleaseOp(op);
+            }
+            return;
+        }
+        case UringOp::kSend: {
+            if(res > 0) {
+                op->sent += res;
+            } else if(res < 0 && res != -ECANCELED && op->error == 0) {
+                op->error = res;
+            }
+            // 链中某个 sendmsg 出错或只发出一部分时，其后的 sendmsg 以 -ECANCELED 结束
+            if(--op->remaining > 0) return;
+            if(op->live) op->send(op->sent > 0 ? op->sent : op->error);
+            ReleaseOp(op);
+            return;
+        }
+    }
+}
+
+void EventLoop::AcceptMultishot(int listenFd, AcceptCallback cb)
+{
+    UringOp *op = NewOp(UringOp::kAccept, listenFd);
+    op->accept = std::move(cb);
+    ArmOp(op);
+}
+
+void EventLoop::RecvMultishot(int fd, RecvCallback cb)
+{
+    // 第一个 recv 请求提交前注册接收缓冲区，只负责 accept 的循环不占用这部分内存
+    if(!ring_->HasBuffers() && !ring_->SetupBuffers(kRecvGroup, kRecvBuffers, kRecvBufferSize)) {
+        LOG_ERROR << "注册 io_uring 接收缓冲区失败";
+        return;
+    }
+    UringOp *op = NewOp(UringOp::kRecv, fd);
+    op->recv = std::move(cb);
+    ArmOp(op);
+}
+
+void EventLoop::CancelRecv(int fd)
+{
+    auto it = uring_ops_.find(fd);
+    if(it == uring_ops_.end()) return;
+    for(UringOp *op : it->second) {
+        if(op->kind == UringOp::kRecv) CancelOp(op);
+    }
+}
+
+void EventLoop::Send(int fd, const struct iovec *iov, int iovcnt, SendCallback cb)
+{
+    unsigned chunks = static_cast<unsigned>((iovcnt + kSendChunkIov - 1) / kSendChunkIov);
+    // 链接的 SQE 必须在同一次提交中，先留出足够的位置；腾不出位置时在下一轮循环中以错误回调
+    if(!ring_->Reserve(chunks)) {
+        LOG_WARN << "io_uring 提交队列已满，fd " << fd << " 的发送失败";
+        QueueInLoop([cb]() { cb(-EAGAIN); });
+        return;
+    }
+    UringOp *op = NewOp(UringOp::kSend, fd);
+    op->send = std::move(cb);
+    op->iov.assign(iov, iov + iovcnt);
+    op->msgs.resize(chunks);
+    op->remaining = chunks;
+    for(unsigned i = 0; i < chunks; ++i) {
+        struct msghdr &msg = op->msgs[i];
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &op->iov[i * kSendChunkIov];
+        msg.msg_iovlen = std::min(kSendChunkIov, iovcnt - static_cast<int>(i) * kSendChunkIov);
+        struct io_uring_sqe *sqe = ring_->GetSqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&msg);
+        sqe->len = 1;
+        // 与 OutputBuffer 相同带上 MSG_NOSIGNAL，对端关闭时不触发 SIGPIPE
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = reinterpret_cast<uint64_t>(op);
+        if(i + 1 < chunks) sqe->flags = IOSQE_IO_LINK;
+    }
+}
+
+bool EventLoop::AddFd(int fd, uint32_t events, IoCallback cb)
+{
+    if(ring_) {
+        // io_uring 的多发 poll 本身就是边沿触发
+        UringOp *op = NewOp(UringOp::kPoll, fd);
+        op->events = events;
+        op->io = std::make_shared<IoCallback>(std::move(cb));
+        ArmOp(op);
+        return true;
+    }
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    Metrics::Increment(Metrics::kNetworkSyscalls);
+    if(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG_ERROR << "epoll_ctl: add: " << LogErrno();
+        return false;
+    }
+    handlers_[fd] = std::make_shared<IoCallback>(std::move(cb));
+    return true;
+}
+
+bool EventLoop::ModifyFd(int fd, uint32_t events)
+{
+    if(ring_) {
+        // 取消原来的 poll，以新的事件集合重新提交，回调不变
+        auto it = uring_ops_.find(fd);
+        if(it == uring_ops_.end()) return false;
+        std::vector<UringOp*> ops = it->second;
+        for(UringOp *op : ops) {
+            if(op->kind != UringOp::kPoll || !op->live) continue;
+            op->live = false;
+            CancelOp(op);
+            UringOp *updated = NewOp(UringOp::kPoll, fd);
+            updated->events = events;
+            updated->io = op->io;
+            ArmOp(updated);
+            return true;
+        }
+        return false;
+    }
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    Metrics::Increment(Metrics::kNetworkSyscalls);
+    if(epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        LOG_ERROR << "epoll_ctl: mod: " << LogErrno();
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::RemoveFd(int fd)
+{
+    if(ring_) {
+        // 请求在最后一个完成事件到达后才释放，期间回调持有的对象（连接、待发送的帧）保持有效
+        auto it = uring_ops_.find(fd);
+        if(it == uring_ops_.end()) return;
+        for(UringOp *op : it->second) {
+            op->live = false;
+            CancelOp(op);
+        }
+        return;
+    }
+    Metrics::Increment(Metrics::kNetworkSyscalls);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    handlers_.erase(fd);
+}
+
+void EventLoop::RunInLoop(Functor cb)
+{
+    if(IsInLoopThread()) {
+        cb();
+    } else {
+        QueueInLoop(std::move(cb));
+    }
+}
+
+void EventLoop::QueueInLoop(Functor cb)
+{
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_functors_.push_back(std::move(cb));
+    }
+    // 非循环线程投递，或正在执行待处理任务时投递，都需要唤醒以免任务滞留
+    if(!IsInLoopThread() || calling_pending_functors_) {
+        Wakeup();
+    }
+}
+
+TimerWheel::TimerHandle EventLoop::RunAfter(int64_t delayMs, Functor cb)
+{
+    return timers_.Add(NowMs(), delayMs, std::move(cb));
+}
+
+void EventLoop::CancelTimer(const TimerWheel::TimerHandle &timer)
+{
+    TimerWheel::Cancel(timer);
+}
+
+void EventLoop::Wakeup()
+{
+    uint64_t one = 1;
+    Metrics::Increment(Metrics::kNetworkSyscalls);
+    ssize_t n = write(wakeup_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void EventLoop::HandleWakeup()
+{
+    uint64_t value;
+    Metrics::Increment(Metrics::kNetworkSyscalls);
+    ssize_t n = read(wakeup_fd_, &value, sizeof(value));
+    (void)n;
+}
+
+void EventLoop::DoPendingFunctors()
+{
+    std::vector<Functor> functors;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        functors.swap(pending_functors_);
+    }
+    calling_pending_functors_ = true;
+    for(auto &f : functors) {
+        f();
+    }
+    calling_pending_functors_ = false;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "timerwheel.h"
+
+class IoUring;
+
+// 事件循环：每个循环由单一线程驱动，负责其名下所有 fd 的读写事件；其他线程通过 QueueInLoop 投递任务。
+// 默认基于 epoll（边沿触发）。kUring 后端改用 io_uring：AddFd 注册的 fd 用多发 poll 通知，
+// 另外提供完成式的多发 accept、内核选择缓冲区的多发 recv 与链接的 sendmsg，
+// 一轮循环中准备的所有请求与等待完成合并为一次 io_uring_enter。
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> IoCallback;
+    typedef std::function<void()> Functor;
+    // 以下回调仅用于 kUring 后端
+    typedef std::function<void(int fd)> AcceptCallback;
+    // n > 0 为收到的数据（仅在回调期间有效），0 为对端关闭，< 0 为 -errno；
+    // CancelRecv 取消后以 -ECANCELED 回调一次
+    typedef std::function<void(const char *data, ssize_t n)> RecvCallback;
+    // 整条发送链结束后回调：已发送的总字节数（可能少于请求的字节数），一个字节都未发出且出错时为 -errno
+    typedef std::function<void(ssize_t sent)> SendCallback;
+
+    enum Backend {
+        kEpoll,
+        kUring
+    };
+
+    // backend 为 kUring 但内核不支持时退回 epoll
+    explicit EventLoop(int timerTickMs = 100, Backend backend = kEpoll);
+    ~EventLoop();
+
+    bool UsesUring() const { return ring_ != nullptr; }
+    static bool UringSupported();
+
+    // 运行事件循环，直到 Quit() 被调用
+    void Loop();
+    void Quit();
+    bool IsInLoopThread() const;
+
+    // 注册/修改/移除 fd，events 为 EPOLLIN、EPOLLOUT 等组合（内部自动加上 EPOLLET）。
+    // RemoveFd 同时取消该 fd 上所有未完成的 io_uring 请求，之后不再回调
+    bool AddFd(int fd, uint32_t events, IoCallback cb);
+    bool ModifyFd(int fd, uint32_t events);
+    void RemoveFd(int fd);
+
+    // 以下仅 kUring 后端可用，只能在循环线程（或循环启动前）调用。
+    // 多发 accept：新连接已设置 SOCK_NONBLOCK | SOCK_CLOEXEC
+    void AcceptMultishot(int listenFd, AcceptCallback cb);
+    // 多发 recv：数据由内核直接写入循环的共享接收缓冲区，回调返回后缓冲区立即归还
+    void RecvMultishot(int fd, RecvCallback cb);
+    // 取消 fd 上的 recv，但仍投递取消前已收到的数据，最后以 -ECANCELED 回调
+    void CancelRecv(int fd);
+    // 按顺序发送 iov（调用方保证数据在回调之前有效），每 kSendChunkIov 段一个 sendmsg，前后用 IOSQE_IO_LINK 链接
+    void Send(int fd, const struct iovec *iov, int iovcnt, SendCallback cb);
+
+    // 在循环线程中执行：若当前就是循环线程则立即执行，否则排队并唤醒循环
+    void RunInLoop(Functor cb);
+    void QueueInLoop(Functor cb);
+
+    // 在 delayMs 毫秒后于循环线程中执行 cb，只能在循环线程中调用；
+    // 定时器由本循环的分层时间轮管理，精度为一个 tick
+    TimerWheel::TimerHandle RunAfter(int64_t delayMs, Functor cb);
+    void CancelTimer(const TimerWheel::TimerHandle &timer);
+
+    // 单调时钟毫秒数
+    static int64_t NowMs();
+
+    static const int kSendChunkIov = 64;
+
+private:
+    // 一个 io_uring 请求（多发请求与发送链各对应一个），SQE 的 user_data 指向它，最后一个完成事件到达时释放
+    struct UringOp {
+        enum Kind { kPoll, kAccept, kRecv, kSend };
+        Kind kind;
+        int fd;
+        bool live = true; // RemoveFd 后置为 false，此后的完成事件只回收资源
+        bool cancelled = false; // 已提交取消请求
+        bool deferred = false;  // 提交队列已满，尚未交给内核，等待下一次提交之后重试
+        uint32_t events = 0;
+        std::shared_ptr<IoCallback> io;
+        AcceptCallback accept;
+        RecvCallback recv;
+        SendCallback send;
+        std::vector<struct iovec> iov;
+        std::vector<struct msghdr> msgs;
+        unsigned remaining = 0; // 发送链中尚未完成的 sendmsg 数
+        ssize_t sent = 0;
+        int error = 0;
+    };
+
+    void Wakeup();
+    void HandleWakeup();
+    void DoPendingFunctors();
+
+    void LoopUring();
+    UringOp *NewOp(UringOp::Kind kind, int fd);
+    void ArmOp(UringOp *op);
+    void CancelOp(UringOp *op);
+    void ReleaseOp(UringOp *op);
+    void RetryDeferredOps();
+    void HandleCompletion(UringOp *op, int32_t res, uint32_t flags);
+
+    int epoll_fd_;
+    int wakeup_fd_;
+    std::atomic<bool> quit_;
+    std::atomic<bool> looping_;
+
+    // fd -> 回调；用 shared_ptr 保存，保证回调在执行期间移除自身时仍然有效
+    std::unordered_map<int, std::shared_ptr<IoCallback>> handlers_;
+
+    std::mutex pending_mutex_;
+    std::vector<Functor> pending_functors_;
+    bool calling_pending_functors_;
+
+    TimerWheel timers_;
+
+    std::unique_ptr<IoUring> ring_; // 为空表示使用 epoll
+    std::unordered_map<int, std::vector<UringOp*>> uring_ops_; // fd -> 未完成的请求
+    // 已完成但尚未释放的请求：等下一次提交之后再释放，保证已排队的取消请求不会命中复用了同一地址的新请求
+    std::vector<UringOp*> retired_ops_;
+    // 提交队列已满时未能提交的多发请求与取消请求，下一次提交腾出位置后重新准备
+    std::vector<UringOp*> unarmed_ops_;
+    std::vector<UringOp*> uncancelled_ops_;
+};
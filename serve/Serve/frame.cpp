@@ -0,0 +1,30 @@
+#include "frame.h"
+#include <cstring>
+#include <arpa/inet.h>
+
+Frame::Frame(std::vector<char> bytes)
+    : buf_(std::make_shared<const std::vector<char>>(std::move(bytes))),
+      offset_(0),
+      length_(buf_->size())
+{
+}
+
+Frame Frame::Encode(uint8_t type, const char *data, size_t size)
+{
+    uint32_t netLength = htonl(static_cast<uint32_t>(size));
+    std::vector<char> buffer(1 + sizeof(netLength) + size);
+    buffer[0] = static_cast<char>(type);
+    memcpy(buffer.data() + 1, &netLength, sizeof(netLength));
+    if(size > 0) memcpy(buffer.data() + 1 + sizeof(netLength), data, size);
+    return Frame(std::move(buffer));
+}
+
+Frame Frame::Slice(size_t offset, size_t length) const
+{
+    Frame slice(*this);
+    if(offset > length_) offset = length_;
+    if(length > length_ - offset) length = length_ - offset;
+    slice.offset_ = offset_ + offset;
+    slice.length_ = length;
+    return slice;
+}
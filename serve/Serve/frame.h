@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// 引用计数的不可变消息帧（共享切片）：同一帧可以同时排入任意多个连接的发送队列，
+// 入队只增加引用计数，不复制数据；写出时直接把底层缓冲交给 writev。
+class Frame {
+public:
+    Frame() : offset_(0), length_(0) {}
+    // 接管已编码好的字节
+    explicit Frame(std::vector<char> bytes);
+
+    // 编码为 类型(1) + 网络序长度(4) + 数据，只分配一次缓冲
+    static Frame Encode(uint8_t type, const char *data, size_t size);
+    static Frame Encode(uint8_t type, const std::string &payload) {
+        return Encode(type, payload.data(), payload.size());
+    }
+
+    // 同一缓冲上的子切片，不复制数据
+    Frame Slice(size_t offset, size_t length) const;
+
+    const char *data() const { return buf_ ? buf_->data() + offset_ : nullptr; }
+    size_t size() const { return length_; }
+    bool empty() const { return length_ == 0; }
+    // 共享同一缓冲的帧数，便于观察扇出时的复用情况
+    long use_count() const { return buf_.use_count(); }
+
+private:
+    std::shared_ptr<const std::vector<char>> buf_;
+    size_t offset_;
+    size_t length_;
+};
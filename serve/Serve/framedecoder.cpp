@@ -0,0 +1,144 @@
+#include "framedecoder.h"
+#include "protocol.h"
+#include "wireschema.h"
+#include <cstring>
+#include <arpa/inet.h>
+
+FrameDecoder::FrameDecoder(size_t initialCapacity, size_t maxFrameSize)
+    : read_pos_(0),
+      write_pos_(0),
+      max_frame_size_(maxFrameSize)
+{
+    size_t size = 64;
+    while(size < initialCapacity) size <<= 1;
+    buffer_.reset(new char[size]);
+    mask_ = size - 1;
+}
+
+void FrameDecoder::Reserve(size_t minSpace)
+{
+    size_t readable = Readable();
+    if(Capacity() - readable >= minSpace) return;
+    size_t size = Capacity();
+    while(size - readable < minSpace) size <<= 1;
+    // 扩容时把未读数据搬到新缓冲区开头
+    std::unique_ptr<char[]> buffer(new char[size]);
+    Peek(0, buffer.get(), readable);
+    buffer_.swap(buffer);
+    mask_ = size - 1;
+    read_pos_ = 0;
+    write_pos_ = readable;
+}
+
+int FrameDecoder::PrepareWrite(struct iovec iov[2], size_t minSpace)
+{
+    Reserve(minSpace);
+    size_t capacity = Capacity();
+    size_t free = capacity - Readable();
+    size_t start = static_cast<size_t>(write_pos_) & mask_;
+    size_t first = capacity - start < free ? capacity - start : free;
+    iov[0].iov_base = buffer_.get() + start;
+    iov[0].iov_len = first;
+    if(first == free) return 1;
+    iov[1].iov_base = buffer_.get();
+    iov[1].iov_len = free - first;
+    return 2;
+}
+
+void FrameDecoder::CommitWrite(size_t n)
+{
+    write_pos_ += n;
+}
+
+void FrameDecoder::Append(const char *data, size_t len)
+{
+    struct iovec iov[2];
+    int count = PrepareWrite(iov, len);
+    for(int i = 0; i < count && len > 0; ++i) {
+        size_t n = iov[i].iov_len < len ? iov[i].iov_len : len;
+        memcpy(iov[i].iov_base, data, n);
+        data += n;
+        len -= n;
+        CommitWrite(n);
+    }
+}
+
+std::string FrameDecoder::Pending() const
+{
+    std::string data(Readable(), '\0');
+    if(!data.empty()) Peek(0, &data[0], data.size());
+    return data;
+}
+
+void FrameDecoder::Peek(size_t offset, void *dst, size_t len) const
+{
+    size_t start = static_cast<size_t>(read_pos_ + offset) & mask_;
+    size_t first = Capacity() - start < len ? Capacity() - start : len;
+    memcpy(dst, buffer_.get() + start, first);
+    if(first < len) memcpy(static_cast<char*>(dst) + first, buffer_.get(), len - first);
+}
+
+uint32_t FrameDecoder::PeekNetLength(size_t offset) const
+{
+    uint32_t netLength;
+    Peek(offset, &netLength, sizeof(netLength));
+    return ntohl(netLength);
+}
+
+FrameDecoder::Status FrameDecoder::Next(bool handshake, Message &msg)
+{
+    size_t available = Readable();
+    if(available < 1) return kNeedMore;
+    uint8_t type;
+    Peek(0, &type, 1);
+
+    size_t payloadOffset = 0;
+    size_t payloadLength = 0;
+    uint32_t instruction = 0;
+    if(handshake && (type & kWireHello)) {
+        // 协商字节只有 1 字节，不是帧
+        msg.type = type;
+        msg.instruction = 0;
+        msg.payload.clear();
+        ++read_pos_;
+        if(read_pos_ == write_pos_) read_pos_ = write_pos_ = 0;
+        return kNegotiate;
+    }
+    MessageType msgType = static_cast<MessageType>(type);
+    if(handshake || msgType == MessageType::forward_msg || msgType == MessageType::room_msg) {
+        if(available < kHeaderSize) return kNeedMore;
+        payloadLength = PeekNetLength(1);
+        payloadOffset = kHeaderSize;
+    } else if(msgType == MessageType::instruction) {
+        // 指令类型以主机字节序的 4 字节整数发送
+        if(available < 1 + sizeof(instruction)) return kNeedMore;
+        Peek(1, &instruction, sizeof(instruction));
+        payloadOffset = 1 + sizeof(instruction);
+        InstructionType instructionType = static_cast<InstructionType>(instruction);
+        if(instructionType == InstructionType::change_password ||
+           instructionType == InstructionType::subscribe_presence ||
+           instructionType == InstructionType::fetch_history ||
+           instructionType == InstructionType::create_room ||
+           instructionType == InstructionType::join_room ||
+           instructionType == InstructionType::leave_room) {
+            // 修改密码指令后跟 长度 + "旧密码|新密码"，订阅指令后跟 长度 + 十进制版本号，
+            // 拉取聊天记录指令后跟 长度 + 二进制查询载荷，聊天室指令后跟 长度 + 聊天室名
+            if(available < payloadOffset + sizeof(uint32_t)) return kNeedMore;
+            payloadLength = PeekNetLength(payloadOffset);
+            payloadOffset += sizeof(uint32_t);
+        }
+    } else {
+        payloadOffset = 1;
+    }
+    if(payloadLength > max_frame_size_) return kTooLarge;
+    if(available < payloadOffset + payloadLength) return kNeedMore;
+
+    msg.type = type;
+    msg.instruction = instruction;
+    msg.payload.resize(payloadLength);
+    if(payloadLength > 0) Peek(payloadOffset, &msg.payload[0], payloadLength);
+    read_pos_ += payloadOffset + payloadLength;
+    // 读空时回到缓冲区开头，下次 readv 尽量只用一段
+    if(read_pos_ == write_pos_) read_pos_ = write_pos_ = 0;
+    return kMessage;
+}
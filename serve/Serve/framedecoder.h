@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <sys/uio.h>
+
+// 流式消息帧解码器：每个连接一个，内部是按 2 的幂增长的环形缓冲区。
+// recv 的数据直接写入环形缓冲区，每次读取后解析出所有完整的帧，不完整的帧留待下次读取；
+// 帧长度超过上限时报告错误而不是无限缓冲。不依赖套接字，可以直接用任意切分的字节流驱动。
+class FrameDecoder {
+public:
+    struct Message {
+        uint8_t type = 0;
+        uint32_t instruction = 0; // 仅指令帧有效
+        std::string payload;
+    };
+    enum Status {
+        kMessage,  // 解析出一个完整的帧
+        kNeedMore, // 数据不足，等待下次读取
+        kTooLarge, // 帧长度超过上限，连接应当关闭
+        kNegotiate // 握手阶段的载荷编码协商字节，值在 Message::type 中
+    };
+
+    FrameDecoder(size_t initialCapacity, size_t maxFrameSize);
+
+    // 准备至少 minSpace 字节的可写空间（最多两段），供 readv 直接写入；返回段数
+    int PrepareWrite(struct iovec iov[2], size_t minSpace);
+    // 确认 readv 写入了 n 字节
+    void CommitWrite(size_t n);
+    void Append(const char *data, size_t len);
+
+    // 解析下一个帧。handshake 为 true 时（登录前）所有帧都是 类型 + 长度 + 数据；
+    // 登录后转发帧为 类型 + 长度 + 数据，指令帧为 类型 + 4 字节指令（个别指令再跟 长度 + 数据），
+    // 其余类型只有 1 字节
+    Status Next(bool handshake, Message &msg);
+
+    // 复制出尚未解析的全部数据（热重启时转交给新进程）
+    std::string Pending() const;
+    size_t Readable() const { return static_cast<size_t>(write_pos_ - read_pos_); }
+    size_t Capacity() const { return mask_ + 1; }
+
+private:
+    void Reserve(size_t minSpace);
+    void Peek(size_t offset, void *dst, size_t len) const;
+    uint32_t PeekNetLength(size_t offset) const;
+
+    std::unique_ptr<char[]> buffer_;
+    size_t mask_;
+    uint64_t read_pos_; // 单调递增的读写位置，取模后为下标
+    uint64_t write_pos_;
+    size_t max_frame_size_;
+};
@@ -0,0 +1,162 @@
+#include "handoffchannel.h"
+#include "logger.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+
+static bool FillAddress(const std::string &path, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+static bool WriteAll(int fd, const char *data, size_t len)
+{
+    while(len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool ReadAll(int fd, char *data, size_t len)
+{
+    while(len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if(n == 0) return false;
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+HandoffChannel::~HandoffChannel()
+{
+    if(fd_ >= 0) close(fd_);
+}
+
+int HandoffChannel::Listen(const std::string &path)
+{
+    struct sockaddr_un addr;
+    if(!FillAddress(path, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        LOG_ERROR << "socket: handoff: " << LogErrno();
+        return -1;
+    }
+    unlink(path.c_str());
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        LOG_ERROR << "bind: handoff: " << LogErrno();
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool HandoffChannel::Connect(const std::string &path, int timeoutMs)
+{
+    struct sockaddr_un addr;
+    if(!FillAddress(path, addr)) return false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while(true) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) return false;
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            fd_ = fd;
+            return true;
+        }
+        close(fd);
+        if(std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+void HandoffChannel::SetTimeout(int timeoutMs)
+{
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool HandoffChannel::Send(const std::string &record, const std::vector<int> &fds)
+{
+    if(fds.size() > kMaxFds) return false;
+    uint32_t netLength = htonl(static_cast<uint32_t>(record.size()));
+    struct iovec iov;
+    iov.iov_base = &netLength;
+    iov.iov_len = sizeof(netLength);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    // 控制消息缓冲按 cmsghdr 对齐
+    std::vector<struct cmsghdr> control((CMSG_SPACE(sizeof(int) * kMaxFds) + sizeof(struct cmsghdr) - 1) / sizeof(struct cmsghdr));
+    if(!fds.empty()) {
+        msg.msg_control = control.data();
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+    ssize_t n;
+    do {
+        n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0) return false;
+    // 长度头至少已经发出第一个字节，fd 随之送达，其余部分按普通字节流写出
+    if(!WriteAll(fd_, reinterpret_cast<const char*>(&netLength) + n, sizeof(netLength) - n)) return false;
+    return WriteAll(fd_, record.data(), record.size());
+}
+
+bool HandoffChannel::Receive(std::string &record, std::vector<int> &fds)
+{
+    uint32_t netLength = 0;
+    struct iovec iov;
+    iov.iov_base = &netLength;
+    iov.iov_len = sizeof(netLength);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    std::vector<struct cmsghdr> control((CMSG_SPACE(sizeof(int) * kMaxFds) + sizeof(struct cmsghdr) - 1) / sizeof(struct cmsghdr));
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size() * sizeof(struct cmsghdr);
+    ssize_t n;
+    do {
+        n = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+    } while(n < 0 && errno == EINTR);
+    if(n <= 0) return false;
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        fds.insert(fds.end(), received, received + count);
+    }
+    if(!ReadAll(fd_, reinterpret_cast<char*>(&netLength) + n, sizeof(netLength) - n)) return false;
+    record.resize(ntohl(netLength));
+    return record.empty() || ReadAll(fd_, &record[0], record.size());
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// 热重启交接通道：旧进程在 Unix 域套接字上等待新进程连接，排空后把监听套接字、连接 fd
+// 与会话状态交给新进程。每条记录为 4 字节长度头 + 载荷，记录携带的 fd 通过 SCM_RIGHTS 附在长度头上。
+// 读写都是阻塞的，只在交接的最后阶段使用
+class HandoffChannel {
+public:
+    // 单条记录最多携带的 fd 数（内核 SCM_MAX_FD 为 253）
+    static const size_t kMaxFds = 200;
+
+    HandoffChannel() : fd_(-1) {}
+    explicit HandoffChannel(int fd) : fd_(fd) {}
+    ~HandoffChannel();
+    HandoffChannel(const HandoffChannel&) = delete;
+    HandoffChannel &operator=(const HandoffChannel&) = delete;
+
+    // 旧进程：在 path 上创建非阻塞的监听套接字，已存在的同名文件先删除；失败返回 -1
+    static int Listen(const std::string &path);
+    // 新进程：连接旧进程，旧进程尚未就绪时在 timeoutMs 内重试
+    bool Connect(const std::string &path, int timeoutMs);
+
+    bool Send(const std::string &record, const std::vector<int> &fds);
+    // 对端关闭或出错时返回 false；收到的 fd 追加到 fds
+    bool Receive(std::string &record, std::vector<int> &fds);
+    // 设置后续阻塞读写的超时
+    void SetTimeout(int timeoutMs);
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+};
@@ -0,0 +1,611 @@
+#include "historystore.h"
+#include "logger.h"
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+
+// 记录格式（主机字节序）：校验和(4) + 正文长度(4) + 正文
+//   正文 = 序号(8) + 时间(8) + 发送者长度(2) + 发送者 + 消息体
+// 索引文件由定长的 (序号(8), 时间(8), 偏移(8)) 组成
+const size_t kRecordHeader = 8;
+const size_t kRecordMinBody = 8 + 8 + 2;
+const size_t kIndexEntrySize = 24;
+// 相邻索引项之间至少间隔的数据字节数；定位后最多多读这么多字节
+const uint64_t kIndexInterval = 4096;
+const char kDataSuffix[] = ".log";
+const char kIndexSuffix[] = ".idx";
+
+// FNV-1a，用于识别崩溃时写了一半的尾部记录
+uint32_t Checksum(const char *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void PutRaw(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T GetRaw(const char *data)
+{
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+bool PreadAll(int fd, char *data, size_t size, uint64_t offset)
+{
+    while(size > 0) {
+        ssize_t n = pread(fd, data, size, static_cast<off_t>(offset));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool WriteAll(int fd, const std::string &data)
+{
+    const char *p = data.data();
+    size_t left = data.size();
+    while(left > 0) {
+        ssize_t n = write(fd, p, left);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// 解析 data 开头的一条记录，返回整条记录的字节数；不完整或校验失败返回 0
+size_t ParseRecord(const char *data, size_t size, HistoryStore::Entry *entry)
+{
+    if(size < kRecordHeader) return 0;
+    uint32_t checksum = GetRaw<uint32_t>(data);
+    uint32_t length = GetRaw<uint32_t>(data + 4);
+    if(length < kRecordMinBody || length > size - kRecordHeader) return 0;
+    const char *body = data + kRecordHeader;
+    if(Checksum(body, length) != checksum) return 0;
+    size_t senderSize = GetRaw<uint16_t>(body + 16);
+    if(kRecordMinBody + senderSize > length) return 0;
+    if(entry) {
+        entry->seq = GetRaw<uint64_t>(body);
+        entry->timeMs = GetRaw<int64_t>(body + 8);
+        entry->sender.assign(body + kRecordMinBody, senderSize);
+        entry->body.assign(body + kRecordMinBody + senderSize, length - kRecordMinBody - senderSize);
+    }
+    return kRecordHeader + length;
+}
+
+// 会话目录名（或删除中的 '.' + 目录名）是否属于 user
+bool Involves(const std::string &name, const std::string &user)
+{
+    size_t begin = !name.empty() && name[0] == '.' ? 1 : 0;
+    size_t plus = name.find('+', begin);
+    if(plus == std::string::npos) return false;
+    return name.compare(begin, plus - begin, user) == 0 || name.compare(plus + 1, std::string::npos, user) == 0;
+}
+
+// 删除会话目录下的段文件与索引文件，再删除目录本身
+bool RemoveDir(const std::string &dir)
+{
+    DIR *d = opendir(dir.c_str());
+    if(!d) return errno == ENOENT;
+    bool ok = true;
+    while(struct dirent *ent = readdir(d)) {
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        std::string path = dir + "/" + ent->d_name;
+        if(unlink(path.c_str()) < 0 && errno != ENOENT) ok = false;
+    }
+    closedir(d);
+    return rmdir(dir.c_str()) == 0 && ok;
+}
+
+} // namespace
+
+HistoryStore::HistoryStore()
+    : segment_bytes_(0),
+      max_open_(1),
+      stopping_(false)
+{
+}
+
+HistoryStore::~HistoryStore()
+{
+    Close();
+}
+
+std::string HistoryStore::ConversationKey(const std::string &a, const std::string &b)
+{
+    // 用户名只含字母、数字与汉字，'+' 不会出现在用户名中
+    return a < b ? a + "+" + b : b + "+" + a;
+}
+
+bool HistoryStore::Open(const std::string &dir, size_t segmentBytes, size_t maxOpenConversations)
+{
+    dir_ = dir;
+    segment_bytes_ = segmentBytes;
+    max_open_ = std::max<size_t>(maxOpenConversations, 1);
+    if(mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR << "mkdir history: " << LogErrno();
+        return false;
+    }
+    stopping_ = false;
+    thread_ = std::thread([this]() { Run(); });
+    return true;
+}
+
+void HistoryStore::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_one();
+    if(thread_.joinable()) thread_.join();
+    while(!lru_.empty()) Evict(lru_.back());
+    dirty_.clear();
+}
+
+size_t HistoryStore::QueueDepth() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void HistoryStore::Append(const std::string &sender, const std::string &peer, const std::string &body)
+{
+    int64_t timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string key = ConversationKey(sender, peer);
+    Post([this, key, sender, body, timeMs]() { DoAppend(key, sender, body, timeMs); });
+}
+
+void HistoryStore::FetchPage(const std::string &user, const std::string &peer, uint64_t beforeSeq, int64_t beforeTimeMs,
+                             size_t limit, size_t maxBytes, PageCallback done)
+{
+    std::string key = ConversationKey(user, peer);
+    Post([this, key, beforeSeq, beforeTimeMs, limit, maxBytes, done]() {
+        Page page;
+        Result result = DoFetch(key, beforeSeq, beforeTimeMs, limit, maxBytes, page);
+        done(result, page);
+    });
+}
+
+void HistoryStore::Purge(const std::string &user)
+{
+    Post([this, user]() { DoPurge(user); });
+}
+
+void HistoryStore::Post(std::function<void()> run)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(run));
+    }
+    cond_.notify_one();
+}
+
+void HistoryStore::Run()
+{
+    while(true) {
+        std::deque<std::function<void()>> tasks;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if(tasks_.empty()) return;
+            tasks.swap(tasks_);
+        }
+        for(auto &task : tasks) {
+            task();
+        }
+        // 本批追加的记录每个会话一次 write 写出
+        for(auto &key : dirty_) {
+            auto it = conversations_.find(key);
+            if(it != conversations_.end()) Flush(it->second);
+        }
+        dirty_.clear();
+    }
+}
+
+std::string HistoryStore::SegmentPath(const Conversation &conv, uint64_t firstSeq, const char *suffix) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu", static_cast<unsigned long long>(firstSeq));
+    return conv.dir + "/" + name + suffix;
+}
+
+HistoryStore::Conversation *HistoryStore::Acquire(const std::string &key, bool create)
+{
+    auto it = conversations_.find(key);
+    if(it != conversations_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return &it->second;
+    }
+    std::string dir = dir_ + "/" + key;
+    if(create) {
+        if(mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            LOG_ERROR << "mkdir " << dir << ": " << LogErrno();
+            return nullptr;
+        }
+    } else {
+        struct stat st;
+        if(stat(dir.c_str(), &st) < 0) return nullptr;
+    }
+    Conversation &conv = conversations_[key];
+    conv.dir = dir;
+    lru_.push_front(key);
+    conv.lru = lru_.begin();
+    if(!Load(conv)) {
+        Evict(key);
+        return nullptr;
+    }
+    while(conversations_.size() > max_open_) {
+        Evict(lru_.back());
+    }
+    return &conv;
+}
+
+bool HistoryStore::Load(Conversation &conv)
+{
+    DIR *d = opendir(conv.dir.c_str());
+    if(!d) {
+        LOG_ERROR << "opendir " << conv.dir << ": " << LogErrno();
+        return false;
+    }
+    std::vector<uint64_t> firstSeqs;
+    while(struct dirent *ent = readdir(d)) {
+        const char *name = ent->d_name;
+        char *end = nullptr;
+        unsigned long long seq = strtoull(name, &end, 10);
+        if(end != name && strcmp(end, kDataSuffix) == 0 && seq > 0) firstSeqs.push_back(seq);
+    }
+    closedir(d);
+    std::sort(firstSeqs.begin(), firstSeqs.end());
+
+    for(uint64_t firstSeq : firstSeqs) {
+        Segment &segment = conv.segments[firstSeq];
+        // 稀疏索引很小，整份读入内存；尾部不足一项的残缺部分丢弃
+        std::string path = SegmentPath(conv, firstSeq, kIndexSuffix);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if(fd >= 0 && fstat(fd, &st) == 0) {
+            std::string data(static_cast<size_t>(st.st_size) / kIndexEntrySize * kIndexEntrySize, '\0');
+            if(data.empty() || PreadAll(fd, &data[0], data.size(), 0)) {
+                for(size_t pos = 0; pos < data.size(); pos += kIndexEntrySize) {
+                    IndexEntry entry;
+                    entry.seq = GetRaw<uint64_t>(data.data() + pos);
+                    entry.timeMs = GetRaw<int64_t>(data.data() + pos + 8);
+                    entry.offset = GetRaw<uint64_t>(data.data() + pos + 16);
+                    segment.index.push_back(entry);
+                }
+            }
+        }
+        if(fd >= 0) close(fd);
+        if(firstSeq != firstSeqs.back()) {
+            struct stat dataSt;
+            if(stat(SegmentPath(conv, firstSeq, kDataSuffix).c_str(), &dataSt) == 0) {
+                segment.size = static_cast<uint64_t>(dataSt.st_size);
+            }
+        }
+    }
+    if(firstSeqs.empty()) return true;
+    return RecoverTail(conv, firstSeqs.back(), conv.segments[firstSeqs.back()]);
+}
+
+bool HistoryStore::RecoverTail(Conversation &conv, uint64_t firstSeq, Segment &segment)
+{
+    // 只有当前段可能有尾部残缺或落后的索引：从最后一个索引项起重新扫描，补齐索引并截掉残缺记录
+    std::string dataPath = SegmentPath(conv, firstSeq, kDataSuffix);
+    conv.dataFd = open(dataPath.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    struct stat st;
+    if(conv.dataFd < 0 || fstat(conv.dataFd, &st) < 0) {
+        LOG_ERROR << "open " << dataPath << ": " << LogErrno();
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+    while(!segment.index.empty() && segment.index.back().offset >= fileSize) {
+        segment.index.pop_back();
+    }
+    uint64_t start = segment.index.empty() ? 0 : segment.index.back().offset;
+    if(!segment.index.empty()) segment.index.pop_back(); // 扫描时重新加入
+    std::string data(static_cast<size_t>(fileSize - start), '\0');
+    if(!data.empty() && !PreadAll(conv.dataFd, &data[0], data.size(), start)) {
+        LOG_ERROR << "read " << dataPath << ": " << LogErrno();
+        return false;
+    }
+    uint64_t lastSeq = firstSeq - 1;
+    size_t pos = 0;
+    Entry entry;
+    while(size_t size = ParseRecord(data.data() + pos, data.size() - pos, &entry)) {
+        uint64_t offset = start + pos;
+        if(segment.index.empty() || offset - segment.index.back().offset >= kIndexInterval) {
+            segment.index.push_back(IndexEntry{entry.seq, entry.timeMs, offset});
+        }
+        lastSeq = entry.seq;
+        pos += size;
+    }
+    segment.size = start + pos;
+    if(segment.size != fileSize) {
+        LOG_WARN << "聊天记录段 " << dataPath << " 尾部 " << fileSize - segment.size << " 字节不完整，已截断";
+        if(ftruncate(conv.dataFd, static_cast<off_t>(segment.size)) < 0) {
+            LOG_ERROR << "ftruncate " << dataPath << ": " << LogErrno();
+            return false;
+        }
+    }
+    conv.nextSeq = lastSeq + 1;
+
+    // 索引按恢复后的内容整份重写
+    std::string indexPath = SegmentPath(conv, firstSeq, kIndexSuffix);
+    conv.indexFd = open(indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(conv.indexFd < 0) {
+        LOG_ERROR << "open " << indexPath << ": " << LogErrno();
+        return false;
+    }
+    std::string index;
+    for(auto &item : segment.index) {
+        PutRaw<uint64_t>(index, item.seq);
+        PutRaw<int64_t>(index, item.timeMs);
+        PutRaw<uint64_t>(index, item.offset);
+    }
+    return WriteAll(conv.indexFd, index);
+}
+
+bool HistoryStore::OpenSegment(Conversation &conv, uint64_t firstSeq)
+{
+    if(!Flush(conv)) return false;
+    if(conv.dataFd >= 0) close(conv.dataFd);
+    if(conv.indexFd >= 0) close(conv.indexFd);
+    conv.indexFd = -1;
+    std::string dataPath = SegmentPath(conv, firstSeq, kDataSuffix);
+    conv.dataFd = open(dataPath.c_str(), O_RDWR | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(conv.dataFd < 0) {
+        LOG_ERROR << "open " << dataPath << ": " << LogErrno();
+        return false;
+    }
+    std::string indexPath = SegmentPath(conv, firstSeq, kIndexSuffix);
+    conv.indexFd = open(indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(conv.indexFd < 0) {
+        LOG_ERROR << "open " << indexPath << ": " << LogErrno();
+        return false;
+    }
+    conv.segments[firstSeq];
+    return true;
+}
+
+bool HistoryStore::Flush(Conversation &conv)
+{
+    // 先写数据再写索引，索引项不会指向尚未写出的记录
+    if(!conv.dataBuffer.empty()) {
+        if(conv.dataFd < 0 || !WriteAll(conv.dataFd, conv.dataBuffer)) {
+            LOG_ERROR << "write " << conv.dir << ": " << LogErrno();
+            return false;
+        }
+        conv.dataBuffer.clear();
+    }
+    if(!conv.indexBuffer.empty()) {
+        if(conv.indexFd < 0 || !WriteAll(conv.indexFd, conv.indexBuffer)) {
+            LOG_ERROR << "write " << conv.dir << ": " << LogErrno();
+            return false;
+        }
+        conv.indexBuffer.clear();
+    }
+    return true;
+}
+
+void HistoryStore::Evict(const std::string &key)
+{
+    auto it = conversations_.find(key);
+    if(it == conversations_.end()) return;
+    Conversation &conv = it->second;
+    Flush(conv);
+    if(conv.dataFd >= 0) close(conv.dataFd);
+    if(conv.indexFd >= 0) close(conv.indexFd);
+    lru_.erase(conv.lru);
+    conversations_.erase(it);
+}
+
+void HistoryStore::DoAppend(const std::string &key, const std::string &sender, const std::string &body, int64_t timeMs)
+{
+    Conversation *conv = Acquire(key, true);
+    if(!conv) {
+        LOG_ERROR << "无法打开会话 " << key << " 的聊天记录";
+        return;
+    }
+    if(conv->segments.empty() || conv->segments.rbegin()->second.size >= segment_bytes_) {
+        if(!OpenSegment(*conv, conv->nextSeq)) return;
+    }
+    uint64_t seq = conv->nextSeq++;
+    std::string record;
+    record.reserve(kRecordHeader + kRecordMinBody + sender.size() + body.size());
+    PutRaw<uint32_t>(record, 0);
+    PutRaw<uint32_t>(record, 0);
+    PutRaw<uint64_t>(record, seq);
+    PutRaw<int64_t>(record, timeMs);
+    PutRaw<uint16_t>(record, static_cast<uint16_t>(sender.size()));
+    record.append(sender);
+    record.append(body);
+    uint32_t length = static_cast<uint32_t>(record.size() - kRecordHeader);
+    uint32_t checksum = Checksum(record.data() + kRecordHeader, length);
+    memcpy(&record[0], &checksum, sizeof(checksum));
+    memcpy(&record[4], &length, sizeof(length));
+
+    Segment &segment = conv->segments.rbegin()->second;
+    uint64_t offset = segment.size;
+    if(segment.index.empty() || offset - segment.index.back().offset >= kIndexInterval) {
+        segment.index.push_back(IndexEntry{seq, timeMs, offset});
+        PutRaw<uint64_t>(conv->indexBuffer, seq);
+        PutRaw<int64_t>(conv->indexBuffer, timeMs);
+        PutRaw<uint64_t>(conv->indexBuffer, offset);
+    }
+    if(conv->dataBuffer.empty()) dirty_.push_back(key);
+    conv->dataBuffer.append(record);
+    segment.size += record.size();
+}
+
+void HistoryStore::DoPurge(const std::string &user)
+{
+    DIR *d = opendir(dir_.c_str());
+    if(!d) {
+        LOG_ERROR << "opendir " << dir_ << ": " << LogErrno();
+        return;
+    }
+    std::vector<std::string> names;
+    while(struct dirent *ent = readdir(d)) {
+        if(Involves(ent->d_name, user)) names.push_back(ent->d_name);
+    }
+    closedir(d);
+    size_t removed = 0;
+    for(auto &name : names) {
+        std::string tombstone = name;
+        if(name[0] != '.') {
+            // 先丢弃内存中的会话及尚未写出的记录，再把目录改名为 '.' 开头，
+            // 之后即使删除中途失败或进程崩溃，Acquire 也不会再打开它；下次删除同名用户时继续清理
+            auto it = conversations_.find(name);
+            if(it != conversations_.end()) {
+                it->second.dataBuffer.clear();
+                it->second.indexBuffer.clear();
+                Evict(name);
+            }
+            tombstone = "." + name;
+            if(rename((dir_ + "/" + name).c_str(), (dir_ + "/" + tombstone).c_str()) < 0) {
+                LOG_ERROR << "rename " << dir_ << "/" << name << ": " << LogErrno();
+                continue;
+            }
+        }
+        if(RemoveDir(dir_ + "/" + tombstone)) {
+            ++removed;
+        } else {
+            LOG_ERROR << "删除聊天记录 " << dir_ << "/" << tombstone << " 失败: " << LogErrno();
+        }
+    }
+    LOG_INFO << "已删除用户[" << user << "]的 " << removed << " 个会话的聊天记录";
+}
+
+HistoryStore::Result HistoryStore::DoFetch(const std::string &key, uint64_t beforeSeq, int64_t beforeTimeMs,
+                                           size_t limit, size_t maxBytes, Page &page)
+{
+    Conversation *conv = Acquire(key, false);
+    if(!conv || conv->segments.empty()) return kOk;
+    // 本批尚未写出的记录先写到文件，读取时才能看到
+    if(!Flush(*conv)) return kFailed;
+    uint64_t firstSeq = conv->segments.begin()->first;
+    if(beforeTimeMs > 0) beforeSeq = SeqAtTime(*conv, beforeTimeMs);
+    if(beforeSeq == 0 || beforeSeq > conv->nextSeq) beforeSeq = conv->nextSeq;
+    limit = std::max<size_t>(limit, 1);
+    // 会话内序号连续，要取的范围可以直接算出
+    uint64_t fromSeq = beforeSeq > firstSeq + limit ? beforeSeq - limit : firstSeq;
+    if(fromSeq >= beforeSeq) return kOk;
+
+    auto it = conv->segments.upper_bound(fromSeq);
+    if(it != conv->segments.begin()) --it;
+    for(; it != conv->segments.end() && it->first < beforeSeq; ++it) {
+        if(!ReadRange(*conv, it, fromSeq, beforeSeq, page.entries)) return kFailed;
+    }
+    // 超过字节上限时从新往旧保留，丢弃较早的部分，游标随之后移
+    size_t bytes = 0;
+    size_t keep = 0;
+    for(auto rit = page.entries.rbegin(); rit != page.entries.rend(); ++rit) {
+        bytes += rit->sender.size() + rit->body.size();
+        if(keep > 0 && bytes > maxBytes) break;
+        ++keep;
+    }
+    page.entries.erase(page.entries.begin(), page.entries.end() - keep);
+    if(!page.entries.empty() && page.entries.front().seq > firstSeq) page.cursor = page.entries.front().seq;
+    return kOk;
+}
+
+bool HistoryStore::ReadRecords(Conversation &conv, std::map<uint64_t, Segment>::iterator segment,
+                               uint64_t beginOffset, uint64_t endOffset, std::vector<Entry> &entries)
+{
+    if(beginOffset >= endOffset) return true;
+    bool active = std::next(segment) == conv.segments.end();
+    std::string path = SegmentPath(conv, segment->first, kDataSuffix);
+    int fd = active ? conv.dataFd : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    std::string data(static_cast<size_t>(endOffset - beginOffset), '\0');
+    bool ok = fd >= 0 && PreadAll(fd, &data[0], data.size(), beginOffset);
+    if(!active && fd >= 0) close(fd);
+    if(!ok) {
+        LOG_ERROR << "read " << path << ": " << LogErrno();
+        return false;
+    }
+    size_t pos = 0;
+    while(pos < data.size()) {
+        Entry entry;
+        size_t size = ParseRecord(data.data() + pos, data.size() - pos, &entry);
+        if(size == 0) {
+            LOG_ERROR << "聊天记录段 " << path << " 在偏移 " << beginOffset + pos << " 处损坏";
+            return false;
+        }
+        entries.push_back(std::move(entry));
+        pos += size;
+    }
+    return true;
+}
+
+bool HistoryStore::ReadRange(Conversation &conv, std::map<uint64_t, Segment>::iterator segment,
+                             uint64_t fromSeq, uint64_t toSeq, std::vector<Entry> &entries)
+{
+    // 起点取不晚于 fromSeq 的最后一个索引项，终点取不早于 toSeq 的第一个索引项，一次读出其间的记录
+    const std::vector<IndexEntry> &index = segment->second.index;
+    auto after = std::upper_bound(index.begin(), index.end(), fromSeq,
+                                  [](uint64_t seq, const IndexEntry &e) { return seq < e.seq; });
+    uint64_t beginOffset = after != index.begin() ? std::prev(after)->offset : 0;
+    auto end = std::lower_bound(index.begin(), index.end(), toSeq,
+                                [](const IndexEntry &e, uint64_t seq) { return e.seq < seq; });
+    uint64_t endOffset = end != index.end() ? end->offset : segment->second.size;
+
+    std::vector<Entry> records;
+    if(!ReadRecords(conv, segment, beginOffset, endOffset, records)) return false;
+    for(auto &record : records) {
+        if(record.seq >= fromSeq && record.seq < toSeq) entries.push_back(std::move(record));
+    }
+    return true;
+}
+
+uint64_t HistoryStore::SeqAtTime(Conversation &conv, int64_t timeMs)
+{
+    // 返回第一条时间不早于 timeMs 的消息序号；先按各段首个索引项定位段，再在段内索引中定位
+    auto segment = conv.segments.end();
+    for(auto it = conv.segments.begin(); it != conv.segments.end(); ++it) {
+        if(it->second.index.empty() || it->second.index.front().timeMs >= timeMs) break;
+        segment = it;
+    }
+    if(segment == conv.segments.end()) return conv.segments.begin()->first;
+    const std::vector<IndexEntry> &index = segment->second.index;
+    auto next = std::lower_bound(index.begin(), index.end(), timeMs,
+                                 [](const IndexEntry &e, int64_t t) { return e.timeMs < t; });
+    auto begin = std::prev(next);
+    uint64_t endOffset = next != index.end() ? next->offset : segment->second.size;
+    std::vector<Entry> records;
+    if(ReadRecords(conv, segment, begin->offset, endOffset, records)) {
+        for(auto &record : records) {
+            if(record.timeMs >= timeMs) return record.seq;
+        }
+    }
+    if(next != index.end()) return next->seq;
+    auto following = std::next(segment);
+    return following != conv.segments.end() ? following->first : conv.nextSeq;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+// 聊天记录存储：每个会话（两个用户）一个目录，消息按会话内连续递增的序号追加到段文件，
+// 每个段配一个稀疏索引文件，大约每 kIndexInterval 字节记一条 (序号, 时间, 偏移)。
+// 按游标取一页时先在内存索引中二分定位，再对段文件做一次 pread 顺序读出整页。
+// 所有读写在专用的历史线程上执行，同一批请求中的追加合并为每个会话一次 write；
+// 聊天记录不参与送达保证，不做 fdatasync，崩溃后截掉写了一半的尾部记录。
+// 只有最近访问的若干会话保留在内存中并持有文件描述符，其余按最久未用淘汰，下次访问时从索引文件重新加载。
+class HistoryStore {
+public:
+    enum Result {
+        kOk,
+        kFailed // 磁盘读写错误
+    };
+    struct Entry {
+        uint64_t seq;
+        int64_t timeMs; // 服务端收到消息时的墙上时间（毫秒）
+        std::string sender;
+        std::string body;
+    };
+    struct Page {
+        std::vector<Entry> entries; // 按序号升序
+        uint64_t cursor = 0;        // 取上一页时作为 beforeSeq 传入，0 表示已经到最早的消息
+    };
+    typedef std::function<void(Result, Page&)> PageCallback;
+
+    HistoryStore();
+    ~HistoryStore();
+
+    // 打开（必要时创建）历史目录并启动历史线程；segmentBytes 为单个段的滚动大小，
+    // maxOpenConversations 为同时保留在内存中的会话数
+    bool Open(const std::string &dir, size_t segmentBytes = 1024 * 1024, size_t maxOpenConversations = 256);
+    // 写出已排队的记录后停止历史线程并关闭文件
+    void Close();
+
+    // 记录一条 sender 发给 peer 的消息，不等待完成
+    void Append(const std::string &sender, const std::string &peer, const std::string &body);
+    // 取 user 与 peer 会话中序号小于 beforeSeq 的最近 limit 条消息；beforeSeq 为 0 时从最新开始。
+    // beforeTimeMs 非 0 时改为取早于该时间的消息。整页正文超过 maxBytes 时丢弃较早的部分（至少保留一条）
+    void FetchPage(const std::string &user, const std::string &peer, uint64_t beforeSeq, int64_t beforeTimeMs,
+                   size_t limit, size_t maxBytes, PageCallback done);
+
+    // 删除 user 参与的全部会话（注销账号时调用），不等待完成；之后注册同名账号看不到这些记录
+    void Purge(const std::string &user);
+
+    // 排队等待历史线程执行的请求数
+    size_t QueueDepth() const;
+
+    static std::string ConversationKey(const std::string &a, const std::string &b);
+
+private:
+    struct IndexEntry {
+        uint64_t seq;
+        int64_t timeMs;
+        uint64_t offset;
+    };
+    struct Segment {
+        uint64_t size = 0; // 文件长度，含尚未写出的缓冲
+        std::vector<IndexEntry> index;
+    };
+    struct Conversation {
+        std::string dir;
+        std::map<uint64_t, Segment> segments; // 按首条消息序号排列，最后一个为当前追加的段
+        uint64_t nextSeq = 1;
+        int dataFd = -1;  // 当前段
+        int indexFd = -1;
+        std::string dataBuffer;  // 当前段尚未写出的记录
+        std::string indexBuffer;
+        std::list<std::string>::iterator lru;
+    };
+
+    void Post(std::function<void()> run);
+    void Run();
+    // 以下仅在历史线程调用
+    Conversation *Acquire(const std::string &key, bool create);
+    bool Load(Conversation &conv);
+    bool RecoverTail(Conversation &conv, uint64_t firstSeq, Segment &segment);
+    bool OpenSegment(Conversation &conv, uint64_t firstSeq); // 滚动到以 firstSeq 开头的新段
+    bool Flush(Conversation &conv);
+    void Evict(const std::string &key);
+    void DoAppend(const std::string &key, const std::string &sender, const std::string &body, int64_t timeMs);
+    void DoPurge(const std::string &user);
+    Result DoFetch(const std::string &key, uint64_t beforeSeq, int64_t beforeTimeMs,
+                   size_t limit, size_t maxBytes, Page &page);
+    bool ReadRecords(Conversation &conv, std::map<uint64_t, Segment>::iterator segment,
+                     uint64_t beginOffset, uint64_t endOffset, std::vector<Entry> &entries);
+    bool ReadRange(Conversation &conv, std::map<uint64_t, Segment>::iterator segment,
+                   uint64_t fromSeq, uint64_t toSeq, std::vector<Entry> &entries);
+    uint64_t SeqAtTime(Conversation &conv, int64_t timeMs);
+    std::string SegmentPath(const Conversation &conv, uint64_t firstSeq, const char *suffix) const;
+
+    std::string dir_;
+    size_t segment_bytes_;
+    size_t max_open_;
+    std::unordered_map<std::string, Conversation> conversations_;
+    std::list<std::string> lru_; // 最近访问的会话在前
+    std::vector<std::string> dirty_; // 本批有追加的会话
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_;
+};
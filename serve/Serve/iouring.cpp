@@ -0,0 +1,218 @@
+#include "iouring.h"
+#include "metrics.h"
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+namespace {
+
+int SysSetup(unsigned entries, struct io_uring_params *params)
+{
+    return static_cast<int>(syscall(SYS_io_uring_setup, entries, params));
+}
+
+int SysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void *arg, size_t argSize)
+{
+    return static_cast<int>(syscall(SYS_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+int SysRegister(int fd, unsigned opcode, const void *arg, unsigned count)
+{
+    return static_cast<int>(syscall(SYS_io_uring_register, fd, opcode, arg, count));
+}
+
+inline unsigned LoadAcquire(const unsigned *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void StoreRelease(unsigned *p, unsigned value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+} // namespace
+
+IoUring::IoUring()
+    : ring_fd_(-1), sq_map_(nullptr), sq_map_size_(0), cq_map_(nullptr), cq_map_size_(0),
+      sqes_(nullptr), sqes_size_(0), sq_entries_(0), sq_head_(nullptr), sq_tail_(nullptr), sq_mask_(0),
+      sq_local_tail_(0), cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(0), cqes_(nullptr),
+      buf_ring_(nullptr), buf_ring_size_(0), buf_count_(0), buf_tail_(0), buffer_size_(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    // 关闭环的 fd 时内核取消全部未完成的请求；缓冲区在此之后才释放
+    if(ring_fd_ >= 0) close(ring_fd_);
+    if(buf_ring_) munmap(buf_ring_, buf_ring_size_);
+    if(sqes_) munmap(sqes_, sqes_size_);
+    if(cq_map_ && cq_map_ != sq_map_) munmap(cq_map_, cq_map_size_);
+    if(sq_map_) munmap(sq_map_, sq_map_size_);
+}
+
+bool IoUring::Supported()
+{
+    struct utsname name;
+    if(uname(&name) != 0) return false;
+    int major = 0, minor = 0;
+    if(sscanf(name.release, "%d.%d", &major, &minor) != 2) return false;
+    if(major < 6) return false;
+    IoUring probe;
+    return probe.Init(4) && probe.SetupBuffers(0, 1, 64);
+}
+
+bool IoUring::Init(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // 多发请求的完成事件可能远多于提交，完成队列开到提交队列的 4 倍；溢出时内核暂存（FEAT_NODROP）
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    int fd = SysSetup(entries, &params);
+    if(fd < 0) return false;
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if((params.features & required) != required) {
+        close(fd);
+        return false;
+    }
+    ring_fd_ = fd;
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sq_map_size_ = cq_map_size_ = sqSize > cqSize ? sqSize : cqSize;
+    sq_map_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(sq_map_ == MAP_FAILED) {
+        sq_map_ = nullptr;
+        close(ring_fd_);
+        ring_fd_ = -1;
+        return false;
+    }
+    cq_map_ = sq_map_;
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        close(ring_fd_);
+        ring_fd_ = -1;
+        return false;
+    }
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char *sq = static_cast<char*>(sq_map_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    // SQE 下标与提交数组一一对应，之后只推进 tail
+    unsigned *array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for(unsigned i = 0; i < sq_entries_; ++i) array[i] = i;
+    sq_local_tail_ = *sq_tail_;
+
+    char *cq = static_cast<char*>(cq_map_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+unsigned IoUring::SqSpace() const
+{
+    return sq_entries_ - (sq_local_tail_ - LoadAcquire(sq_head_));
+}
+
+int IoUring::Enter(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs)
+{
+    Metrics::Increment(Metrics::kNetworkSyscalls);
+    if(timeoutMs < 0 || !(flags & IORING_ENTER_GETEVENTS)) {
+        return SysEnter(ring_fd_, toSubmit, minComplete, flags, nullptr, 0);
+    }
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    return SysEnter(ring_fd_, toSubmit, minComplete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+void IoUring::Submit(bool wait, int timeoutMs)
+{
+    StoreRelease(sq_tail_, sq_local_tail_);
+    unsigned toSubmit = sq_local_tail_ - LoadAcquire(sq_head_);
+    if(toSubmit == 0 && !wait) return;
+    int n = Enter(toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, timeoutMs);
+    (void)n; // 超时（ETIME）与信号中断（EINTR）都只是提前返回，由调用方照常收割
+}
+
+bool IoUring::Reserve(unsigned count)
+{
+    if(SqSpace() < count) Submit(false, -1);
+    return SqSpace() >= count;
+}
+
+struct io_uring_sqe *IoUring::GetSqe()
+{
+    if(SqSpace() == 0) {
+        Submit(false, -1);
+        if(SqSpace() == 0) return nullptr;
+    }
+    struct io_uring_sqe *sqe = &sqes_[sq_local_tail_ & sq_mask_];
+    memset(sqe, 0, sizeof(*sqe));
+    ++sq_local_tail_;
+    return sqe;
+}
+
+struct io_uring_cqe *IoUring::PeekCqe()
+{
+    unsigned head = *cq_head_;
+    if(head == LoadAcquire(cq_tail_)) return nullptr;
+    return &cqes_[head & cq_mask_];
+}
+
+void IoUring::SeenCqe()
+{
+    StoreRelease(cq_head_, *cq_head_ + 1);
+}
+
+bool IoUring::SetupBuffers(uint16_t group, unsigned count, size_t size)
+{
+    buf_ring_size_ = count * sizeof(struct io_uring_buf);
+    void *ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED) return false;
+    buf_ring_ = static_cast<struct io_uring_buf_ring*>(ring);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if(SysRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(ring, buf_ring_size_);
+        buf_ring_ = nullptr;
+        return false;
+    }
+    buf_count_ = count;
+    buffer_size_ = size;
+    buffers_.reset(new char[count * size]);
+    buf_tail_ = 0;
+    for(unsigned bid = 0; bid < count; ++bid) RecycleBuffer(static_cast<uint16_t>(bid));
+    return true;
+}
+
+void IoUring::RecycleBuffer(uint16_t bid)
+{
+    // 环本身就是 io_uring_buf 数组（tail 叠放在第 0 项的 resv 上）。不用 bufs 成员：内核头文件的
+    // __DECLARE_FLEX_ARRAY 在 C++ 下包了一层空结构体，偏移量变为 8
+    struct io_uring_buf *bufs = reinterpret_cast<struct io_uring_buf*>(buf_ring_);
+    struct io_uring_buf &buf = bufs[buf_tail_ & (buf_count_ - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffers_.get() + static_cast<size_t>(bid) * buffer_size_);
+    buf.len = static_cast<uint32_t>(buffer_size_);
+    buf.bid = bid;
+    ++buf_tail_;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <linux/io_uring.h>
+
+// io_uring 的最小封装：直接使用系统调用与共享内存环，不依赖 liburing。
+// 提交与收割只在所属事件循环的线程进行（循环启动前在创建线程准备 SQE 也可以，由线程启动保证可见性）。
+// 另外注册一组内核选择的接收缓冲区（provided buffer ring），多发接收时内核直接取用，
+// 处理完一块后由 RecycleBuffer 归还。
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    // 创建提交队列长度为 entries 的环；内核不支持、被禁用或缺少所需特性时返回 false
+    bool Init(unsigned entries);
+    bool Valid() const { return ring_fd_ >= 0; }
+
+    // 取一个清零的 SQE；提交队列已满时先把已准备的 SQE 交给内核
+    struct io_uring_sqe *GetSqe();
+    // 保证接下来连续 count 个 GetSqe 不会触发中途提交（链接的 SQE 必须在同一次提交中）；
+    // 内核暂时收不走已准备的 SQE、腾不出 count 个位置时返回 false
+    bool Reserve(unsigned count);
+    // 提交已准备的 SQE；wait 为 true 时等待至少一个完成，timeoutMs < 0 表示不限时
+    void Submit(bool wait, int timeoutMs);
+
+    // 依次取出已完成的 CQE，处理后调用 SeenCqe
+    struct io_uring_cqe *PeekCqe();
+    void SeenCqe();
+
+    // 注册编号为 group 的接收缓冲区组：count 块（2 的幂），每块 size 字节
+    bool SetupBuffers(uint16_t group, unsigned count, size_t size);
+    bool HasBuffers() const { return buffers_ != nullptr; }
+    const char *Buffer(uint16_t bid) const { return buffers_.get() + static_cast<size_t>(bid) * buffer_size_; }
+    void RecycleBuffer(uint16_t bid);
+
+    // 当前内核是否提供本服务需要的特性（多发 accept/recv、provided buffer ring，即 6.0 及以上）
+    static bool Supported();
+
+private:
+    IoUring(const IoUring&) = delete;
+    IoUring &operator=(const IoUring&) = delete;
+    unsigned SqSpace() const;
+    int Enter(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs);
+
+    int ring_fd_;
+    void *sq_map_;
+    size_t sq_map_size_;
+    void *cq_map_;
+    size_t cq_map_size_;
+    struct io_uring_sqe *sqes_;
+    size_t sqes_size_;
+    unsigned sq_entries_;
+    unsigned *sq_head_;
+    unsigned *sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_local_tail_; // 已准备但尚未发布给内核的 SQE 截止位置
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe *cqes_;
+
+    struct io_uring_buf_ring *buf_ring_;
+    size_t buf_ring_size_;
+    unsigned buf_count_;
+    uint16_t buf_tail_;
+    size_t buffer_size_;
+    std::unique_ptr<char[]> buffers_;
+};
@@ -0,0 +1,431 @@
+#include "logger.h"
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace {
+
+// 环中每条记录的头部，后跟 size 字节正文；记录可以跨越环尾回绕
+struct RecordHeader {
+    int64_t timeNs;
+    uint32_t size;
+    uint32_t level;
+};
+
+// 一个线程的日志环：head 只由所属线程推进，tail 只由写入线程推进，两者用单调递增的字节数表示。
+// 分开放在不同缓存行，避免生产者与写入线程互相争用；线程退出后保留，未写出的日志不会丢失
+struct Ring {
+    std::atomic<uint64_t> head;
+    char pad1[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> tail;
+    char pad2[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> dropped;
+    uint32_t tid;
+    char data[Logger::kRingBytes];
+};
+
+// 写入线程从环中取出的一条记录，正文在批次的 arena 中
+struct Pending {
+    int64_t timeNs;
+    uint32_t level;
+    uint32_t tid;
+    size_t offset;
+    size_t size;
+};
+
+std::mutex g_ringsMutex;
+std::vector<Ring*> g_rings;
+
+std::atomic<int> g_level(Logger::kInfo);
+std::atomic<bool> g_running(false);
+int g_fd = 2;
+Logger::Format g_format = Logger::kText;
+
+std::mutex g_mutex;
+std::condition_variable g_cond;
+bool g_stopping = false;
+std::thread g_writer;
+
+const char *kLevelText[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+const char *kLevelJson[] = {"debug", "info", "warn", "error"};
+
+Ring &LocalRing()
+{
+    thread_local Ring *ring = nullptr;
+    if(!ring) {
+        ring = new Ring();
+        ring->tid = static_cast<uint32_t>(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(g_ringsMutex);
+        g_rings.push_back(ring);
+    }
+    return *ring;
+}
+
+void CopyIn(Ring &ring, uint64_t pos, const void *src, size_t size)
+{
+    size_t offset = static_cast<size_t>(pos % Logger::kRingBytes);
+    size_t first = std::min(size, Logger::kRingBytes - offset);
+    memcpy(ring.data + offset, src, first);
+    memcpy(ring.data, static_cast<const char*>(src) + first, size - first);
+}
+
+void CopyOut(const Ring &ring, uint64_t pos, void *dst, size_t size)
+{
+    size_t offset = static_cast<size_t>(pos % Logger::kRingBytes);
+    size_t first = std::min(size, Logger::kRingBytes - offset);
+    memcpy(dst, ring.data + offset, first);
+    memcpy(static_cast<char*>(dst) + first, ring.data, size - first);
+}
+
+// 把纳秒时间格式化为本地时间；同一秒内的记录复用上一次 localtime_r 的结果
+class TimeFormatter {
+public:
+    // 返回 "YYYY-MM-DD HH:MM:SS.uuuuuu"，separator 为日期与时间之间的字符
+    const char *Format(int64_t timeNs, char separator)
+    {
+        time_t seconds = static_cast<time_t>(timeNs / 1000000000);
+        if(seconds != cached_seconds_ || separator != cached_separator_) {
+            struct tm tm;
+            localtime_r(&seconds, &tm);
+            // 各字段按无符号取模限定位数，输出固定 19 字节，编译器也能据此确认不会截断
+            snprintf(prefix_, sizeof(prefix_), "%04u-%02u-%02u%c%02u:%02u:%02u",
+                     static_cast<unsigned>(tm.tm_year + 1900) % 10000u, static_cast<unsigned>(tm.tm_mon + 1) % 100u,
+                     static_cast<unsigned>(tm.tm_mday) % 100u, separator, static_cast<unsigned>(tm.tm_hour) % 100u,
+                     static_cast<unsigned>(tm.tm_min) % 100u, static_cast<unsigned>(tm.tm_sec) % 100u);
+            cached_seconds_ = seconds;
+            cached_separator_ = separator;
+        }
+        snprintf(text_, sizeof(text_), "%s.%06u", prefix_, static_cast<unsigned>(timeNs % 1000000000 / 1000) % 1000000u);
+        return text_;
+    }
+
+private:
+    time_t cached_seconds_ = -1;
+    char cached_separator_ = 0;
+    char prefix_[32];
+    char text_[48];
+};
+
+void AppendJsonString(std::string &out, const char *text, size_t size)
+{
+    out += '"';
+    for(size_t i = 0; i < size; ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if(c == '\n') {
+            out += "\\n";
+        } else if(c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
+
+void FormatRecord(std::string &out, TimeFormatter &time, int64_t timeNs, uint32_t level, uint32_t tid,
+                  const char *text, size_t size)
+{
+    char head[96];
+    if(g_format == Logger::kJsonLines) {
+        snprintf(head, sizeof(head), "{\"ts\":\"%s\",\"level\":\"%s\",\"tid\":%u,\"msg\":",
+                 time.Format(timeNs, 'T'), kLevelJson[level], tid);
+        out += head;
+        AppendJsonString(out, text, size);
+        out += "}\n";
+    } else {
+        snprintf(head, sizeof(head), "%s %s [%u] ", time.Format(timeNs, ' '), kLevelText[level], tid);
+        out += head;
+        out.append(text, size);
+        out += '\n';
+    }
+}
+
+void WriteAll(int fd, const std::string &out)
+{
+    size_t written = 0;
+    while(written < out.size()) {
+        ssize_t n = write(fd, out.data() + written, out.size() - written);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        written += static_cast<size_t>(n);
+    }
+}
+
+int64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// 写入线程的状态：每轮取走所有环中的记录，排序、格式化后一次写出
+class Writer {
+public:
+    void Drain()
+    {
+        std::vector<Ring*> rings;
+        {
+            std::lock_guard<std::mutex> lock(g_ringsMutex);
+            rings = g_rings;
+        }
+        pending_.clear();
+        arena_.clear();
+        uint64_t dropped = 0;
+        for(Ring *ring : rings) {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            while(tail < head) {
+                RecordHeader header;
+                CopyOut(*ring, tail, &header, sizeof(header));
+                Pending record = {header.timeNs, header.level, ring->tid, arena_.size(), header.size};
+                arena_.resize(arena_.size() + header.size);
+                CopyOut(*ring, tail + sizeof(header), &arena_[record.offset], header.size);
+                pending_.push_back(record);
+                tail += sizeof(header) + header.size;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+        }
+        out_.clear();
+        if(dropped > reported_dropped_) {
+            char text[96];
+            int size = snprintf(text, sizeof(text), "日志缓冲区已满，丢弃 %llu 条日志",
+                                static_cast<unsigned long long>(dropped - reported_dropped_));
+            FormatRecord(out_, time_, NowNs(), Logger::kWarn, static_cast<uint32_t>(syscall(SYS_gettid)), text,
+                         static_cast<size_t>(size));
+            reported_dropped_ = dropped;
+        }
+        if(pending_.empty() && out_.empty()) return;
+        // 各线程的记录各自有序，合并后按日志点取到的时间排序
+        std::stable_sort(pending_.begin(), pending_.end(), [](const Pending &a, const Pending &b) {
+            return a.timeNs < b.timeNs;
+        });
+        for(const Pending &record : pending_) {
+            FormatRecord(out_, time_, record.timeNs, record.level, record.tid, arena_.data() + record.offset,
+                         record.size);
+        }
+        WriteAll(g_fd, out_);
+    }
+
+private:
+    std::vector<Pending> pending_;
+    std::string arena_;
+    std::string out_;
+    TimeFormatter time_;
+    uint64_t reported_dropped_ = 0;
+};
+
+void WriterMain()
+{
+    Writer writer;
+    std::unique_lock<std::mutex> lock(g_mutex);
+    while(!g_stopping) {
+        g_cond.wait_for(lock, std::chrono::milliseconds(Logger::kFlushIntervalMs));
+        lock.unlock();
+        writer.Drain();
+        lock.lock();
+    }
+    lock.unlock();
+    writer.Drain();
+}
+
+} // namespace
+
+const size_t Logger::kRingBytes;
+const size_t Logger::kMaxMessageBytes;
+const int Logger::kFlushIntervalMs;
+
+void Logger::Start(int fd, Level level, Format format)
+{
+    if(g_running.load()) return;
+    g_fd = fd;
+    g_format = format;
+    SetLevel(level);
+    g_stopping = false;
+    // 写入线程屏蔽所有信号，信号只投递给服务自己的线程（热重启的 SIGUSR2 由主线程的 signalfd 处理）
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    g_writer = std::thread(WriterMain);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    g_running.store(true, std::memory_order_release);
+}
+
+void Logger::Stop()
+{
+    if(!g_running.exchange(false)) return;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_stopping = true;
+    }
+    g_cond.notify_one();
+    g_writer.join();
+}
+
+bool Logger::Enabled(Level level)
+{
+    return level >= g_level.load(std::memory_order_relaxed);
+}
+
+void Logger::SetLevel(Level level)
+{
+    g_level.store(level, std::memory_order_relaxed);
+}
+
+uint64_t Logger::Dropped()
+{
+    std::lock_guard<std::mutex> lock(g_ringsMutex);
+    uint64_t total = 0;
+    for(Ring *ring : g_rings) total += ring->dropped.load(std::memory_order_relaxed);
+    return total;
+}
+
+bool Logger::ParseLevel(const char *name, Level &level)
+{
+    static const char *kNames[] = {"debug", "info", "warn", "error"};
+    for(int i = 0; i < 4; ++i) {
+        if(strcmp(name, kNames[i]) == 0) {
+            level = static_cast<Level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::Submit(Level level, int64_t timeNs, const char *text, size_t size)
+{
+    if(!g_running.load(std::memory_order_acquire)) {
+        // 写入线程未运行：同步写到标准错误
+        std::string out;
+        TimeFormatter time;
+        FormatRecord(out, time, timeNs, level, static_cast<uint32_t>(syscall(SYS_gettid)), text, size);
+        WriteAll(2, out);
+        return;
+    }
+    Ring &ring = LocalRing();
+    RecordHeader header = {timeNs, static_cast<uint32_t>(size), static_cast<uint32_t>(level)};
+    size_t need = sizeof(header) + size;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t used = head - ring.tail.load(std::memory_order_acquire);
+    if(need > kRingBytes - used) {
+        ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    CopyIn(ring, head, &header, sizeof(header));
+    CopyIn(ring, head + sizeof(header), text, size);
+    ring.head.store(head + need, std::memory_order_release);
+    // 过半时提前唤醒写入线程；不持锁通知，漏掉的唤醒由写入线程的定时轮询兜底
+    if(used + need > kRingBytes / 2) g_cond.notify_one();
+}
+
+LogLine::LogLine(Logger::Level level)
+    : level_(level), time_ns_(NowNs()), errno_(errno), size_(0)
+{
+}
+
+LogLine::~LogLine()
+{
+    Logger::Submit(level_, time_ns_, buffer_, size_);
+}
+
+void LogLine::Append(const char *data, size_t size)
+{
+    size_t room = sizeof(buffer_) - size_;
+    if(size > room) size = room;
+    memcpy(buffer_ + size_, data, size);
+    size_ += size;
+}
+
+LogLine &LogLine::operator<<(const char *text)
+{
+    if(text) Append(text, strlen(text));
+    return *this;
+}
+
+LogLine &LogLine::operator<<(const std::string &text)
+{
+    Append(text.data(), text.size());
+    return *this;
+}
+
+LogLine &LogLine::operator<<(char c)
+{
+    Append(&c, 1);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(bool value)
+{
+    return *this << (value ? "true" : "false");
+}
+
+LogLine &LogLine::operator<<(int value)
+{
+    return *this << static_cast<long long>(value);
+}
+
+LogLine &LogLine::operator<<(unsigned value)
+{
+    return *this << static_cast<unsigned long long>(value);
+}
+
+LogLine &LogLine::operator<<(long value)
+{
+    return *this << static_cast<long long>(value);
+}
+
+LogLine &LogLine::operator<<(unsigned long value)
+{
+    return *this << static_cast<unsigned long long>(value);
+}
+
+LogLine &LogLine::operator<<(long long value)
+{
+    char text[24];
+    int size = snprintf(text, sizeof(text), "%lld", value);
+    Append(text, static_cast<size_t>(size));
+    return *this;
+}
+
+LogLine &LogLine::operator<<(unsigned long long value)
+{
+    char text[24];
+    int size = snprintf(text, sizeof(text), "%llu", value);
+    Append(text, static_cast<size_t>(size));
+    return *this;
+}
+
+LogLine &LogLine::operator<<(double value)
+{
+    char text[32];
+    int size = snprintf(text, sizeof(text), "%g", value);
+    Append(text, static_cast<size_t>(size));
+    return *this;
+}
+
+LogLine &LogLine::operator<<(LogErrno)
+{
+    char text[128];
+    // GNU 版本的 strerror_r 返回描述字符串，不一定写入 text
+    const char *message = strerror_r(errno_, text, sizeof(text));
+    return *this << message;
+}
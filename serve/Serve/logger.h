@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// 异步日志：每个线程第一次写日志时分配自己的环形缓冲区（单生产者单消费者，无锁），
+// 记录为二进制头（纳秒墙上时间、级别、线程号）加已格式化的正文，写入线程每 kFlushIntervalMs
+// 或某个缓冲区过半时取走所有线程的记录，按时间排序后格式化时间戳，合并为少数几次 write。
+// 网络线程写日志只做一次栈上格式化和一次内存拷贝，从不阻塞；缓冲区满时丢弃该条并计数。
+// Start 之前（以及 Stop 之后）的日志直接同步写到标准错误。
+class Logger {
+public:
+    enum Level {
+        kDebug,
+        kInfo,
+        kWarn,
+        kError
+    };
+    enum Format {
+        kText,      // 2026-01-02 03:04:05.123456 INFO  [1234] 正文
+        kJsonLines  // {"ts":"...","level":"info","tid":1234,"msg":"..."}
+    };
+    static const size_t kRingBytes = 256 * 1024;
+    static const size_t kMaxMessageBytes = 2048; // 超出部分截断
+    static const int kFlushIntervalMs = 10;
+
+    // 启动写入线程，日志写到 fd（不接管其所有权）；level 以下的日志在格式化之前丢弃
+    static void Start(int fd = 1, Level level = kInfo, Format format = kText);
+    // 写出所有线程已提交的日志后停止写入线程
+    static void Stop();
+
+    static bool Enabled(Level level);
+    static void SetLevel(Level level);
+    // 缓冲区满而丢弃的日志条数
+    static uint64_t Dropped();
+
+    static bool ParseLevel(const char *name, Level &level);
+
+    // 由 LogLine 调用：timeNs 为日志点取到的墙上时间
+    static void Submit(Level level, int64_t timeNs, const char *text, size_t size);
+};
+
+// 与 perror 相同：输出构造 LogLine 时的 errno 对应的错误描述
+struct LogErrno {};
+
+// 一条日志：在栈上缓冲区中格式化，析构时提交
+class LogLine {
+public:
+    explicit LogLine(Logger::Level level);
+    ~LogLine();
+
+    LogLine &operator<<(const char *text);
+    LogLine &operator<<(const std::string &text);
+    LogLine &operator<<(char c);
+    LogLine &operator<<(bool value);
+    LogLine &operator<<(int value);
+    LogLine &operator<<(unsigned value);
+    LogLine &operator<<(long value);
+    LogLine &operator<<(unsigned long value);
+    LogLine &operator<<(long long value);
+    LogLine &operator<<(unsigned long long value);
+    LogLine &operator<<(double value);
+    LogLine &operator<<(LogErrno);
+
+private:
+    LogLine(const LogLine&) = delete;
+    LogLine &operator=(const LogLine&) = delete;
+    void Append(const char *data, size_t size);
+
+    Logger::Level level_;
+    int64_t time_ns_;
+    int errno_;
+    size_t size_;
+    char buffer_[Logger::kMaxMessageBytes];
+};
+
+// 编译期最低级别（0 debug，1 info，2 warn）：低于它的日志点编译为 while(false)，参数不求值也不生成代码。
+// 默认 1，调试构建可以 -DCHATSERVE_LOG_MIN_LEVEL=0 打开 LOG_DEBUG
+#ifndef CHATSERVE_LOG_MIN_LEVEL
+#define CHATSERVE_LOG_MIN_LEVEL 1
+#endif
+
+// 用只执行一次的 for 而不是 if/else 包装，日志语句写在不带花括号的 if 里也不会吞掉外层的 else
+#define CHATSERVE_LOG(level) \
+    for(bool chatserve_log_once_ = Logger::Enabled(level); chatserve_log_once_; chatserve_log_once_ = false) \
+        LogLine(level)
+#define CHATSERVE_LOG_OFF(level) \
+    while(false) LogLine(level)
+
+#if CHATSERVE_LOG_MIN_LEVEL <= 0
+#define LOG_DEBUG CHATSERVE_LOG(Logger::kDebug)
+#else
+#define LOG_DEBUG CHATSERVE_LOG_OFF(Logger::kDebug)
+#endif
+#if CHATSERVE_LOG_MIN_LEVEL <= 1
+#define LOG_INFO CHATSERVE_LOG(Logger::kInfo)
+#else
+#define LOG_INFO CHATSERVE_LOG_OFF(Logger::kInfo)
+#endif
+#if CHATSERVE_LOG_MIN_LEVEL <= 2
+#define LOG_WARN CHATSERVE_LOG(Logger::kWarn)
+#else
+#define LOG_WARN CHATSERVE_LOG_OFF(Logger::kWarn)
+#endif
+#define LOG_ERROR CHATSERVE_LOG(Logger::kError)
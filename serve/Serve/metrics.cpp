@@ -0,0 +1,191 @@
+#include "metrics.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+
+namespace {
+
+struct HistogramShard {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> buckets[Metrics::kBuckets];
+};
+
+// 一个线程的全部指标；值初始化为零，线程退出后保留，已记录的数据不会丢失
+struct Shard {
+    std::atomic<uint64_t> counters[Metrics::kCounterCount];
+    HistogramShard histograms[Metrics::kHistogramCount];
+};
+
+std::mutex g_shardsMutex;
+std::vector<Shard*> g_shards;
+
+Shard &LocalShard()
+{
+    thread_local Shard *shard = nullptr;
+    if(!shard) {
+        shard = new Shard();
+        std::lock_guard<std::mutex> lock(g_shardsMutex);
+        g_shards.push_back(shard);
+    }
+    return *shard;
+}
+
+// 只有所属线程写入，读改写无需原子指令；导出线程用 relaxed 读取
+inline void Bump(std::atomic<uint64_t> &value, uint64_t n)
+{
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+const char *kCounterNames[Metrics::kCounterCount][2] = {
+    {"chatserve_connections_opened_total", "Connections registered on a reactor (accepted or taken over)"},
+    {"chatserve_connections_closed_total", "Connections closed"},
+    {"chatserve_frames_in_total", "Frames parsed from clients"},
+    {"chatserve_login_success_total", "Successful logins"},
+    {"chatserve_login_failed_total", "Rejected logins"},
+    {"chatserve_forward_delivered_total", "Forwards delivered to an online target"},
+    {"chatserve_forward_stored_total", "Forwards stored in the offline mailbox"},
+    {"chatserve_forward_rejected_total", "Forwards to unknown users or full mailboxes"},
+    {"chatserve_room_messages_total", "Room messages fanned out"},
+    {"chatserve_broadcast_frames_total", "Frames queued by presence and room fan-out"},
+    {"chatserve_slow_consumer_total", "Frames rejected by the send high-water mark"},
+    {"chatserve_net_syscalls_total", "Network path syscalls: waits, reads, sends, accepts, wakeups and epoll_ctl"},
+    {"chatserve_password_rejected_total", "Register, login and password changes rejected because the hashing queue was full"},
+    {"chatserve_password_migrated_total", "Plaintext passwords rehashed on login"},
+    {"chatserve_rate_limited_user_total", "Requests rejected by the per-user token bucket"},
+    {"chatserve_rate_limited_address_total", "Requests rejected by the per-address token bucket"},
+    {"chatserve_presence_deltas_total", "Coalesced presence delta windows published"},
+    {"chatserve_presence_cancelled_total", "Presence changes cancelled out within one window"},
+    {"chatserve_presence_frames_saved_total", "Presence frames saved by coalescing instead of per-change broadcast"},
+};
+
+const char *kHistogramNames[Metrics::kHistogramCount][2] = {
+    {"chatserve_accept_latency_us", "accept() to connection registered on its reactor"},
+    {"chatserve_login_latency_us", "Login frame parsed to reply queued"},
+    {"chatserve_forward_latency_us", "Forward frame parsed to frame queued for an online target"},
+    {"chatserve_broadcast_latency_us", "One presence delta or room message fan-out"},
+    {"chatserve_store_latency_us", "Store request submitted to callback, including queueing and sync"},
+    {"chatserve_password_latency_us", "Password hash or verify task submitted to finished, including queueing"},
+};
+
+} // namespace
+
+void Metrics::Increment(Counter counter, uint64_t n)
+{
+    Bump(LocalShard().counters[counter], n);
+}
+
+void Metrics::Record(Histogram histogram, int64_t micros)
+{
+    uint64_t value = micros > 0 ? static_cast<uint64_t>(micros) : 0;
+    HistogramShard &shard = LocalShard().histograms[histogram];
+    Bump(shard.count, 1);
+    Bump(shard.sum, value);
+    Bump(shard.buckets[BucketIndex(value)], 1);
+}
+
+int64_t Metrics::NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t Metrics::BucketIndex(uint64_t micros)
+{
+    const uint64_t subBuckets = 1ULL << kSubBucketBits;
+    if(micros < subBuckets) return static_cast<size_t>(micros);
+    size_t msb = 63 - __builtin_clzll(micros);
+    size_t shift = msb - kSubBucketBits;
+    size_t index = ((shift + 1) << kSubBucketBits) + static_cast<size_t>((micros >> shift) - subBuckets);
+    return index < kBuckets ? index : kBuckets - 1;
+}
+
+uint64_t Metrics::BucketUpperBound(size_t index)
+{
+    const uint64_t subBuckets = 1ULL << kSubBucketBits;
+    if(index < subBuckets) return index;
+    size_t shift = (index >> kSubBucketBits) - 1;
+    uint64_t mantissa = subBuckets + (index & (subBuckets - 1));
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void Metrics::Snapshot::Add(uint64_t micros)
+{
+    ++count;
+    sum += micros;
+    ++buckets[BucketIndex(micros)];
+}
+
+uint64_t Metrics::Snapshot::Quantile(double q) const
+{
+    if(count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * count);
+    if(rank >= count) rank = count - 1;
+    uint64_t seen = 0;
+    for(size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if(seen > rank) return BucketUpperBound(i);
+    }
+    return BucketUpperBound(kBuckets - 1);
+}
+
+uint64_t Metrics::CounterValue(Counter counter)
+{
+    std::lock_guard<std::mutex> lock(g_shardsMutex);
+    uint64_t total = 0;
+    for(Shard *shard : g_shards) total += shard->counters[counter].load(std::memory_order_relaxed);
+    return total;
+}
+
+void Metrics::Collect(Histogram histogram, Snapshot &snapshot)
+{
+    std::lock_guard<std::mutex> lock(g_shardsMutex);
+    for(Shard *shard : g_shards) {
+        const HistogramShard &h = shard->histograms[histogram];
+        snapshot.count += h.count.load(std::memory_order_relaxed);
+        snapshot.sum += h.sum.load(std::memory_order_relaxed);
+        for(size_t i = 0; i < kBuckets; ++i) snapshot.buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+void Metrics::RenderGauge(std::string &out, const char *name, const char *help, double value)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", name, help, name, name, value);
+    out += line;
+}
+
+void Metrics::RenderCounter(std::string &out, const char *name, const char *help, uint64_t value)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+             static_cast<unsigned long long>(value));
+    out += line;
+}
+
+void Metrics::Render(std::string &out)
+{
+    char line[256];
+    for(int c = 0; c < kCounterCount; ++c) {
+        RenderCounter(out, kCounterNames[c][0], kCounterNames[c][1], CounterValue(static_cast<Counter>(c)));
+    }
+    static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for(int h = 0; h < kHistogramCount; ++h) {
+        const char *name = kHistogramNames[h][0];
+        std::unique_ptr<Snapshot> snapshot(new Snapshot);
+        Collect(static_cast<Histogram>(h), *snapshot);
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s summary\n", name, kHistogramNames[h][1], name);
+        out += line;
+        for(double q : kQuantiles) {
+            snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %llu\n", name, q,
+                     static_cast<unsigned long long>(snapshot->Quantile(q)));
+            out += line;
+        }
+        snprintf(line, sizeof(line), "%s_sum %llu\n%s_count %llu\n", name, static_cast<unsigned long long>(snapshot->sum),
+                 name, static_cast<unsigned long long>(snapshot->count));
+        out += line;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// 进程内指标：每个线程第一次记录时分配自己的分片，计数器与直方图只由所属线程写入
+// （单写者，relaxed 读改写，不加锁也没有 lock 前缀指令），导出时把所有分片相加。
+// 直方图为 HDR 风格的对数-线性分桶：每个 2 的幂区间再等分为 16 个子桶，相对误差约 6%，
+// 以微秒为单位覆盖 0 到约 12 天。导出格式为 Prometheus 文本格式（summary 类型）。
+class Metrics {
+public:
+    // 子桶位数 4：小于 16 的值各占一个桶，之后每个 2 的幂区间 16 个桶，最大到 2^40
+    static const size_t kSubBucketBits = 4;
+    static const size_t kBuckets = 37 << kSubBucketBits;
+
+    enum Counter {
+        kConnectionsOpened,
+        kConnectionsClosed,
+        kFramesIn,
+        kLoginSuccess,
+        kLoginFailed,
+        kForwardDelivered,  // 目标在线，直接投递
+        kForwardStored,     // 目标离线，写入信箱
+        kForwardRejected,   // 目标不存在或信箱已满
+        kRoomMessages,
+        kBroadcastFrames,   // 在线状态增量与聊天室消息扇出的帧数
+        kSlowConsumer,      // 发送队列超过高水位
+        kNetworkSyscalls,   // 网络路径上的系统调用：等待、读、写、accept、跨线程唤醒与 epoll_ctl
+        kPasswordRejected,  // 口令哈希队列已满而拒绝的注册/登录/改密
+        kPasswordMigrated,  // 明文口令在登录时迁移为哈希存储
+        kRateLimitedUser,   // 用户的令牌桶不足而拒绝的请求
+        kRateLimitedAddress, // 来源地址的令牌桶不足而拒绝的请求
+        kPresenceDeltas,    // 合并后发出的在线状态增量（每个窗口一个）
+        kPresenceCancelled, // 窗口内一上一下互相抵消的状态变化
+        kPresenceFramesSaved, // 相比逐条广播少发的帧数
+        kCounterCount
+    };
+    enum Histogram {
+        kAcceptLatency,     // accept 到连接在反应器上注册完成
+        kLoginLatency,      // 登录帧解析到回复入队
+        kForwardLatency,    // 转发帧解析到投递入队（在线目标）
+        kBroadcastLatency,  // 一次在线状态增量或聊天室消息的扇出
+        kStoreLatency,      // 存储层请求从提交到回调（含排队与落盘）
+        kPasswordLatency,   // 口令哈希/校验任务从提交到算完（含排队）
+        kHistogramCount
+    };
+
+    static void Increment(Counter counter, uint64_t n = 1);
+    static void Record(Histogram histogram, int64_t micros);
+    // 单调时钟微秒数，计时起止都用它
+    static int64_t NowUs();
+
+    // 以 Prometheus 文本格式追加所有计数器与直方图
+    static void Render(std::string &out);
+    static void RenderGauge(std::string &out, const char *name, const char *help, double value);
+    // 由其他模块自行累计的单调总数，按计数器输出，name 应以 _total 结尾
+    static void RenderCounter(std::string &out, const char *name, const char *help, uint64_t value);
+
+    // 所有分片相加后的直方图，负载生成器等也用它统计分位数
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t buckets[kBuckets] = {};
+        // 取分位数所在桶的上界（微秒）
+        uint64_t Quantile(double q) const;
+        void Add(uint64_t micros);
+    };
+    static uint64_t CounterValue(Counter counter);
+    static void Collect(Histogram histogram, Snapshot &snapshot);
+
+    static size_t BucketIndex(uint64_t micros);
+    static uint64_t BucketUpperBound(size_t index);
+};
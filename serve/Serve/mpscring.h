@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// 有界无锁环形队列：多生产者、单消费者。
+// 每个槽带一个序号，生产者用 CAS 抢占写位置，消费者按序号判断槽是否就绪（Vyukov 算法）。
+template <typename T>
+class MpscRing {
+public:
+    explicit MpscRing(size_t capacity)
+        : enqueue_pos_(0),
+          dequeue_pos_(0)
+    {
+        size_t size = 2;
+        while(size < capacity) size <<= 1;
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for(size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // 任意线程调用；队列已满时返回 false，value 保持不变
+    bool TryPush(T &value)
+    {
+        Cell *cell;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(diff == 0) {
+                if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 仅消费者线程调用；没有就绪元素时返回 false
+    bool TryPop(T &value)
+    {
+        Cell *cell = &cells_[dequeue_pos_ & mask_];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(dequeue_pos_ + 1) < 0)
+            return false;
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+
+    // 仅消费者线程调用：没有已抢占但尚未取走的槽（包括生产者还没写完的槽）
+    bool Empty() const { return enqueue_pos_.load(std::memory_order_acquire) == dequeue_pos_; }
+
+    size_t Capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    // 生产者与消费者的位置分开放在不同缓存行，避免伪共享
+    char pad0_[64];
+    std::atomic<size_t> enqueue_pos_;
+    char pad1_[64];
+    size_t dequeue_pos_;
+};
@@ -0,0 +1,592 @@
+#include "offlinemailbox.h"
+#include "logger.h"
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+
+// 记录格式（主机字节序）：
+//   校验和(4) + 正文长度(4) + 正文
+//   正文 = 类型(1) + 序号(8) + 收件人长度(2) + 收件人 [+ 发送者长度(2) + 发送者 + 消息体]
+// 类型 'M' 为一条离线消息；'D' 表示该收件人序号不大于记录序号的消息均已送达
+const char kRecordMessage = 'M';
+const char kRecordDelivered = 'D';
+const size_t kRecordHeader = 8;
+const size_t kRecordMinBody = 1 + 8 + 2;
+const char kSegmentSuffix[] = ".log";
+
+// FNV-1a，用于识别崩溃时写了一半的尾部记录
+uint32_t Checksum(const char *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void PutRaw(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T GetRaw(const char *data)
+{
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// 解析出的记录正文，字段指向原缓冲区
+struct RecordView {
+    char type;
+    uint64_t seq;
+    std::string recipient;
+    const char *sender;
+    size_t senderSize;
+    const char *body;
+    size_t bodySize;
+};
+
+bool ParseRecordBody(const char *data, size_t size, RecordView &record)
+{
+    if(size < kRecordMinBody) return false;
+    record.type = data[0];
+    record.seq = GetRaw<uint64_t>(data + 1);
+    size_t recipientSize = GetRaw<uint16_t>(data + 9);
+    size_t pos = kRecordMinBody;
+    if(pos + recipientSize > size) return false;
+    record.recipient.assign(data + pos, recipientSize);
+    pos += recipientSize;
+    record.sender = nullptr;
+    record.senderSize = 0;
+    record.body = nullptr;
+    record.bodySize = 0;
+    if(record.type == kRecordDelivered) return pos == size;
+    if(record.type != kRecordMessage || pos + 2 > size) return false;
+    record.senderSize = GetRaw<uint16_t>(data + pos);
+    pos += 2;
+    if(pos + record.senderSize > size) return false;
+    record.sender = data + pos;
+    pos += record.senderSize;
+    record.body = data + pos;
+    record.bodySize = size - pos;
+    return true;
+}
+
+bool PreadAll(int fd, char *data, size_t size, uint64_t offset)
+{
+    while(size > 0) {
+        ssize_t n = pread(fd, data, size, static_cast<off_t>(offset));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+OfflineMailbox::OfflineMailbox()
+    : per_user_limit_(0),
+      batch_window_ms_(0),
+      segment_bytes_(0),
+      active_id_(0),
+      dirty_(false),
+      sync_failed_(false),
+      next_seq_(1),
+      stopping_(false)
+{
+}
+
+OfflineMailbox::~OfflineMailbox()
+{
+    Close();
+}
+
+bool OfflineMailbox::Open(const std::string &dir, size_t perUserLimit, int batchWindowMs, size_t segmentBytes)
+{
+    dir_ = dir;
+    per_user_limit_ = perUserLimit;
+    batch_window_ms_ = batchWindowMs;
+    segment_bytes_ = segmentBytes;
+    if(mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR << "mkdir mailbox: " << LogErrno();
+        return false;
+    }
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if(!Recover()) {
+        Close();
+        return false;
+    }
+    size_t pending = 0;
+    for(auto &pair : boxes_) pending += pair.second.size();
+    LOG_INFO << "离线信箱: " << segments_.size() << " 个日志段，" << boxes_.size() << " 个收件人共 "
+             << pending << " 条未送达消息，恢复耗时 "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()
+             << " ms";
+    stopping_ = false;
+    thread_ = std::thread([this]() { Run(); });
+    return true;
+}
+
+void OfflineMailbox::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_one();
+    if(thread_.joinable()) thread_.join();
+    if(dirty_) Sync();
+    for(auto &pair : segments_) {
+        if(pair.second.fd >= 0) close(pair.second.fd);
+    }
+    segments_.clear();
+    boxes_.clear();
+    write_buffer_.clear();
+    dirty_ = false;
+}
+
+void OfflineMailbox::Append(const std::string &recipient, const std::string &sender, const std::string &body, Callback done)
+{
+    Post([this, recipient, sender, body]() { return DoAppend(recipient, sender, body); }, std::move(done), true);
+}
+
+void OfflineMailbox::Fetch(const std::string &recipient, uint64_t ackSeq, size_t maxMessages, FetchCallback done)
+{
+    std::shared_ptr<std::vector<Message>> messages = std::make_shared<std::vector<Message>>();
+    Post([this, recipient, ackSeq, maxMessages, messages]() {
+        return DoFetch(recipient, ackSeq, maxMessages, *messages);
+    }, [done, messages](Result result) {
+        done(result, *messages);
+    }, false);
+}
+
+void OfflineMailbox::Purge(const std::string &recipient, Callback done)
+{
+    Post([this, recipient]() {
+        Acknowledge(recipient, next_seq_ - 1);
+        return kOk;
+    }, std::move(done), true);
+}
+
+size_t OfflineMailbox::QueueDepth() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void OfflineMailbox::Post(std::function<Result()> run, Callback done, bool mutation)
+{
+    Task task;
+    task.run = std::move(run);
+    task.done = std::move(done);
+    task.mutation = mutation;
+    task.result = kFailed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+}
+
+void OfflineMailbox::Run()
+{
+    while(true) {
+        std::deque<Task> tasks;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if(tasks_.empty()) return;
+            // 有新消息时再等一个合并窗口，随后几毫秒内的消息共用一次 fdatasync
+            bool hasMutation = std::any_of(tasks_.begin(), tasks_.end(), [](const Task &t) { return t.mutation; });
+            if(hasMutation && batch_window_ms_ > 0 && !stopping_) {
+                cond_.wait_for(lock, std::chrono::milliseconds(batch_window_ms_), [this]() { return stopping_; });
+            }
+            tasks.swap(tasks_);
+        }
+
+        batch_appends_.clear();
+        for(auto &task : tasks) {
+            task.result = task.run();
+        }
+        if(dirty_ && !Sync()) {
+            // 落盘失败时本批的请求都按失败回复：撤销内存中的新消息，发送者重试时不会重复投递；
+            // 同批取出的消息可能包含它们，取信也按失败处理，收件人下次从已确认的位置重新取
+            DiscardBatchAppends();
+            for(auto &task : tasks) {
+                if(task.result == kOk) task.result = kFailed;
+            }
+        }
+        // 搬移到当前段的副本确认落盘之前，旧段上的原记录是唯一可靠的一份，不能删除
+        if(!sync_failed_) ReclaimSegments();
+        // 落盘之后才回复
+        for(auto &task : tasks) {
+            if(task.done) task.done(task.result);
+        }
+    }
+}
+
+std::string OfflineMailbox::SegmentPath(uint64_t id) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu", static_cast<unsigned long long>(id));
+    return dir_ + "/" + name + kSegmentSuffix;
+}
+
+bool OfflineMailbox::Recover()
+{
+    DIR *d = opendir(dir_.c_str());
+    if(!d) {
+        LOG_ERROR << "opendir mailbox: " << LogErrno();
+        return false;
+    }
+    std::vector<uint64_t> ids;
+    while(struct dirent *ent = readdir(d)) {
+        const char *name = ent->d_name;
+        char *end = nullptr;
+        unsigned long long id = strtoull(name, &end, 10);
+        if(end != name && strcmp(end, kSegmentSuffix) == 0 && id > 0) ids.push_back(id);
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+
+    // 重放期间记录每个收件人已确认的序号，跳过被搬移过的旧消息副本
+    std::unordered_map<std::string, uint64_t> acked;
+    for(size_t i = 0; i < ids.size(); ++i) {
+        if(!RecoverSegment(ids[i], i + 1 == ids.size(), acked)) return false;
+    }
+    for(auto it = boxes_.begin(); it != boxes_.end();) {
+        if(it->second.empty()) it = boxes_.erase(it);
+        else ++it;
+    }
+    if(ids.empty()) {
+        if(!OpenActive(1)) return false;
+    } else {
+        active_id_ = ids.back();
+    }
+    ReclaimSegments();
+    return true;
+}
+
+bool OfflineMailbox::RecoverSegment(uint64_t id, bool last, std::unordered_map<std::string, uint64_t> &acked)
+{
+    std::string path = SegmentPath(id);
+    int fd = open(path.c_str(), (last ? O_RDWR | O_APPEND : O_RDONLY) | O_CLOEXEC);
+    if(fd < 0) {
+        LOG_ERROR << "open " << path << ": " << LogErrno();
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        LOG_ERROR << "fstat " << path << ": " << LogErrno();
+        close(fd);
+        return false;
+    }
+    std::string data(static_cast<size_t>(st.st_size), '\0');
+    if(!data.empty() && !PreadAll(fd, &data[0], data.size(), 0)) {
+        LOG_ERROR << "read " << path << ": " << LogErrno();
+        close(fd);
+        return false;
+    }
+
+    Segment &segment = segments_[id];
+    segment.fd = fd;
+    size_t pos = 0;
+    while(pos + kRecordHeader <= data.size()) {
+        uint32_t checksum = GetRaw<uint32_t>(data.data() + pos);
+        uint32_t length = GetRaw<uint32_t>(data.data() + pos + 4);
+        const char *body = data.data() + pos + kRecordHeader;
+        RecordView record;
+        if(length > data.size() - pos - kRecordHeader || Checksum(body, length) != checksum
+           || !ParseRecordBody(body, length, record)) {
+            break;
+        }
+        uint32_t size = static_cast<uint32_t>(kRecordHeader + length);
+        next_seq_ = std::max(next_seq_, record.seq + 1);
+        std::deque<Entry> &box = boxes_[record.recipient];
+        if(record.type == kRecordDelivered) {
+            uint64_t &ackSeq = acked[record.recipient];
+            ackSeq = std::max(ackSeq, record.seq);
+            Drop(box, ackSeq);
+        } else if(record.seq > acked[record.recipient]) {
+            // 搬移产生的副本与原记录序号相同，只保留一份；副本可能排在更新的消息之后，按序号插入
+            Entry entry = {record.seq, id, pos, size};
+            auto it = std::lower_bound(box.begin(), box.end(), record.seq,
+                                       [](const Entry &e, uint64_t seq) { return e.seq < seq; });
+            if(it == box.end() || it->seq != record.seq) {
+                box.insert(it, entry);
+                ++segment.live;
+                segment.liveBytes += size;
+            }
+        }
+        pos += size;
+    }
+    segment.size = pos;
+    if(pos != data.size()) {
+        if(last) {
+            // 崩溃时写了一半的尾部记录，截掉后继续追加
+            LOG_WARN << "离线信箱段 " << path << " 尾部 " << data.size() - pos << " 字节不完整，已截断";
+            if(ftruncate(fd, static_cast<off_t>(pos)) < 0) {
+                LOG_ERROR << "ftruncate " << path << ": " << LogErrno();
+                return false;
+            }
+        } else {
+            LOG_ERROR << "离线信箱段 " << path << " 在偏移 " << pos << " 处损坏，忽略其后的记录";
+        }
+    }
+    return true;
+}
+
+bool OfflineMailbox::OpenActive(uint64_t id)
+{
+    std::string path = SegmentPath(id);
+    int fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        LOG_ERROR << "open " << path << ": " << LogErrno();
+        return false;
+    }
+    // 新段的目录项也要落盘，否则崩溃后整段可能丢失
+    int dirFd = open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    segments_[id].fd = fd;
+    active_id_ = id;
+    return true;
+}
+
+bool OfflineMailbox::Roll()
+{
+    if(!Sync()) return false;
+    if(!OpenActive(active_id_ + 1)) return false;
+    CompactHead();
+    return true;
+}
+
+bool OfflineMailbox::FlushBuffer()
+{
+    const char *data = write_buffer_.data();
+    size_t left = write_buffer_.size();
+    int fd = segments_[active_id_].fd;
+    while(left > 0) {
+        ssize_t n = write(fd, data, left);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            LOG_ERROR << "write mailbox: " << LogErrno();
+            // 只保留未写出的部分，重试时不会把已写出的前缀再写一遍，索引中的偏移保持正确
+            write_buffer_.erase(0, write_buffer_.size() - left);
+            return false;
+        }
+        data += n;
+        left -= static_cast<size_t>(n);
+    }
+    write_buffer_.clear();
+    return true;
+}
+
+bool OfflineMailbox::Sync()
+{
+    if(!FlushBuffer()) return false;
+    if(dirty_ && fdatasync(segments_[active_id_].fd) < 0) {
+        LOG_ERROR << "fdatasync mailbox: " << LogErrno();
+        if(!sync_failed_) LOG_ERROR << "离线信箱落盘失败，停止回收旧段直到重启";
+        sync_failed_ = true;
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+void OfflineMailbox::WriteRecord(char type, uint64_t seq, const std::string &recipient,
+                                 const std::string &sender, const std::string &body, Entry *entry)
+{
+    std::string record;
+    record.reserve(kRecordHeader + kRecordMinBody + recipient.size() + 2 + sender.size() + body.size());
+    PutRaw<uint32_t>(record, 0);
+    PutRaw<uint32_t>(record, 0);
+    record.push_back(type);
+    PutRaw<uint64_t>(record, seq);
+    PutRaw<uint16_t>(record, static_cast<uint16_t>(recipient.size()));
+    record.append(recipient);
+    if(type == kRecordMessage) {
+        PutRaw<uint16_t>(record, static_cast<uint16_t>(sender.size()));
+        record.append(sender);
+        record.append(body);
+    }
+    uint32_t length = static_cast<uint32_t>(record.size() - kRecordHeader);
+    uint32_t checksum = Checksum(record.data() + kRecordHeader, length);
+    memcpy(&record[0], &checksum, sizeof(checksum));
+    memcpy(&record[4], &length, sizeof(length));
+
+    Segment &segment = segments_[active_id_];
+    if(entry) {
+        entry->seq = seq;
+        entry->segment = active_id_;
+        entry->offset = segment.size;
+        entry->size = static_cast<uint32_t>(record.size());
+        ++segment.live;
+        segment.liveBytes += record.size();
+    }
+    segment.size += record.size();
+    write_buffer_.append(record);
+    dirty_ = true;
+}
+
+void OfflineMailbox::Drop(std::deque<Entry> &box, uint64_t ackSeq)
+{
+    while(!box.empty() && box.front().seq <= ackSeq) {
+        auto it = segments_.find(box.front().segment);
+        if(it != segments_.end()) {
+            --it->second.live;
+            it->second.liveBytes -= box.front().size;
+        }
+        box.pop_front();
+    }
+}
+
+void OfflineMailbox::Acknowledge(const std::string &recipient, uint64_t ackSeq)
+{
+    auto it = boxes_.find(recipient);
+    if(it == boxes_.end() || it->second.empty() || it->second.front().seq > ackSeq) return;
+    Drop(it->second, ackSeq);
+    if(it->second.empty()) boxes_.erase(it);
+    WriteRecord(kRecordDelivered, ackSeq, recipient, std::string(), std::string(), nullptr);
+}
+
+void OfflineMailbox::CompactHead()
+{
+    // 从头部起连续挑出大部分已送达的旧段，剩余消息原样复制到当前段（序号不变），
+    // 复制落盘后这些段随 ReclaimSegments 删除；落盘失败过则不再回收，搬移也没有意义
+    if(sync_failed_) return;
+    std::vector<uint64_t> victims;
+    for(auto &pair : segments_) {
+        if(pair.first == active_id_) break;
+        const Segment &segment = pair.second;
+        if(segment.live > 0 && segment.liveBytes * 4 > segment.size) break;
+        if(segment.live > 0) victims.push_back(pair.first);
+    }
+    if(victims.empty()) return;
+    Segment &active = segments_[active_id_];
+    size_t moved = 0;
+    std::string record;
+    for(auto &pair : boxes_) {
+        for(Entry &entry : pair.second) {
+            if(!std::binary_search(victims.begin(), victims.end(), entry.segment)) continue;
+            Segment &from = segments_[entry.segment];
+            record.resize(entry.size);
+            if(!PreadAll(from.fd, &record[0], entry.size, entry.offset)) {
+                LOG_ERROR << "read mailbox: " << LogErrno();
+                continue;
+            }
+            --from.live;
+            from.liveBytes -= entry.size;
+            entry.segment = active_id_;
+            entry.offset = active.size;
+            ++active.live;
+            active.liveBytes += entry.size;
+            active.size += entry.size;
+            write_buffer_.append(record);
+            dirty_ = true;
+            ++moved;
+        }
+    }
+    LOG_INFO << "离线信箱: 从 " << victims.size() << " 个旧段搬移 " << moved << " 条未送达消息";
+}
+
+void OfflineMailbox::ReclaimSegments()
+{
+    // 只从头部按顺序删除：送达记录只会确认更早的消息，删掉的段之前不会再有需要它的记录
+    while(segments_.size() > 1) {
+        auto it = segments_.begin();
+        if(it->first == active_id_ || it->second.live > 0) break;
+        close(it->second.fd);
+        std::string path = SegmentPath(it->first);
+        if(unlink(path.c_str()) < 0) {
+            LOG_ERROR << "unlink " << path << ": " << LogErrno();
+        }
+        segments_.erase(it);
+    }
+}
+
+OfflineMailbox::Result OfflineMailbox::DoAppend(const std::string &recipient, const std::string &sender, const std::string &body)
+{
+    std::deque<Entry> &box = boxes_[recipient];
+    if(per_user_limit_ > 0 && box.size() >= per_user_limit_) return kFull;
+    if(segments_[active_id_].size >= segment_bytes_ && !Roll()) {
+        if(box.empty()) boxes_.erase(recipient);
+        return kFailed;
+    }
+    Entry entry;
+    WriteRecord(kRecordMessage, next_seq_++, recipient, sender, body, &entry);
+    box.push_back(entry);
+    batch_appends_.emplace_back(recipient, entry.seq);
+    return kOk;
+}
+
+void OfflineMailbox::DiscardBatchAppends()
+{
+    // 记录本身留在段文件中；若其实已经写到磁盘，重启重放时仍会出现
+    for(auto &append : batch_appends_) {
+        auto it = boxes_.find(append.first);
+        if(it == boxes_.end()) continue;
+        std::deque<Entry> &box = it->second;
+        // 新消息在队尾附近，从后往前找；同批内已被确认的消息已不在队列中
+        for(auto entry = box.rbegin(); entry != box.rend(); ++entry) {
+            if(entry->seq != append.second) continue;
+            auto segment = segments_.find(entry->segment);
+            if(segment != segments_.end()) {
+                --segment->second.live;
+                segment->second.liveBytes -= entry->size;
+            }
+            box.erase(std::next(entry).base());
+            break;
+        }
+        if(box.empty()) boxes_.erase(it);
+    }
+    batch_appends_.clear();
+}
+
+OfflineMailbox::Result OfflineMailbox::DoFetch(const std::string &recipient, uint64_t ackSeq, size_t maxMessages,
+                                               std::vector<Message> &messages)
+{
+    Acknowledge(recipient, ackSeq);
+    auto it = boxes_.find(recipient);
+    if(it == boxes_.end()) return kOk;
+    // 读取的记录可能还在写缓冲中，先写到文件（不必等 fdatasync）
+    if(!write_buffer_.empty() && !FlushBuffer()) return kFailed;
+    std::string record;
+    for(const Entry &entry : it->second) {
+        if(messages.size() >= maxMessages) break;
+        record.resize(entry.size);
+        RecordView view;
+        if(!PreadAll(segments_[entry.segment].fd, &record[0], entry.size, entry.offset)
+           || !ParseRecordBody(record.data() + kRecordHeader, entry.size - kRecordHeader, view)) {
+            LOG_ERROR << "读取离线消息失败: " << recipient << " #" << entry.seq;
+            return kFailed;
+        }
+        Message message;
+        message.seq = entry.seq;
+        message.sender.assign(view.sender, view.senderSize);
+        message.body.assign(view.body, view.bodySize);
+        messages.push_back(std::move(message));
+    }
+    return kOk;
+}
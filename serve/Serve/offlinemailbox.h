@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+// 离线消息信箱：发给离线用户的消息追加写入目录下的日志段文件（所有收件人共用），
+// 内存中只为每个收件人保存按序号排列的消息位置索引。
+// 送达确认同样以记录的形式追加，启动时顺序重放全部段即可恢复未送达的消息。
+// 所有请求在专用的信箱线程上执行；合并窗口内的写入一次 write + 一次 fdatasync 落盘，
+// 之后才调用完成回调，回调返回成功即表示消息已经持久化。
+// 头部段的消息全部送达后整段删除；头部段大多已送达时把剩余消息搬到当前段再删除，
+// 长期不上线的用户不会拖住磁盘空间的回收。
+class OfflineMailbox {
+public:
+    enum Result {
+        kOk,
+        kFull,   // 收件人的离线消息数已达上限
+        kFailed  // 磁盘读写错误
+    };
+    struct Message {
+        uint64_t seq;       // 全局递增的消息序号，确认送达时使用
+        std::string sender;
+        std::string body;
+    };
+    typedef std::function<void(Result)> Callback;
+    typedef std::function<void(Result, std::vector<Message>&)> FetchCallback;
+
+    OfflineMailbox();
+    ~OfflineMailbox();
+
+    // 打开（必要时创建）信箱目录，重放全部日志段重建索引并启动信箱线程；
+    // perUserLimit 为单个收件人最多保存的消息数，batchWindowMs 为写入的合并窗口，
+    // segmentBytes 为单个日志段的滚动大小
+    bool Open(const std::string &dir, size_t perUserLimit, int batchWindowMs,
+              size_t segmentBytes = 4 * 1024 * 1024);
+    // 执行完已排队的请求后停止信箱线程并关闭段文件
+    void Close();
+
+    void Append(const std::string &recipient, const std::string &sender, const std::string &body, Callback done);
+    // 先确认 ackSeq 及之前的消息已送达，再按序取出其后最多 maxMessages 条；
+    // 没有剩余消息时回调收到空列表
+    void Fetch(const std::string &recipient, uint64_t ackSeq, size_t maxMessages, FetchCallback done);
+    // 丢弃收件人的全部离线消息（注销账号时调用）
+    void Purge(const std::string &recipient, Callback done);
+    // 排队等待信箱线程执行的请求数
+    size_t QueueDepth() const;
+
+private:
+    // 消息在段文件中的位置
+    struct Entry {
+        uint64_t seq;
+        uint64_t segment;
+        uint64_t offset;
+        uint32_t size; // 整条记录的字节数，含记录头
+    };
+    struct Segment {
+        int fd = -1;
+        uint64_t size = 0;      // 文件长度，含尚未写出的缓冲
+        size_t live = 0;        // 尚未送达的消息数
+        uint64_t liveBytes = 0;
+    };
+    struct Task {
+        std::function<Result()> run; // 在信箱线程上执行
+        Callback done;               // 所在批次落盘之后调用，可为空
+        bool mutation;               // 追加消息，触发合并窗口
+        Result result;
+    };
+
+    void Post(std::function<Result()> run, Callback done, bool mutation);
+    void Run();
+    // 以下仅在信箱线程（或 Open 期间）调用
+    bool Recover();
+    bool RecoverSegment(uint64_t id, bool last, std::unordered_map<std::string, uint64_t> &acked);
+    bool OpenActive(uint64_t id);
+    bool Roll();
+    bool FlushBuffer();
+    bool Sync();
+    void WriteRecord(char type, uint64_t seq, const std::string &recipient,
+                     const std::string &sender, const std::string &body, Entry *entry);
+    void Acknowledge(const std::string &recipient, uint64_t ackSeq);
+    void Drop(std::deque<Entry> &box, uint64_t ackSeq);
+    void CompactHead();
+    void ReclaimSegments();
+    void DiscardBatchAppends();
+    std::string SegmentPath(uint64_t id) const;
+    Result DoAppend(const std::string &recipient, const std::string &sender, const std::string &body);
+    Result DoFetch(const std::string &recipient, uint64_t ackSeq, size_t maxMessages, std::vector<Message> &messages);
+
+    std::string dir_;
+    size_t per_user_limit_;
+    int batch_window_ms_;
+    size_t segment_bytes_;
+
+    std::map<uint64_t, Segment> segments_; // 按段号排列，最后一个为当前追加的段
+    uint64_t active_id_;
+    std::string write_buffer_; // 当前段尚未写出的记录
+    bool dirty_;               // 有尚未 fdatasync 的写入
+    // fdatasync 失败过：内核可能已丢弃脏页并清除错误，之后的成功也不能证明此前的写入已落盘，
+    // 从此不再搬移与删除旧段，重启后由重放去重
+    bool sync_failed_;
+    std::vector<std::pair<std::string, uint64_t>> batch_appends_; // 本批追加的 (收件人, 序号)，落盘失败时撤销
+    uint64_t next_seq_;
+    std::unordered_map<std::string, std::deque<Entry>> boxes_;
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Task> tasks_;
+    bool stopping_;
+};
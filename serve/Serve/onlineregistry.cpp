@@ -0,0 +1,85 @@
+#include "onlineregistry.h"
+
+OnlineRegistry::OnlineRegistry(size_t shardCount)
+    : shards_(new Shard[shardCount > 0 ? shardCount : 1]),
+      shard_count_(shardCount > 0 ? shardCount : 1),
+      size_(0)
+{
+}
+
+OnlineRegistry::Shard &OnlineRegistry::ShardFor(const std::string &username) const
+{
+    return shards_[std::hash<std::string>()(username) % shard_count_];
+}
+
+bool OnlineRegistry::Add(const std::string &username, const ConnectionPtr &conn, bool notify)
+{
+    {
+        Shard &shard = ShardFor(username);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if(!shard.clients.emplace(username, conn).second) return false;
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+    if(notify) NotifyPresence(username, true);
+    return true;
+}
+
+bool OnlineRegistry::Remove(const std::string &username, const ConnectionPtr &conn)
+{
+    {
+        Shard &shard = ShardFor(username);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.clients.find(username);
+        if(it == shard.clients.end() || it->second != conn) return false;
+        shard.clients.erase(it);
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    NotifyPresence(username, false);
+    return true;
+}
+
+OnlineRegistry::ConnectionPtr OnlineRegistry::Find(const std::string &username) const
+{
+    Shard &shard = ShardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.clients.find(username);
+    return it != shard.clients.end() ? it->second : ConnectionPtr();
+}
+
+std::vector<OnlineRegistry::ConnectionPtr> OnlineRegistry::Snapshot() const
+{
+    std::vector<ConnectionPtr> clients;
+    clients.reserve(Size());
+    for(size_t i = 0; i < shard_count_; ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        for(auto &pair : shards_[i].clients) {
+            clients.push_back(pair.second);
+        }
+    }
+    return clients;
+}
+
+std::vector<std::string> OnlineRegistry::SnapshotNames() const
+{
+    std::vector<std::string> names;
+    names.reserve(Size());
+    for(size_t i = 0; i < shard_count_; ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        for(auto &pair : shards_[i].clients) {
+            names.push_back(pair.first);
+        }
+    }
+    return names;
+}
+
+void OnlineRegistry::AddPresenceListener(PresenceListener listener)
+{
+    listeners_.push_back(std::move(listener));
+}
+
+void OnlineRegistry::NotifyPresence(const std::string &username, bool online)
+{
+    for(auto &listener : listeners_) {
+        listener(username, online);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+struct ClientConnection;
+
+// 在线用户表：按用户名哈希分成若干条带，每个条带一把锁。
+// 登录、转发查找、下线只锁住用户名所在的条带，互不阻塞；
+// 遍历时逐个条带复制快照，不会长时间持有任何一把锁。
+class OnlineRegistry {
+public:
+    typedef std::shared_ptr<ClientConnection> ConnectionPtr;
+    // 上线/下线通知，在条带锁之外调用
+    typedef std::function<void(const std::string &username, bool online)> PresenceListener;
+
+    explicit OnlineRegistry(size_t shardCount = 64);
+
+    // 用户名不存在时登记并返回 true，已存在返回 false（查重与登记在同一把锁内完成）；
+    // notify 为 false 时不通知上线（热重启接管的连接，在旧进程中早已上线）
+    bool Add(const std::string &username, const ConnectionPtr &conn, bool notify = true);
+    // 仅当登记的仍是 conn 时移除，避免误删同名的新连接
+    bool Remove(const std::string &username, const ConnectionPtr &conn);
+    ConnectionPtr Find(const std::string &username) const;
+
+    std::vector<ConnectionPtr> Snapshot() const;
+    std::vector<std::string> SnapshotNames() const;
+    size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+    // 注册上线/下线监听者，需在服务开始接受连接前完成
+    void AddPresenceListener(PresenceListener listener);
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, ConnectionPtr> clients;
+        char pad[64]; // 相邻条带的锁放在不同缓存行
+    };
+
+    Shard &ShardFor(const std::string &username) const;
+    void NotifyPresence(const std::string &username, bool online);
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_count_;
+    std::atomic<size_t> size_;
+    std::vector<PresenceListener> listeners_;
+};
@@ -0,0 +1,132 @@
+#include "outputbuffer.h"
+#include "metrics.h"
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// 单次 writev 最多合并的帧数
+static const int kMaxIov = 64;
+
+OutputBuffer::OutputBuffer(size_t highWaterMark, size_t queueCapacity)
+    : high_water_mark_(highWaterMark),
+      queued_bytes_(0),
+      flush_scheduled_(false),
+      pending_(queueCapacity),
+      overflowing_(false),
+      out_offset_(0)
+{
+}
+
+OutputBuffer::PushResult OutputBuffer::Push(const Frame &frame, bool ownerThread)
+{
+    size_t size = frame.size();
+    size_t queued = queued_bytes_.fetch_add(size, std::memory_order_relaxed);
+    // 队列为空时总是接受，避免单个大帧永远发不出去
+    if(high_water_mark_ > 0 && queued > 0 && queued + size > high_water_mark_) {
+        queued_bytes_.fetch_sub(size, std::memory_order_relaxed);
+        return kRejected;
+    }
+    if(ownerThread) {
+        // 先收拢其他线程更早入队的帧，保持先后顺序
+        Collect();
+        if(overflowing_.load(std::memory_order_relaxed)) PushOverflow(frame);
+        else out_.push_back(frame);
+    } else {
+        Frame shared(frame);
+        if(overflowing_.load(std::memory_order_acquire) || !pending_.TryPush(shared)) {
+            PushOverflow(shared);
+        }
+    }
+    // 只有第一个把标志从 false 置为 true 的生产者负责安排写出，其余帧搭便车
+    if(!flush_scheduled_.exchange(true, std::memory_order_acq_rel)) {
+        return kPushedNeedFlush;
+    }
+    return kPushed;
+}
+
+void OutputBuffer::PushOverflow(const Frame &frame)
+{
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    overflow_.push_back(frame);
+    overflowing_.store(true, std::memory_order_release);
+}
+
+void OutputBuffer::Collect()
+{
+    Frame frame;
+    while(pending_.TryPop(frame)) {
+        out_.push_back(std::move(frame));
+    }
+    if(!overflowing_.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    while(pending_.TryPop(frame)) {
+        out_.push_back(std::move(frame));
+    }
+    // 环形队列里还有生产者没写完的槽时先不取溢出帧，否则会越过更早入队的帧；
+    // 那个生产者写完后会发现写出标志已被清除，重新安排一次写出
+    if(!pending_.Empty()) return;
+    for(auto &overflow : overflow_) {
+        out_.push_back(std::move(overflow));
+    }
+    overflow_.clear();
+    overflowing_.store(false, std::memory_order_release);
+}
+
+int OutputBuffer::FillIov(struct iovec *iov, int maxIov)
+{
+    Collect();
+    int iovcnt = 0;
+    for(auto it = out_.begin(); it != out_.end() && iovcnt < maxIov; ++it, ++iovcnt) {
+        size_t skip = iovcnt == 0 ? out_offset_ : 0;
+        iov[iovcnt].iov_base = const_cast<char*>(it->data()) + skip;
+        iov[iovcnt].iov_len = it->size() - skip;
+    }
+    return iovcnt;
+}
+
+void OutputBuffer::Consume(size_t n)
+{
+    queued_bytes_.fetch_sub(n, std::memory_order_relaxed);
+    while(n > 0) {
+        size_t left = out_.front().size() - out_offset_;
+        if(n >= left) {
+            n -= left;
+            out_.pop_front();
+            out_offset_ = 0;
+        } else {
+            out_offset_ += n;
+            n = 0;
+        }
+    }
+}
+
+int OutputBuffer::Gather(struct iovec *iov, int maxIov)
+{
+    // 与 WriteTo 相同，先清除标志再取帧
+    flush_scheduled_.exchange(false, std::memory_order_acq_rel);
+    return FillIov(iov, maxIov);
+}
+
+OutputBuffer::WriteResult OutputBuffer::WriteTo(int fd)
+{
+    // 先清除标志再取帧：之后到达的帧会重新安排写出，不会滞留。
+    // 清除与生产者的置位都用读改写操作，二者全序，保证不会漏掉已入队的帧
+    flush_scheduled_.exchange(false, std::memory_order_acq_rel);
+    while(true) {
+        struct iovec iov[kMaxIov];
+        int iovcnt = FillIov(iov, kMaxIov);
+        if(iovcnt == 0) return kDrained;
+        // 用 sendmsg 代替 writev 以便带上 MSG_NOSIGNAL，对端关闭时不触发 SIGPIPE
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        Metrics::Increment(Metrics::kNetworkSyscalls);
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return kWouldBlock;
+            return kError;
+        }
+        Consume(static_cast<size_t>(n));
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <sys/uio.h>
+#include "mpscring.h"
+#include "frame.h"
+
+// 连接的非阻塞输出缓冲：任意线程可通过无锁环形队列追加消息帧，不会互相阻塞；
+// 帧是共享的不可变缓冲，入队不复制数据；由连接所属的循环线程用 writev 一次写出尽可能多的帧。
+// 环形队列满时（例如一批很小的广播帧）改走加锁的溢出队列，直到循环线程把两者都取空；
+// 只有排队字节数超过高水位才拒绝新帧
+class OutputBuffer {
+public:
+    enum PushResult {
+        kPushed,         // 已入队，写出任务已在排队中
+        kPushedNeedFlush,// 已入队，调用方需要安排一次写出
+        kRejected        // 超过高水位被拒绝
+    };
+    enum WriteResult {
+        kDrained,        // 所有帧都已写出
+        kWouldBlock,     // 内核发送缓冲区已满，等待 EPOLLOUT
+        kError           // 写出出错，连接应当关闭
+    };
+
+    OutputBuffer(size_t highWaterMark, size_t queueCapacity);
+
+    // 任意线程调用；ownerThread 表示调用方就是连接所属的循环线程，
+    // 此时帧直接追加到写出队列，不占用环形队列的槽位
+    PushResult Push(const Frame &frame, bool ownerThread = false);
+    size_t QueuedBytes() const { return queued_bytes_.load(std::memory_order_relaxed); }
+
+    // 仅循环线程调用：合并待发送帧并写到 fd
+    WriteResult WriteTo(int fd);
+
+    // 异步发送（io_uring）：仅循环线程调用。Gather 收拢待发送帧，从未写出的位置起填入至多 maxIov 段，
+    // 返回段数（0 表示已写空）；iov 指向的帧在 Consume 之前保持有效。发送完成后用 Consume 确认写出的字节数
+    int Gather(struct iovec *iov, int maxIov);
+    void Consume(size_t n);
+
+private:
+    // 仅循环线程调用：把环形队列与溢出队列中的帧按入队顺序移到 out_
+    void Collect();
+    void PushOverflow(const Frame &frame);
+    int FillIov(struct iovec *iov, int maxIov);
+
+    size_t high_water_mark_;
+    std::atomic<size_t> queued_bytes_;
+    std::atomic<bool> flush_scheduled_;
+
+    MpscRing<Frame> pending_; // 生产者追加的新帧
+    // 环形队列满时的后备队列；overflowing_ 为真期间所有生产者都排到这里，保证同一生产者的帧不乱序
+    std::mutex overflow_mutex_;
+    std::deque<Frame> overflow_;
+    std::atomic<bool> overflowing_;
+
+    std::deque<Frame> out_; // 正在写出的帧，仅循环线程访问
+    size_t out_offset_; // 队首帧已写出的字节数
+};
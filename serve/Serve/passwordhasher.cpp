@@ -0,0 +1,94 @@
+#include "passwordhasher.h"
+#include <cstdlib>
+#include <cstring>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+namespace {
+
+const char kPrefix[] = "pbkdf2-sha256$";
+const size_t kPrefixLen = sizeof(kPrefix) - 1;
+
+std::string ToHex(const unsigned char *data, size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out(size * 2, '0');
+    for(size_t i = 0; i < size; ++i) {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 0x0f];
+    }
+    return out;
+}
+
+int HexValue(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+bool FromHex(const std::string &text, size_t pos, size_t size, unsigned char *out)
+{
+    if(pos + size * 2 > text.size()) return false;
+    for(size_t i = 0; i < size; ++i) {
+        int hi = HexValue(text[pos + 2 * i]);
+        int lo = HexValue(text[pos + 2 * i + 1]);
+        if(hi < 0 || lo < 0) return false;
+        out[i] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+    return true;
+}
+
+bool Derive(const std::string &password, const unsigned char *salt, int iterations, unsigned char *key)
+{
+    return PKCS5_PBKDF2_HMAC(password.data(), static_cast<int>(password.size()), salt,
+                             static_cast<int>(PasswordHasher::kSaltBytes), iterations, EVP_sha256(),
+                             static_cast<int>(PasswordHasher::kKeyBytes), key) == 1;
+}
+
+} // namespace
+
+const int PasswordHasher::kDefaultIterations;
+const size_t PasswordHasher::kSaltBytes;
+const size_t PasswordHasher::kKeyBytes;
+
+bool PasswordHasher::IsHashed(const std::string &stored)
+{
+    return stored.compare(0, kPrefixLen, kPrefix) == 0;
+}
+
+std::string PasswordHasher::Hash(const std::string &password, int iterations)
+{
+    unsigned char salt[kSaltBytes];
+    unsigned char key[kKeyBytes];
+    if(RAND_bytes(salt, sizeof(salt)) != 1) return std::string();
+    if(!Derive(password, salt, iterations, key)) return std::string();
+    return kPrefix + std::to_string(iterations) + "$" + ToHex(salt, sizeof(salt)) + "$" + ToHex(key, sizeof(key));
+}
+
+bool PasswordHasher::Verify(const std::string &password, const std::string &stored, int iterations, bool &needsRehash)
+{
+    if(!IsHashed(stored)) {
+        // 旧版明文存储
+        needsRehash = true;
+        return stored.size() == password.size() &&
+               CRYPTO_memcmp(stored.data(), password.data(), password.size()) == 0;
+    }
+    const char *begin = stored.c_str() + kPrefixLen;
+    char *end = nullptr;
+    long storedIterations = strtol(begin, &end, 10);
+    if(end == begin || *end != '$' || storedIterations <= 0 || storedIterations > 100000000) return false;
+    size_t saltPos = static_cast<size_t>(end - stored.c_str()) + 1;
+    size_t keyPos = saltPos + kSaltBytes * 2 + 1;
+    unsigned char salt[kSaltBytes];
+    unsigned char expected[kKeyBytes];
+    if(!FromHex(stored, saltPos, kSaltBytes, salt) || stored.size() != keyPos + kKeyBytes * 2 ||
+       stored[keyPos - 1] != '$' || !FromHex(stored, keyPos, kKeyBytes, expected)) {
+        return false;
+    }
+    unsigned char key[kKeyBytes];
+    if(!Derive(password, salt, static_cast<int>(storedIterations), key)) return false;
+    needsRehash = storedIterations != iterations;
+    return CRYPTO_memcmp(key, expected, kKeyBytes) == 0;
+}
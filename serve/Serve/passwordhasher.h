@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+// 加盐的 PBKDF2-HMAC-SHA256 口令哈希（OpenSSL libcrypto）。存储格式为
+//   pbkdf2-sha256$迭代次数$盐(hex)$派生密钥(hex)
+// 合法密码只含字母和数字，不会以该前缀开头，其余存储值按旧版明文处理，校验通过后由调用方重新哈希。
+// 一次计算耗时与迭代次数成正比（默认数毫秒），只能在工作线程池上调用，不能在 I/O 线程上调用。
+class PasswordHasher {
+public:
+    static const int kDefaultIterations = 20000;
+    static const size_t kSaltBytes = 16;
+    static const size_t kKeyBytes = 32;
+
+    // 用随机盐派生存储值；随机数或派生失败时返回空串
+    static std::string Hash(const std::string &password, int iterations);
+    // 校验密码（常数时间比较）；needsRehash 表示存储值是明文或迭代次数与 iterations 不同，应以新参数重新哈希
+    static bool Verify(const std::string &password, const std::string &stored, int iterations, bool &needsRehash);
+    static bool IsHashed(const std::string &stored);
+};
@@ -0,0 +1,56 @@
+#include "presenceaggregator.h"
+#include "metrics.h"
+
+PresenceAggregator::PresenceAggregator()
+    : raw_changes_(0),
+      flush_armed_(false)
+{
+}
+
+bool PresenceAggregator::Record(const std::string &username, bool online)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++raw_changes_;
+    auto it = pending_.find(username);
+    if(it == pending_.end()) {
+        pending_.emplace(username, online);
+    } else if(it->second != online) {
+        // 窗口内的一上一下互相抵消
+        pending_.erase(it);
+        Metrics::Increment(Metrics::kPresenceCancelled, 2);
+    }
+    if(flush_armed_) return false;
+    flush_armed_ = true;
+    return true;
+}
+
+PresenceAggregator::Delta PresenceAggregator::TakeDelta()
+{
+    Delta delta;
+    std::unordered_map<std::string, bool> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending.swap(pending_);
+        delta.rawChanges = raw_changes_;
+        raw_changes_ = 0;
+        flush_armed_ = false;
+    }
+    for(auto &pair : pending) {
+        if(pair.second) delta.online.push_back(pair.first);
+        else delta.offline.push_back(pair.first);
+    }
+    if(!delta.empty()) Metrics::Increment(Metrics::kPresenceDeltas);
+    return delta;
+}
+
+std::string PresenceAggregator::Encode(const Delta &delta, uint64_t version)
+{
+    std::string msg = "presence_delta:" + std::to_string(version) + ":";
+    for(auto &name : delta.online) {
+        msg += "+" + name + "|";
+    }
+    for(auto &name : delta.offline) {
+        msg += "-" + name + "|";
+    }
+    return msg;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+
+// 上线/下线合并器：在一个时间窗口内累积在线状态变化，窗口结束时合并成一个增量帧广播。
+// 同一用户在窗口内先上线后下线（或反之）会互相抵消，不产生任何通知。
+// 发出的增量帧数、被抵消的变化数与节省的帧数记在 Metrics 中，由 /metrics 导出。
+class PresenceAggregator {
+public:
+    struct Delta {
+        std::vector<std::string> online;
+        std::vector<std::string> offline;
+        size_t rawChanges = 0; // 窗口内原始的状态变化次数（含被抵消的）
+        bool empty() const { return online.empty() && offline.empty(); }
+    };
+
+    PresenceAggregator();
+
+    // 记录一次状态变化；返回 true 表示这是窗口内的第一条变化，调用方需要安排一次刷新
+    bool Record(const std::string &username, bool online);
+    // 取出并清空当前窗口的净变化
+    Delta TakeDelta();
+
+    // 编码为 "presence_delta:版本号:+上线用户|-下线用户|"
+    static std::string Encode(const Delta &delta, uint64_t version);
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, bool> pending_; // 用户名 -> 窗口结束时的净状态
+    size_t raw_changes_;
+    bool flush_armed_;
+};
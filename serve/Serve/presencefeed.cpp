@@ -0,0 +1,53 @@
+#include "presencefeed.h"
+#include <ctime>
+
+PresenceFeed::PresenceFeed(uint8_t frameType, size_t historyLimit)
+    : frame_type_(frameType),
+      history_limit_(historyLimit > 0 ? historyLimit : 1),
+      // 版本号以启动时间为基数，服务重启后旧客户端带来的版本号不会落在新的历史区间内
+      version_(static_cast<uint64_t>(std::time(nullptr)) << 20)
+{
+}
+
+Frame PresenceFeed::Publish(const PresenceAggregator::Delta &delta)
+{
+    ++version_;
+    for(auto &name : delta.online) {
+        members_.insert(name);
+    }
+    for(auto &name : delta.offline) {
+        members_.erase(name);
+    }
+    Frame frame = Frame::Encode(frame_type_, PresenceAggregator::Encode(delta, version_));
+    history_.push_back(frame);
+    if(history_.size() > history_limit_) history_.pop_front();
+    return frame;
+}
+
+void PresenceFeed::Restore(uint64_t version, const std::vector<std::string> &members)
+{
+    version_ = version;
+    history_.clear();
+    members_.clear();
+    members_.insert(members.begin(), members.end());
+}
+
+bool PresenceFeed::CatchUp(uint64_t sinceVersion, std::vector<Frame> &out) const
+{
+    if(sinceVersion > version_) return false;
+    uint64_t missing = version_ - sinceVersion;
+    if(missing > history_.size()) return false;
+    for(size_t i = history_.size() - missing; i < history_.size(); ++i) {
+        out.push_back(history_[i]);
+    }
+    return true;
+}
+
+Frame PresenceFeed::Snapshot() const
+{
+    std::string msg = "presence_snapshot:" + std::to_string(version_) + ":";
+    for(auto &name : members_) {
+        msg += name + "|";
+    }
+    return Frame::Encode(frame_type_, msg);
+}
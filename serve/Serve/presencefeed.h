@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_set>
+#include "frame.h"
+#include "presenceaggregator.h"
+
+// 带版本号的在线状态订阅源：每发布一个合并后的增量，版本号加一，并保留最近若干个增量帧。
+// 客户端带着自己最后看到的版本号订阅，能用历史补齐时只补发缺失的增量，
+// 首次订阅或版本断档时才发送一次全量快照。
+// 非线程安全，由主循环线程独占使用。
+class PresenceFeed {
+public:
+    // frameType 为增量/快照帧使用的消息类型，historyLimit 为保留的增量个数
+    PresenceFeed(uint8_t frameType, size_t historyLimit);
+
+    // 发布一个增量并更新成员集合，返回编码好的增量帧
+    Frame Publish(const PresenceAggregator::Delta &delta);
+
+    // 从 sinceVersion 追赶到当前版本：历史足以补齐时把缺失的增量帧追加到 out 并返回 true，
+    // 否则返回 false，调用方应改发快照
+    bool CatchUp(uint64_t sinceVersion, std::vector<Frame> &out) const;
+    // 编码为 "presence_snapshot:版本号:用户1|用户2|"
+    Frame Snapshot() const;
+
+    // 热重启：沿用旧进程的版本号与成员集合，历史为空，落后的订阅者改发快照
+    void Restore(uint64_t version, const std::vector<std::string> &members);
+
+    uint64_t Version() const { return version_; }
+    size_t Members() const { return members_.size(); }
+    const std::unordered_set<std::string> &MemberSet() const { return members_; }
+
+private:
+    uint8_t frame_type_;
+    size_t history_limit_;
+    uint64_t version_;
+    std::deque<Frame> history_; // 版本号 version_ - history_.size() + 1 .. version_ 的增量帧
+    std::unordered_set<std::string> members_; // 当前版本对应的在线用户
+};
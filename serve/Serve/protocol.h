@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+// 客户端与服务端共用的消息类型与指令类型（与 socketlearn/classlist.h 保持一致）
+enum class MessageType {
+    login = 0,
+    register_user = 1,
+    forward_msg = 2,
+    instruction = 3,
+    return_msg = 4,
+    // 5 被客户端用作本地错误通知，服务端不发送
+    history_msg = 6,
+    room_msg = 7
+};
+
+enum class InstructionType {
+    delete_self = 0,
+    change_password = 1,
+    get_all_user = 2,
+    get_all_online_users = 3,
+    heartbeat_ACK = 4,
+    logout = 5,
+    subscribe_presence = 6,
+    fetch_history = 7,
+    create_room = 8,
+    join_room = 9,
+    leave_room = 10
+};
+
+// 帧头：1 字节类型 + 4 字节网络字节序长度
+static const size_t kHeaderSize = 5;
@@ -0,0 +1,57 @@
+#include "ratelimiter.h"
+#include <algorithm>
+
+RateLimiter::RateLimiter(double rate, double burst, size_t shardCount)
+    : rate_(rate > 0 ? rate : 0),
+      burst_(std::max(burst, 1.0)),
+      shards_(new Shard[shardCount > 0 ? shardCount : 1]),
+      shard_count_(shardCount > 0 ? shardCount : 1),
+      size_(0)
+{
+}
+
+RateLimiter::Shard &RateLimiter::ShardFor(const std::string &key)
+{
+    return shards_[std::hash<std::string>()(key) % shard_count_];
+}
+
+double RateLimiter::Refill(const Bucket &bucket, int64_t nowMs) const
+{
+    int64_t elapsedMs = std::max<int64_t>(nowMs - bucket.lastMs, 0);
+    return std::min(burst_, bucket.tokens + rate_ * elapsedMs / 1000.0);
+}
+
+bool RateLimiter::TryAcquire(const std::string &key, double cost, int64_t nowMs)
+{
+    if(!Enabled()) return true;
+    Shard &shard = ShardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto result = shard.buckets.emplace(key, Bucket{burst_, nowMs});
+    Bucket &bucket = result.first->second;
+    if(result.second) {
+        size_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        bucket.tokens = Refill(bucket, nowMs);
+        bucket.lastMs = nowMs;
+    }
+    if(bucket.tokens < cost) return false;
+    bucket.tokens -= cost;
+    return true;
+}
+
+size_t RateLimiter::Sweep(int64_t nowMs)
+{
+    for(size_t i = 0; i < shard_count_; ++i) {
+        Shard &shard = shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for(auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+            if(Refill(it->second, nowMs) >= burst_) {
+                it = shard.buckets.erase(it);
+                size_.fetch_sub(1, std::memory_order_relaxed);
+            } else {
+                ++it;
+            }
+        }
+    }
+    return Size();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+// 令牌桶限流表：每个键（用户名或来源地址）一个桶，每秒补充 rate 个令牌，最多积攒 burst 个。
+// 补充在取令牌时按流逝的时间一次算出，不需要定时器；一次请求只做一次哈希查找和几次算术，
+// 按键哈希分条带加锁，与在线用户表相同。补满的桶与不存在的桶等价，由 Sweep 定期回收。
+class RateLimiter {
+public:
+    // rate 为 0 表示不限流
+    RateLimiter(double rate, double burst, size_t shardCount = 64);
+
+    bool Enabled() const { return rate_ > 0; }
+    // 从 key 的桶中取 cost 个令牌；不足时返回 false，不扣减
+    bool TryAcquire(const std::string &key, double cost, int64_t nowMs);
+    // 删除已经补满的桶，返回剩余的桶数
+    size_t Sweep(int64_t nowMs);
+    size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+private:
+    struct Bucket {
+        double tokens;
+        int64_t lastMs; // 上次补充的时间（单调时钟毫秒）
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Bucket> buckets;
+        char pad[64]; // 相邻条带的锁放在不同缓存行
+    };
+
+    Shard &ShardFor(const std::string &key);
+    double Refill(const Bucket &bucket, int64_t nowMs) const;
+
+    double rate_;
+    double burst_;
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_count_;
+    std::atomic<size_t> size_;
+};
@@ -0,0 +1,135 @@
+#include "roomregistry.h"
+#include <algorithm>
+
+RoomRegistry::RoomRegistry(size_t maxMembers)
+    : max_members_(maxMembers)
+{
+}
+
+uint32_t RoomRegistry::InternLocked(const std::string &username)
+{
+    auto it = ids_.find(username);
+    if(it != ids_.end()) return it->second;
+    uint32_t id = static_cast<uint32_t>(connections_.size());
+    ids_.emplace(username, id);
+    connections_.push_back(ConnectionPtr());
+    return id;
+}
+
+bool RoomRegistry::FindIdLocked(const std::string &username, uint32_t &id) const
+{
+    auto it = ids_.find(username);
+    if(it == ids_.end()) return false;
+    id = it->second;
+    return true;
+}
+
+RoomRegistry::Result RoomRegistry::Create(const std::string &room, const std::string &username)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(rooms_.count(room)) return kExists;
+    uint32_t id = InternLocked(username);
+    rooms_[room].push_back(id);
+    return kOk;
+}
+
+RoomRegistry::Result RoomRegistry::Join(const std::string &room, const std::string &username)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rooms_.find(room);
+    if(it == rooms_.end()) return kNoRoom;
+    std::vector<uint32_t> &ids = it->second;
+    if(max_members_ > 0 && ids.size() >= max_members_) return kFull;
+    uint32_t id = InternLocked(username);
+    auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if(pos != ids.end() && *pos == id) return kAlreadyMember;
+    ids.insert(pos, id);
+    return kOk;
+}
+
+RoomRegistry::Result RoomRegistry::Leave(const std::string &room, const std::string &username)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rooms_.find(room);
+    if(it == rooms_.end()) return kNoRoom;
+    uint32_t id;
+    if(!FindIdLocked(username, id)) return kNotMember;
+    std::vector<uint32_t> &ids = it->second;
+    auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if(pos == ids.end() || *pos != id) return kNotMember;
+    ids.erase(pos);
+    if(ids.empty()) rooms_.erase(it);
+    return kOk;
+}
+
+size_t RoomRegistry::RemoveUser(const std::string &username)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto idIt = ids_.find(username);
+    if(idIt == ids_.end()) return 0;
+    uint32_t id = idIt->second;
+    size_t removed = 0;
+    for(auto it = rooms_.begin(); it != rooms_.end();) {
+        std::vector<uint32_t> &ids = it->second;
+        auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+        if(pos != ids.end() && *pos == id) {
+            ids.erase(pos);
+            ++removed;
+        }
+        if(ids.empty()) {
+            it = rooms_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // 编号不再复用，旧连接随之解绑；新账号登录时重新分配编号
+    connections_[id].reset();
+    ids_.erase(idIt);
+    return removed;
+}
+
+RoomRegistry::Result RoomRegistry::Collect(const std::string &room, const std::string &sender,
+                                           std::vector<ConnectionPtr> &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rooms_.find(room);
+    if(it == rooms_.end()) return kNoRoom;
+    uint32_t senderId;
+    const std::vector<uint32_t> &ids = it->second;
+    if(!FindIdLocked(sender, senderId) || !std::binary_search(ids.begin(), ids.end(), senderId)) return kNotMember;
+    out.reserve(out.size() + ids.size());
+    for(uint32_t id : ids) {
+        if(id != senderId && connections_[id]) out.push_back(connections_[id]);
+    }
+    return kOk;
+}
+
+void RoomRegistry::Attach(const std::string &username, const ConnectionPtr &conn)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_[InternLocked(username)] = conn;
+}
+
+void RoomRegistry::Detach(const std::string &username, const ConnectionPtr &conn)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t id;
+    if(FindIdLocked(username, id) && connections_[id] == conn) connections_[id].reset();
+}
+
+size_t RoomRegistry::RoomCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rooms_.size();
+}
+
+void RoomRegistry::Snapshot(std::vector<std::pair<std::string, std::vector<std::string>>> &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<const std::string*> names(connections_.size());
+    for(auto &pair : ids_) names[pair.second] = &pair.first;
+    for(auto &room : rooms_) {
+        out.emplace_back(room.first, std::vector<std::string>());
+        for(uint32_t id : room.second) out.back().second.push_back(*names[id]);
+    }
+}
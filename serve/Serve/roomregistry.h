@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+
+struct ClientConnection;
+
+// 聊天室表：每个用户第一次参与聊天室时分配一个紧凑的成员编号，
+// 聊天室的成员表是按编号排序的 uint32_t 数组（1k 成员只占 4KB），加入/退出二分插入删除。
+// 成员编号到当前连接的映射由登录/断开时维护，扇出时按数组顺序取连接，不再逐个按用户名查在线表。
+// 成员关系只保存在内存中，与连接无关：成员断开后仍在聊天室内，离线期间的聊天室消息不补发。
+class RoomRegistry {
+public:
+    typedef std::shared_ptr<ClientConnection> ConnectionPtr;
+    enum Result {
+        kOk,
+        kExists,        // 创建时聊天室已存在
+        kNoRoom,        // 聊天室不存在
+        kAlreadyMember,
+        kNotMember,
+        kFull           // 成员数已达上限
+    };
+
+    explicit RoomRegistry(size_t maxMembers = 4096);
+
+    // 创建聊天室，创建者自动成为成员
+    Result Create(const std::string &room, const std::string &username);
+    Result Join(const std::string &room, const std::string &username);
+    // 最后一个成员退出时聊天室随之删除
+    Result Leave(const std::string &room, const std::string &username);
+
+    // 注销账号时把用户移出所有聊天室（变空的聊天室随之删除）并回收其成员编号，
+    // 之后注册同名账号不会继承这些成员关系；返回移出的聊天室数
+    size_t RemoveUser(const std::string &username);
+
+    // 取发送者所在聊天室中除自己以外的在线成员连接，追加到 out；发送者不是成员时返回 kNotMember
+    Result Collect(const std::string &room, const std::string &sender, std::vector<ConnectionPtr> &out) const;
+
+    // 登录成功后绑定连接，断开时解绑（仅当绑定的仍是 conn）
+    void Attach(const std::string &username, const ConnectionPtr &conn);
+    void Detach(const std::string &username, const ConnectionPtr &conn);
+
+    size_t RoomCount() const;
+    // 导出所有聊天室及其成员名（热重启交接时使用）
+    void Snapshot(std::vector<std::pair<std::string, std::vector<std::string>>> &out) const;
+
+private:
+    uint32_t InternLocked(const std::string &username);
+    bool FindIdLocked(const std::string &username, uint32_t &id) const;
+
+    size_t max_members_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::vector<uint32_t>> rooms_; // 聊天室 -> 有序成员编号
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::vector<ConnectionPtr> connections_; // 按成员编号索引，不在线时为空
+};
@@ -1,91 +1,353 @@
 #include "serve.h"
-#include <iostream>
+#include "credentialvalidator.h"
+#include "wireschema.h"
+#include "metrics.h"
+#include "logger.h"
 #include <cstring>
+#include <cerrno>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <vector>
-#include <sqlite3.h>
 #include <unordered_map>
 #include <thread>
 #include <mutex>
-#include <regex>
 #include <netinet/tcp.h>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/uio.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <signal.h>
 
-// 全局在线客户端列表：存储用户名及其对应的连接描述符（TCP socket）
-static std::unordered_map<std::string, std::shared_ptr<ClientConnection>> onlineClients;
-// 保护在线列表的互斥锁
-static std::mutex clientsMutex;
+// 单次 readv 至少预留的缓冲空间
+static const size_t kReadChunk = 4096;
 
-static void FlushSocketBuffer(int sock_fd) {
-    char flushBuffer[1024];
-    int flags = fcntl(sock_fd, F_GETFL, 0);
-    // 将 socket 设置为非阻塞模式
-    fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
-    while (true) {
-        ssize_t n = recv(sock_fd, flushBuffer, sizeof(flushBuffer), 0);
-        if (n <= 0) break;
+// 解析两段式载荷：旧客户端为 "第一段|第二段"（按第一个 '|' 切分），协商了二进制编码的客户端按字段号解码
+static bool ParsePair(const ClientConnection &conn, const std::string &payload, uint32_t firstField, uint32_t secondField,
+                      std::string &first, std::string &second) {
+    if(conn.wireVersion >= 1) {
+        WireView firstView;
+        WireView secondView;
+        if(!DecodeWirePair(payload, firstField, secondField, firstView, secondView)) return false;
+        first = firstView.str();
+        second = secondView.str();
+        return true;
     }
-    // 恢复原有非非阻塞设置
-    fcntl(sock_fd, F_SETFL, flags);
-} 
+    size_t pos = payload.find('|');
+    if(pos == std::string::npos) return false;
+    first = payload.substr(0, pos);
+    second = payload.substr(pos + 1);
+    return true;
+}
+
+// 离线消息补发时，等待上一批写出的轮询间隔（毫秒）
+static const int kMailboxPollMs = 10;
+// 交接前检查各连接是否已排空的轮询间隔（毫秒）
+static const int kDrainPollMs = 10;
+// 回收已补满的限流令牌桶的间隔（毫秒）
+static const int kRateLimitSweepMs = 10000;
+// 查询整张用户表或翻阅聊天记录的请求占用的令牌数（一般请求为 1）
+static const double kStoreScanCost = 10;
+// 事件循环时间轮的 tick（毫秒）
+static const int kTimerTickMs = 100;
+// io_uring 后端一条发送链最多合并的帧数（每 EventLoop::kSendChunkIov 段一个 sendmsg）
+static const int kUringSendIov = 256;
+
+// 按接收方协商的编码组装转发载荷
+static Frame EncodeForward(const ClientConnection &target, const std::string &sender, const std::string &body) {
+    std::string forwardMsg;
+    if(target.wireVersion >= 1) {
+        WireWriter writer;
+        writer.PutString(kForwardPeer, sender);
+        writer.PutString(kForwardBody, body);
+        forwardMsg = writer.Take();
+    } else {
+        forwardMsg = sender + "|" + body;
+    }
+    return Frame::Encode(static_cast<uint8_t>(MessageType::forward_msg), forwardMsg);
+}
+
+// 一个请求占用的令牌数，0 表示不限流：心跳确认与退出必须送达，否则限流会变成断线
+static double RequestCost(MessageType msgType, uint32_t instruction) {
+    if(msgType != MessageType::instruction) return 1;
+    switch(static_cast<InstructionType>(instruction)) {
+        case InstructionType::heartbeat_ACK:
+        case InstructionType::logout:
+            return 0;
+        case InstructionType::get_all_user:
+        case InstructionType::fetch_history:
+            return kStoreScanCost;
+        default:
+            return 1;
+    }
+}
 
 Serve::Serve()
+    : Serve(ServeOptions())
+{
+}
+
+Serve::Serve(const ServeOptions &options)
+    : online_(options.onlineShards),
+      rooms_(options.maxRoomMembers),
+      presence_feed_(static_cast<uint8_t>(MessageType::return_msg), options.presenceHistory),
+      user_limits_(options.userRequestRate, options.userRequestBurst),
+      address_limits_(options.addressRequestRate, options.addressRequestBurst),
+      handshake_limits_(options.handshakeRequestRate, options.handshakeRequestBurst)
 {
-    listen_port_ = 4567;
-    db_ = nullptr;
+    options_ = options;
+    listen_port_ = options.port;
+    listen_fd_ = -1;
+    next_reactor_ = 0;
+    handoff_fd_ = -1;
+    signal_fd_ = -1;
+    metrics_fd_ = -1;
+    draining_ = false;
+    draining_reactors_ = 0;
+    adopting_ = 0;
+    // 上线/下线由在线用户表统一通知
+    online_.AddPresenceListener([this](const std::string &username, bool online) {
+        OnPresenceChange(username, online);
+    });
 }
 
 Serve::~Serve()
 {
-    if(db_) {
-        sqlite3_close(db_);
-        db_ = nullptr;
-    }
+    password_pool_.Stop();
+    history_.Close();
+    mailbox_.Close();
+    store_.Close();
 }
 
 void Serve::start()
 {
-    // 初始化并连接 SQLite 数据库（数据库文件名：ChatServe.db，如果不存在则自动创建）
-    int rc = sqlite3_open("ChatServe.db", &db_);
-    if(rc != SQLITE_OK)
-    {
-        std::cerr << "无法打开数据库: " << sqlite3_errmsg(db_) << std::endl;
-        sqlite3_close(db_);
-        db_ = nullptr;
+    // 热重启信号由主循环通过 signalfd 处理，须在创建任何线程（包括存储层线程）之前屏蔽
+    sigset_t restartSignals;
+    sigemptyset(&restartSignals);
+    sigaddset(&restartSignals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &restartSignals, nullptr);
+
+    // 接管旧进程：旧进程排空并关闭存储层之后才交出连接，本进程随后才能打开同一批存储文件
+    std::vector<int> inheritedListenFds;
+    std::vector<AdoptedConnection> adopted;
+    if(options_.takeover && !TakeOver(inheritedListenFds, adopted)) {
+        LOG_WARN << "接管旧进程失败，按全新启动处理";
+    }
+
+    // 初始化并连接 SQLite 数据库（数据库文件名：ChatServe.db，如果不存在则自动创建），建表并启动数据库线程
+    if(!store_.Open("ChatServe.db", options_.maxUsers, options_.storeBatchWindowMs)) {
         return;
     }
-    std::cout << "成功打开数据库." << std::endl;
-
-    // 创建 users 表（若不存在则创建），注意字段定义按 SQLite 语法写
-    const char* sql_create = "CREATE TABLE IF NOT EXISTS users ("
-                             "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                             "username TEXT NOT NULL UNIQUE, "
-                             "password TEXT NOT NULL, "
-                             "create_at DATETIME DEFAULT CURRENT_TIMESTAMP);";
-    char* errMsg = nullptr;
-    rc = sqlite3_exec(db_, sql_create, nullptr, nullptr, &errMsg);
-    if(rc != SQLITE_OK)
-    {
-        std::cerr << "创建表出错: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
-        sqlite3_close(db_);
-        db_ = nullptr;
+    LOG_INFO << "成功打开数据库.";
+
+    // 整表加载账号到内存，登录校验不再访问数据库
+    credentials_.Clear();
+    int64_t loadStartMs = EventLoop::NowMs();
+    size_t plaintext = 0;
+    UserStore::Result loaded = store_.ScanCredentials([this, &plaintext](const std::string &username, const std::string &stored) {
+        credentials_.Put(username, stored);
+        if(!PasswordHasher::IsHashed(stored)) ++plaintext;
+    });
+    if(loaded != UserStore::kOk) {
+        LOG_ERROR << "加载账号失败";
+        store_.Close();
+        return;
+    }
+    LOG_INFO << "加载 " << credentials_.Size() << " 个账号，耗时 "
+             << EventLoop::NowMs() - loadStartMs << " ms";
+    if(plaintext > 0) {
+        LOG_INFO << plaintext << " 个账号仍为明文口令，将在下次登录时迁移为哈希";
+    }
+
+    // 口令哈希线程池：注册、登录、改密的哈希计算排队在这里，不阻塞 I/O 线程
+    int passwordThreads = options_.passwordThreads;
+    if(passwordThreads <= 0) passwordThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    password_pool_.Start(passwordThreads, options_.passwordQueueLimit);
+
+    // 离线消息信箱与账号库放在同一目录，写入同样按合并窗口组提交
+    if(!mailbox_.Open("ChatServe.mailbox", options_.mailboxLimit, options_.storeBatchWindowMs)) {
+        LOG_ERROR << "打开离线信箱失败";
+        store_.Close();
+        return;
+    }
+    if(!history_.Open("ChatServe.history")) {
+        LOG_ERROR << "打开聊天记录目录失败";
+        mailbox_.Close();
+        store_.Close();
+        return;
+    }
+
+    EventLoop::Backend backend = options_.ioBackend;
+    if(backend == EventLoop::kUring && !EventLoop::UringSupported()) {
+        LOG_WARN << "内核不支持多发 accept/recv 或 provided buffer ring，网络 I/O 改用 epoll";
+        backend = EventLoop::kEpoll;
+    }
+
+    // 创建 I/O 反应器，每个反应器一个事件循环线程，负责其名下连接的握手、读写与心跳
+    int ioThreads = options_.ioThreads;
+    if(ioThreads <= 0) {
+        ioThreads = static_cast<int>(std::thread::hardware_concurrency());
+        if(ioThreads <= 0) ioThreads = 1;
+    }
+    for(int i = 0; i < ioThreads; ++i) {
+        std::unique_ptr<Reactor> reactor(new Reactor);
+        reactor->loop.reset(new EventLoop(kTimerTickMs, backend));
+        reactors_.push_back(std::move(reactor));
+    }
+    accept_loop_.reset(new EventLoop(kTimerTickMs, backend));
+
+    bool listenOk = true;
+    if(options_.reusePort) {
+        // 每个反应器独占一个监听套接字，由内核按四元组哈希分摊新连接，accept 在各核上并行
+        for(auto &reactor : reactors_) {
+            Reactor *r = reactor.get();
+            r->listenFd = TakeListenSocket(inheritedListenFds);
+            if(r->listenFd < 0) {
+                listenOk = false;
+                break;
+            }
+            if(r->loop->UsesUring()) {
+                r->loop->AcceptMultishot(r->listenFd, [this, r](int fd) { DispatchConnection(fd, r); });
+            } else {
+                r->loop->AddFd(r->listenFd, EPOLLIN, [this, r](uint32_t) { HandleAccept(r->listenFd, r); });
+            }
+        }
+    } else {
+        // 单监听模式：主线程运行 accept 循环，将新连接轮流分配给各个反应器
+        listen_fd_ = TakeListenSocket(inheritedListenFds);
+        listenOk = listen_fd_ >= 0;
+        if(listenOk) {
+            if(accept_loop_->UsesUring()) {
+                accept_loop_->AcceptMultishot(listen_fd_, [this](int fd) { DispatchConnection(fd, nullptr); });
+            } else {
+                accept_loop_->AddFd(listen_fd_, EPOLLIN, [this](uint32_t) { HandleAccept(listen_fd_, nullptr); });
+            }
+        }
+    }
+    // 新旧进程的监听方式不一致时，多出的监听套接字直接关闭（交接前后应使用相同的 --reuseport 设置）
+    for(int fd : inheritedListenFds) close(fd);
+    if(!listenOk) {
+        for(auto &reactor : reactors_) {
+            if(reactor->listenFd >= 0) close(reactor->listenFd);
+        }
+        for(auto &state : adopted) close(state.fd);
+        reactors_.clear();
+        accept_loop_.reset();
+        password_pool_.Stop();
+        history_.Close();
+        mailbox_.Close();
+        store_.Close();
         return;
     }
+    for(auto &reactor : reactors_) {
+        EventLoop *loop = reactor->loop.get();
+        reactor->thread = std::thread([loop]() { loop->Loop(); });
+    }
+    // 接管的连接轮流分配给各反应器；全部登记进在线用户表之后再发布接管前后的在线状态差异，
+    // 订阅者都能收到这个紧接旧版本的增量
+    adopting_ = adopted.size();
+    for(auto &state : adopted) {
+        Reactor *reactor = reactors_[next_reactor_].get();
+        next_reactor_ = (next_reactor_ + 1) % reactors_.size();
+        reactor->loop->QueueInLoop([this, reactor, state]() {
+            AdoptConnection(reactor, state);
+            if(--adopting_ == 0) accept_loop_->QueueInLoop([this]() { FlushPresence(); });
+        });
+    }
+    if(options_.takeover && adopted.empty()) {
+        accept_loop_->QueueInLoop([this]() { FlushPresence(); });
+    }
+    if(options_.metricsPort > 0) {
+        metrics_fd_ = CreateMetricsSocket();
+        if(metrics_fd_ >= 0) {
+            accept_loop_->AddFd(metrics_fd_, EPOLLIN, [this](uint32_t) { HandleMetricsAccept(); });
+        }
+    }
+    if(user_limits_.Enabled() || address_limits_.Enabled() || handshake_limits_.Enabled()) {
+        accept_loop_->RunAfter(kRateLimitSweepMs, [this]() { SweepRateLimits(); });
+    }
+    if(!options_.handoffPath.empty()) {
+        handoff_fd_ = HandoffChannel::Listen(options_.handoffPath);
+        if(handoff_fd_ >= 0) {
+            accept_loop_->AddFd(handoff_fd_, EPOLLIN, [this](uint32_t) { OnHandoffRequest(); });
+        }
+        signal_fd_ = signalfd(-1, &restartSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if(signal_fd_ >= 0) {
+            accept_loop_->AddFd(signal_fd_, EPOLLIN, [this](uint32_t) {
+                struct signalfd_siginfo info;
+                while(read(signal_fd_, &info, sizeof(info)) == sizeof(info)) {}
+                LOG_INFO << "收到 SIGUSR2，开始热重启";
+                restart();
+            });
+        }
+    }
+
+    LOG_INFO << "server is listening on port " << listen_port_ << " with "
+             << ioThreads << " io threads"
+             << (options_.reusePort ? " (SO_REUSEPORT)" : "")
+             << (accept_loop_->UsesUring() ? " (io_uring)" : "") << " ...";
+    // reusePort 模式下主线程的循环不注册任何 fd，仅阻塞到 stop() 为止
+    accept_loop_->Loop();
+
+    // 事件循环退出后回收 I/O 线程
+    for(auto &reactor : reactors_) {
+        if(reactor->thread.joinable()) reactor->thread.join();
+    }
+    // 先停哈希线程池与存储线程再销毁反应器，尚未执行的完成回调仍能安全地投递到（已停止的）循环；
+    // 哈希任务会继续向存储层提交请求，所以线程池先停
+    password_pool_.Stop();
+    history_.Close();
+    mailbox_.Close();
+    store_.Close();
+    reactors_.clear();
+    accept_loop_.reset();
+    if(handoff_fd_ >= 0) {
+        close(handoff_fd_);
+        handoff_fd_ = -1;
+    }
+    if(signal_fd_ >= 0) {
+        close(signal_fd_);
+        signal_fd_ = -1;
+    }
+    if(metrics_fd_ >= 0) {
+        close(metrics_fd_);
+        metrics_fd_ = -1;
+    }
+    for(auto &pair : metrics_clients_) close(pair.first);
+    metrics_clients_.clear();
+}
 
-    // 创建 TCP 监听套接字
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+int Serve::TakeListenSocket(std::vector<int> &inherited)
+{
+    // 优先使用从旧进程接管的监听套接字，其内核队列中尚未 accept 的连接不会丢失
+    if(inherited.empty()) return CreateListenSocket();
+    int fd = inherited.front();
+    inherited.erase(inherited.begin());
+    return fd;
+}
+
+int Serve::CreateListenSocket()
+{
+    // 创建 TCP 监听套接字（非阻塞，由事件循环驱动 accept）
+    int sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if(sock_fd < 0)
     {
-        perror("socket");
-        return;
+        LOG_ERROR << "socket: " << LogErrno();
+        return -1;
     }
 
     int opt = 1;
     setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if(options_.reusePort && setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        LOG_ERROR << "setsockopt: SO_REUSEPORT: " << LogErrno();
+        close(sock_fd);
+        return -1;
+    }
 
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
@@ -95,157 +357,1229 @@ void Serve::start()
 
     if(bind(sock_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
     {
-        perror("bind");
+        LOG_ERROR << "bind: " << LogErrno();
         close(sock_fd);
-        return;
+        return -1;
     }
 
-    if(listen(sock_fd, 5) < 0)
+    if(listen(sock_fd, options_.backlog) < 0)
     {
-        perror("listen");
+        LOG_ERROR << "listen: " << LogErrno();
         close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+void Serve::stop()
+{
+    for(auto &reactor : reactors_)
+    {
+        Reactor *r = reactor.get();
+        // 在各自的循环线程中关闭每个连接的socket fd
+        r->loop->RunInLoop([this, r]() {
+            if(r->listenFd >= 0) {
+                r->loop->RemoveFd(r->listenFd);
+                close(r->listenFd);
+                r->listenFd = -1;
+            }
+            std::vector<std::shared_ptr<ClientConnection>> conns;
+            for(auto &pair : r->connections) conns.push_back(pair.second);
+            for(auto &conn : conns) CloseConnection(conn);
+            r->loop->Quit();
+        });
+    }
+    if(accept_loop_) {
+        accept_loop_->Quit();
+    }
+    if(listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    if(!options_.handoffPath.empty() && !draining_) {
+        unlink(options_.handoffPath.c_str());
+    }
+    LOG_INFO << "停止服务...";
+}
+
+void Serve::restart()
+{
+    // 启动新进程，由它连接交接通道接管监听套接字与在线连接；本进程交接完成后从 start() 返回
+    if(draining_) return;
+    if(options_.restartCommand.empty() || handoff_fd_ < 0) {
+        LOG_ERROR << "未配置重启命令或交接通道，无法热重启";
         return;
     }
+    std::vector<char*> argv;
+    for(auto &arg : options_.restartCommand) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if(pid < 0) {
+        LOG_ERROR << "fork: " << LogErrno();
+        return;
+    }
+    if(pid == 0) {
+        // 二次 fork，新进程由 init 收养，不会成为本进程的僵尸子进程；恢复被屏蔽的信号
+        if(fork() == 0) {
+            sigset_t empty;
+            sigemptyset(&empty);
+            sigprocmask(SIG_SETMASK, &empty, nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    LOG_INFO << "已启动新进程 " << argv[0] << "，等待其接管连接...";
+}
 
-    std::cout << "server is listening on port " << listen_port_ << " ..." << std::endl;
-    
-    // 主线程持续监听客户端连接请求
+bool Serve::TakeOver(std::vector<int> &listenFds, std::vector<AdoptedConnection> &adopted)
+{
+    HandoffChannel channel;
+    if(!channel.Connect(options_.handoffPath, options_.drainTimeoutMs)) {
+        LOG_ERROR << "无法连接旧进程的交接通道: " << options_.handoffPath;
+        return false;
+    }
+    LOG_INFO << "已连接旧进程，等待其排空...";
+    // 旧进程排空最长 drainTimeoutMs，之后还要关闭存储层，留出余量
+    channel.SetTimeout(options_.drainTimeoutMs + 30000);
+    std::vector<std::pair<std::string, std::vector<std::string>>> rooms;
+    bool havePresence = false;
+    uint64_t presenceVersion = 0;
+    std::vector<std::string> presenceMembers;
+    bool complete = false;
+    std::string record;
+    std::vector<int> fds;
+    while(!complete) {
+        record.clear();
+        fds.clear();
+        if(!channel.Receive(record, fds)) break;
+        uint64_t kind = 0;
+        uint64_t flags = 0;
+        AdoptedConnection state;
+        state.fd = -1;
+        state.wireVersion = 0;
+        std::pair<std::string, std::vector<std::string>> room;
+        WireReader reader(record);
+        WireReader::Field field;
+        while(reader.Next(field)) {
+            if(field.number == kHandoffKind && field.type == kVarint) kind = field.value;
+            else if(field.number == kHandoffUsername && field.type == kBytes) {
+                state.username = field.bytes.str();
+                room.second.push_back(state.username);
+            }
+            else if(field.number == kHandoffWireVersion && field.type == kVarint) state.wireVersion = static_cast<uint8_t>(field.value);
+            else if(field.number == kHandoffFlags && field.type == kVarint) flags = field.value;
+            else if(field.number == kHandoffInput && field.type == kBytes) state.input = field.bytes.str();
+            else if(field.number == kHandoffRoom && field.type == kBytes) room.first = field.bytes.str();
+            else if(field.number == kHandoffPresenceVersion && field.type == kVarint) presenceVersion = field.value;
+        }
+        if(kind == kHandoffListen && !reader.Error()) {
+            listenFds.insert(listenFds.end(), fds.begin(), fds.end());
+        } else if(kind == kHandoffConnection && fds.size() == 1 && !reader.Error()) {
+            state.fd = fds[0];
+            state.presenceSubscribed = (flags & kHandoffPresenceSubscribed) != 0;
+            adopted.push_back(std::move(state));
+        } else {
+            for(int fd : fds) close(fd);
+            if(reader.Error()) break;
+            if(kind == kHandoffRoomMembers && !room.second.empty()) rooms.push_back(std::move(room));
+            else if(kind == kHandoffPresence) {
+                havePresence = true;
+                presenceMembers.swap(room.second);
+            }
+            else if(kind == kHandoffEnd) complete = true;
+        }
+    }
+    // 收齐后回复确认，旧进程随即关闭自己持有的副本并退出
+    if(!complete || !channel.Send("ok", std::vector<int>())) {
+        for(int fd : listenFds) close(fd);
+        for(auto &state : adopted) close(state.fd);
+        listenFds.clear();
+        adopted.clear();
+        return false;
+    }
+    for(auto &room : rooms) {
+        rooms_.Create(room.first, room.second[0]);
+        for(size_t i = 1; i < room.second.size(); ++i) rooms_.Join(room.first, room.second[i]);
+    }
+    if(havePresence) {
+        // 沿用旧进程的订阅源，已订阅的客户端手里的版本号仍然有效；接管的连接登记时不再通知上线，
+        // 旧进程尚未发布的变化（以及排空期间断开的连接）按实际接管的用户算出差异，作为下一个版本发布
+        presence_feed_.Restore(presenceVersion, presenceMembers);
+        std::unordered_set<std::string> adoptedUsers;
+        for(auto &state : adopted) {
+            if(!state.username.empty()) adoptedUsers.insert(state.username);
+        }
+        for(auto &name : presence_feed_.MemberSet()) {
+            if(!adoptedUsers.count(name)) presence_.Record(name, false);
+        }
+        for(auto &name : adoptedUsers) {
+            if(!presence_feed_.MemberSet().count(name)) presence_.Record(name, true);
+        }
+        LOG_INFO << "沿用旧进程的在线状态 v" << presenceVersion << "，" << presenceMembers.size() << " 个成员";
+    }
+    LOG_INFO << "从旧进程接管 " << listenFds.size() << " 个监听套接字、" << adopted.size()
+             << " 个连接、" << rooms.size() << " 个聊天室";
+    return true;
+}
+
+void Serve::AdoptConnection(Reactor *reactor, const AdoptedConnection &state)
+{
+    std::shared_ptr<ClientConnection> conn = RegisterConnection(reactor, state.fd);
+    if(!conn) return;
+    conn->wireVersion = state.wireVersion;
+    conn->presenceSubscribed = state.presenceSubscribed;
+    conn->decoder.Append(state.input.data(), state.input.size());
+    if(state.username.empty()) {
+        // 仍在握手阶段，重新开始握手超时计时
+        std::weak_ptr<ClientConnection> weakConn = conn;
+        conn->timer = reactor->loop->RunAfter(options_.handshakeTimeoutSeconds * 1000,
+            [this, weakConn]() { OnHandshakeTimeout(weakConn); });
+    } else {
+        conn->username = state.username;
+        if(!online_.Add(state.username, conn, false)) {
+            conn->username.clear();
+            CloseConnection(conn);
+            return;
+        }
+        rooms_.Attach(state.username, conn);
+        ArmHeartbeatTimer(conn, options_.heartbeatIdleSeconds * 1000);
+        // 旧进程排空时中断的离线消息补发，从已确认的位置继续
+        DrainMailbox(conn);
+    }
+    // 先解析旧进程转交的数据；此后到达的数据由事件循环通知，注册时已可读的 fd 会立即上报
+    ProcessInput(conn);
+}
+
+void Serve::OnHandoffRequest()
+{
+    while(true) {
+        int fd = accept4(handoff_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        if(draining_) {
+            // 同一时刻只交接给一个新进程
+            close(fd);
+            continue;
+        }
+        LOG_INFO << "新进程请求接管，开始排空...";
+        successor_.reset(new HandoffChannel(fd));
+        draining_ = true;
+        // 新进程接管后要绑定同一个指标端口
+        if(metrics_fd_ >= 0) {
+            accept_loop_->RemoveFd(metrics_fd_);
+            close(metrics_fd_);
+            metrics_fd_ = -1;
+        }
+        // 停止接受新连接；监听套接字保持打开，期间到达的连接留在内核队列中由新进程 accept
+        if(listen_fd_ >= 0) accept_loop_->RemoveFd(listen_fd_);
+        draining_reactors_ = reactors_.size();
+        for(auto &reactor : reactors_) {
+            Reactor *r = reactor.get();
+            r->loop->RunInLoop([this, r]() { BeginDrain(r); });
+        }
+    }
+}
+
+void Serve::BeginDrain(Reactor *reactor)
+{
+    if(reactor->listenFd >= 0) reactor->loop->RemoveFd(reactor->listenFd);
+    // 排空期间不再检测心跳与握手超时，新进程接管后重新计时
+    for(auto &pair : reactor->connections) {
+        reactor->loop->CancelTimer(pair.second->timer);
+        pair.second->timer.reset();
+    }
+    CheckDrained(reactor, EventLoop::NowMs() + options_.drainTimeoutMs);
+}
+
+void Serve::CheckDrained(Reactor *reactor, int64_t deadlineMs)
+{
+    // 等在途的存储层请求与离线消息补发结束，并把发送队列写空
+    std::vector<std::shared_ptr<ClientConnection>> conns;
+    for(auto &pair : reactor->connections) conns.push_back(pair.second);
+    std::vector<std::shared_ptr<ClientConnection>> busy;
+    for(auto &conn : conns) {
+        if(conn->output.QueuedBytes() > 0) FlushSendQueue(conn);
+        if(conn->closed) continue;
+        // io_uring 后端：取消多发 recv，取消前已收到的数据进入解码器随连接转交
+        if(conn->recvArmed) reactor->loop->CancelRecv(conn->fd);
+        if(conn->storePending || conn->mailboxDraining || conn->output.QueuedBytes() > 0 || conn->recvArmed) {
+            busy.push_back(conn);
+        }
+    }
+    if(!busy.empty() && EventLoop::NowMs() < deadlineMs) {
+        reactor->loop->RunAfter(kDrainPollMs, [this, reactor, deadlineMs]() { CheckDrained(reactor, deadlineMs); });
+        return;
+    }
+    for(auto &conn : busy) {
+        LOG_WARN << "client_fd " << conn->fd << " 排空超时，断开连接";
+        CloseConnection(conn);
+    }
+    // 本反应器已静止，停止其循环，此后它的连接只由主线程访问
+    reactor->loop->Quit();
+    if(--draining_reactors_ == 0) {
+        accept_loop_->QueueInLoop([this]() { FinishHandoff(); });
+    }
+}
+
+void Serve::FinishHandoff()
+{
+    for(auto &reactor : reactors_) {
+        if(reactor->thread.joinable()) reactor->thread.join();
+    }
+    // 补发的离线消息都已写入内核，确认送达，新进程从下一条开始补发
+    for(auto &reactor : reactors_) {
+        for(auto &pair : reactor->connections) {
+            ClientConnection &conn = *pair.second;
+            if(conn.username.empty() || conn.mailboxSeq == 0) continue;
+            mailbox_.Fetch(conn.username, conn.mailboxSeq, 0,
+                           [](OfflineMailbox::Result, std::vector<OfflineMailbox::Message>&) {});
+        }
+    }
+    // 写出排队的记录并关闭存储层，新进程收到连接后才打开同一批文件；
+    // 口令迁移在登录回复之后才提交，先停线程池让它们进入存储层的队列
+    password_pool_.Stop();
+    history_.Close();
+    mailbox_.Close();
+    store_.Close();
+
+    bool ok = SendHandoffState();
+    // 成功时连接已由新进程持有，只关闭本进程的副本，不能 shutdown；失败时断开全部连接，由客户端重连
+    size_t count = 0;
+    for(auto &reactor : reactors_) {
+        for(auto &pair : reactor->connections) {
+            pair.second->closed = true;
+            if(!ok) shutdown(pair.first, SHUT_RDWR);
+            close(pair.first);
+            ++count;
+        }
+        reactor->connections.clear();
+        if(reactor->listenFd >= 0) {
+            close(reactor->listenFd);
+            reactor->listenFd = -1;
+        }
+    }
+    if(listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    successor_.reset();
+    if(ok) {
+        LOG_INFO << "交接完成，移交 " << count << " 个连接";
+    } else {
+        LOG_ERROR << "交接失败，断开 " << count << " 个连接";
+    }
+    accept_loop_->Quit();
+}
+
+bool Serve::SendHandoffState()
+{
+    HandoffChannel &channel = *successor_;
+    channel.SetTimeout(options_.drainTimeoutMs);
+    std::vector<int> listenFds;
+    if(listen_fd_ >= 0) listenFds.push_back(listen_fd_);
+    for(auto &reactor : reactors_) {
+        if(reactor->listenFd >= 0) listenFds.push_back(reactor->listenFd);
+    }
+    WireWriter writer;
+    writer.PutVarint(kHandoffKind, kHandoffListen);
+    if(!channel.Send(writer.Take(), listenFds)) return false;
+
+    for(auto &reactor : reactors_) {
+        for(auto &pair : reactor->connections) {
+            ClientConnection &conn = *pair.second;
+            writer.PutVarint(kHandoffKind, kHandoffConnection);
+            if(!conn.username.empty()) writer.PutString(kHandoffUsername, conn.username);
+            writer.PutVarint(kHandoffWireVersion, conn.wireVersion);
+            writer.PutVarint(kHandoffFlags, conn.presenceSubscribed ? static_cast<uint64_t>(kHandoffPresenceSubscribed) : 0);
+            writer.PutString(kHandoffInput, conn.decoder.Pending());
+            if(!channel.Send(writer.Take(), std::vector<int>(1, conn.fd))) return false;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> rooms;
+    rooms_.Snapshot(rooms);
+    for(auto &room : rooms) {
+        writer.PutVarint(kHandoffKind, kHandoffRoomMembers);
+        writer.PutString(kHandoffRoom, room.first);
+        for(auto &member : room.second) writer.PutString(kHandoffUsername, member);
+        if(!channel.Send(writer.Take(), std::vector<int>())) return false;
+    }
+
+    // 只交出已发布的版本；尚未发布的变化由新进程按接管的连接重新算出
+    writer.PutVarint(kHandoffKind, kHandoffPresence);
+    writer.PutVarint(kHandoffPresenceVersion, presence_feed_.Version());
+    for(auto &member : presence_feed_.MemberSet()) writer.PutString(kHandoffUsername, member);
+    if(!channel.Send(writer.Take(), std::vector<int>())) return false;
+
+    writer.PutVarint(kHandoffKind, kHandoffEnd);
+    if(!channel.Send(writer.Take(), std::vector<int>())) return false;
+    // 等新进程确认收齐
+    std::string reply;
+    std::vector<int> fds;
+    return channel.Receive(reply, fds);
+}
+
+void Serve::HandleAccept(int listenFd, Reactor *owner)
+{
+    // 边沿触发：一次事件需要 accept 到 EAGAIN 为止
     while(true)
     {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
-        int client_fd = accept(sock_fd, (struct sockaddr*)&client_addr, &client_len);
-        std::cout << "client_fd: " << client_fd << std::endl;
+        Metrics::Increment(Metrics::kNetworkSyscalls);
+        int client_fd = accept4(listenFd, (struct sockaddr*)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
         if(client_fd < 0)
         {
-            perror("accept");
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            LOG_ERROR << "accept: " << LogErrno();
+            break;
+        }
+        DispatchConnection(client_fd, owner);
+    }
+}
+
+void Serve::DispatchConnection(int client_fd, Reactor *owner)
+{
+    LOG_DEBUG << "client_fd: " << client_fd;
+    int64_t acceptedUs = Metrics::NowUs();
+
+    if(owner) {
+        // reusePort 模式：连接由接受它的反应器直接负责，无需跨线程投递
+        OnNewConnection(owner, client_fd, acceptedUs);
+        return;
+    }
+    Reactor *reactor = reactors_[next_reactor_].get();
+    next_reactor_ = (next_reactor_ + 1) % reactors_.size();
+    reactor->loop->QueueInLoop([this, reactor, client_fd, acceptedUs]() { OnNewConnection(reactor, client_fd, acceptedUs); });
+}
+
+void Serve::OnNewConnection(Reactor *reactor, int client_fd, int64_t acceptedUs)
+{
+    std::shared_ptr<ClientConnection> conn = RegisterConnection(reactor, client_fd);
+    if(!conn) return;
+    Metrics::Record(Metrics::kAcceptLatency, Metrics::NowUs() - acceptedUs);
+    // 握手超时检查，对应原先的 SO_RCVTIMEO
+    std::weak_ptr<ClientConnection> weakConn = conn;
+    conn->timer = reactor->loop->RunAfter(options_.handshakeTimeoutSeconds * 1000,
+        [this, weakConn]() { OnHandshakeTimeout(weakConn); });
+}
+
+std::shared_ptr<ClientConnection> Serve::RegisterConnection(Reactor *reactor, int client_fd)
+{
+    auto conn = std::make_shared<ClientConnection>(options_.sendHighWaterMark, options_.sendQueueCapacity,
+                                                    options_.maxFrameBytes);
+    conn->fd = client_fd;
+    conn->reactor = reactor;
+    conn->lastActiveMs = EventLoop::NowMs();
+    struct sockaddr_in peer;
+    socklen_t peerLen = sizeof(peer);
+    if(getpeername(client_fd, (struct sockaddr*)&peer, &peerLen) == 0 && peer.sin_family == AF_INET) {
+        conn->peerAddress.assign(reinterpret_cast<const char*>(&peer.sin_addr), sizeof(peer.sin_addr));
+    }
+    reactor->connections[client_fd] = conn;
+    bool ok = true;
+    if(reactor->loop->UsesUring()) {
+        // 完成式收发：数据随 recv 完成事件送达，发送由 FlushSendQueue 提交，不需要可写通知
+        ArmRecv(conn);
+    } else {
+        ok = reactor->loop->AddFd(client_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+            [this, conn](uint32_t events) { HandleConnectionEvent(conn, events); });
+    }
+    if(!ok) {
+        reactor->connections.erase(client_fd);
+        close(client_fd);
+        return nullptr;
+    }
+    Metrics::Increment(Metrics::kConnectionsOpened);
+    return conn;
+}
+
+void Serve::HandleConnectionEvent(std::shared_ptr<ClientConnection> conn, uint32_t events)
+{
+    // 排空期间不再读取，未读的数据留在内核中由新进程读取
+    if(!draining_ && (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))) {
+        HandleRead(conn);
+    }
+    if(!conn->closed && (events & EPOLLOUT)) {
+        FlushSendQueue(conn);
+    }
+}
+
+void Serve::HandleRead(std::shared_ptr<ClientConnection> conn)
+{
+    bool peerClosed = false;
+    bool received = false;
+    while(!conn->closed) {
+        // 解析暂停时最多预读一块，其余数据留在内核接收缓冲区，由 TCP 流控限制客户端继续发送；
+        // 边沿触发下不会再收到通知，由 ResumeRead 在恢复解析后重新读取
+        if(InputPaused(*conn) && conn->decoder.Readable() >= kReadChunk) {
+            conn->readPaused = true;
+            break;
+        }
+        // 直接读入连接的环形缓冲区，每次读取后立即解析出所有完整的帧
+        struct iovec iov[2];
+        int iovcnt = conn->decoder.PrepareWrite(iov, kReadChunk);
+        Metrics::Increment(Metrics::kNetworkSyscalls);
+        ssize_t n = readv(conn->fd, iov, iovcnt);
+        if(n > 0) {
+            conn->decoder.CommitWrite(static_cast<size_t>(n));
+            if(!received) {
+                received = true;
+                OnPeerActive(conn);
+            }
+            ProcessInput(conn);
+            continue;
+        }
+        if(n == 0) {
+            peerClosed = true;
+            break;
+        }
+        if(errno == EINTR) continue;
+        if(errno != EAGAIN && errno != EWOULDBLOCK) peerClosed = true;
+        break;
+    }
+    if(peerClosed && !conn->closed) OnPeerClosed(conn);
+}
+
+void Serve::HandleRecv(std::shared_ptr<ClientConnection> conn, const char *data, ssize_t n)
+{
+    if(n == -ECANCELED) {
+        // 排空或暂停读取时取消，此后的数据留在内核中，由新进程或恢复后的 recv 读取
+        conn->recvArmed = false;
+        if(!draining_) ResumeRead(conn);
+        return;
+    }
+    if(conn->closed) return;
+    if(n <= 0) {
+        conn->recvArmed = false;
+        OnPeerClosed(conn);
+        return;
+    }
+    // 内核选择的接收缓冲区在回调返回后即归还，数据复制进解码器；排空期间只缓存不解析
+    conn->decoder.Append(data, static_cast<size_t>(n));
+    OnPeerActive(conn);
+    ProcessInput(conn);
+    // 与 HandleRead 相同，解析暂停时不再无限缓冲：取消多发 recv，恢复解析后重新提交
+    if(!conn->closed && !conn->readPaused && !draining_ && InputPaused(*conn) &&
+       conn->decoder.Readable() >= kReadChunk) {
+        conn->readPaused = true;
+        conn->reactor->loop->CancelRecv(conn->fd);
+    }
+}
+
+bool Serve::InputPaused(const ClientConnection &conn) const
+{
+    return conn.closeAfterFlush || conn.storePending || draining_;
+}
+
+void Serve::ArmRecv(std::shared_ptr<ClientConnection> conn)
+{
+    conn->reactor->loop->RecvMultishot(conn->fd, [this, conn](const char *data, ssize_t n) { HandleRecv(conn, data, n); });
+    conn->recvArmed = true;
+}
+
+void Serve::ResumeRead(std::shared_ptr<ClientConnection> conn)
+{
+    if(!conn->readPaused || conn->closed || InputPaused(*conn)) return;
+    if(conn->reactor->loop->UsesUring()) {
+        // 取消尚未完成时等 -ECANCELED 回调再重新提交
+        if(conn->recvArmed) return;
+        conn->readPaused = false;
+        ArmRecv(conn);
+    } else {
+        conn->readPaused = false;
+        HandleRead(conn);
+    }
+}
+
+void Serve::OnPeerActive(std::shared_ptr<ClientConnection> conn)
+{
+    // 收到数据时，认为客户端有响应，清零 heartbeat 计时变量
+    conn->lastActiveMs = EventLoop::NowMs();
+    if(conn->heartbeatSentMs != 0) {
+        // 正在等待 ACK 时收到数据，重新从空闲计时开始
+        conn->heartbeatSentMs = 0;
+        ArmHeartbeatTimer(conn, options_.heartbeatIdleSeconds * 1000);
+    }
+}
+
+void Serve::OnPeerClosed(std::shared_ptr<ClientConnection> conn)
+{
+    if(conn->username.empty()) {
+        LOG_WARN << "client_fd " << conn->fd << " 在握手阶段断开连接";
+    } else {
+        LOG_INFO << "客户端[" << conn->username << "]断开连接或读取失败";
+    }
+    CloseConnection(conn);
+}
+
+void Serve::ProcessInput(std::shared_ptr<ClientConnection> conn)
+{
+    // 依次解析缓冲区中所有完整的消息帧，不完整的部分留待下次读取
+    // 排空期间已读取的帧留在解码器中，随连接转交给新进程
+    while(!conn->closed && !InputPaused(*conn)) {
+        FrameDecoder::Message msg;
+        bool handshake = conn->username.empty();
+        FrameDecoder::Status status = conn->decoder.Next(handshake, msg);
+        if(status == FrameDecoder::kNeedMore) return;
+        if(status == FrameDecoder::kTooLarge) {
+            LOG_WARN << "client_fd " << conn->fd << " 消息帧超过上限 " << options_.maxFrameBytes << " 字节，断开连接";
+            CloseConnection(conn);
+            return;
+        }
+        if(status == FrameDecoder::kNegotiate) {
+            uint8_t version = static_cast<uint8_t>(msg.type & ~kWireHello);
+            conn->wireVersion = std::min(version, kWireVersion);
             continue;
         }
+        MessageType msgType = static_cast<MessageType>(msg.type);
+        Metrics::Increment(Metrics::kFramesIn);
 
-        // 将初始握手处理放入独立线程中，避免阻塞 accept() 循环
-        std::thread t(&Serve::HandleInitialConnection, this, client_fd);
-        t.detach();
+        // 握手帧尚无用户名，按来源地址计入握手专用的桶（默认开启）与一般的地址桶；
+        // 每次登录/注册都要排一次口令哈希，这也限制了同一来源的暴力猜测
+        double cost = handshake ? 1 : RequestCost(msgType, msg.instruction);
+        if(cost > 0 && !AllowRequest(conn, cost, handshake)) {
+            RejectRateLimited(conn, msgType);
+            continue;
+        }
+
+        if(handshake) {
+            // 握手阶段：登录或注册消息（载荷含密码，不打印）
+            // 调用原有的消息处理逻辑
+            HandleMessage(msgType, msg.payload, conn);
+            continue;
+        }
+
+        bool exitLoop = false;
+        HandleClientMessage(conn, msgType, msg.instruction, msg.payload, exitLoop);
+        if(exitLoop) {
+            conn->closeAfterFlush = true;
+            FlushSendQueue(conn);
+        }
     }
-    // 关闭监听套接字（正常流程一般不会执行到这里）
-    close(sock_fd);
 }
 
-void Serve::stop()
+bool Serve::AllowRequest(std::shared_ptr<ClientConnection> conn, double cost, bool handshake)
 {
-    for(auto &client : onlineClients)
-    {
-        // 关闭每个连接的socket fd
-        close(client.second->fd);
+    int64_t nowMs = EventLoop::NowMs();
+    if(handshake && !conn->peerAddress.empty() && !handshake_limits_.TryAcquire(conn->peerAddress, cost, nowMs)) {
+        Metrics::Increment(Metrics::kRateLimitedAddress);
+        return false;
+    }
+    // 先扣用户的桶再扣地址的桶；地址的桶拒绝时用户桶已扣的令牌不退回，被拒的请求同样占用了解析与回复
+    if(!conn->username.empty() && !user_limits_.TryAcquire(conn->username, cost, nowMs)) {
+        Metrics::Increment(Metrics::kRateLimitedUser);
+        return false;
     }
-    std::cout << "停止服务..." << std::endl;
+    if(!conn->peerAddress.empty() && !address_limits_.TryAcquire(conn->peerAddress, cost, nowMs)) {
+        Metrics::Increment(Metrics::kRateLimitedAddress);
+        return false;
+    }
+    return true;
 }
 
-void Serve::restart()
+void Serve::RejectRateLimited(std::shared_ptr<ClientConnection> conn, MessageType msgType)
+{
+    LOG_DEBUG << "client_fd " << conn->fd << " 请求过于频繁，已拒绝";
+    if(conn->username.empty()) {
+        // 握手阶段按原有的失败回执格式回复后断开
+        if(msgType == MessageType::register_user) {
+            SendAndClose(conn, "register:rate_limited");
+        } else if(msgType == MessageType::login) {
+            SendAndClose(conn, "login:login_failed, rate_limited");
+        } else {
+            CloseConnection(conn);
+        }
+        return;
+    }
+    // 已登录：丢弃该请求并回执，连接保持
+    static const Frame rateLimited = GenerateReturnMsg("rate limited");
+    SendMessage(conn, rateLimited);
+}
+
+void Serve::SweepRateLimits()
 {
-    stop();
-    start();
+    int64_t nowMs = EventLoop::NowMs();
+    user_limits_.Sweep(nowMs);
+    address_limits_.Sweep(nowMs);
+    handshake_limits_.Sweep(nowMs);
+    accept_loop_->RunAfter(kRateLimitSweepMs, [this]() { SweepRateLimits(); });
+}
+
+void Serve::OnHandshakeTimeout(std::weak_ptr<ClientConnection> weakConn)
+{
+    std::shared_ptr<ClientConnection> conn = weakConn.lock();
+    if(!conn || conn->closed || !conn->username.empty()) return;
+    // 登录/注册请求已收到、正在排队哈希或落库时不算超时，由完成回调回复
+    if(conn->storePending) return;
+    LOG_WARN << "read msgTypeByte timeout";
+    CloseConnection(conn);
+}
+
+void Serve::ArmHeartbeatTimer(std::shared_ptr<ClientConnection> conn, int64_t delayMs)
+{
+    EventLoop *loop = conn->reactor->loop.get();
+    loop->CancelTimer(conn->timer);
+    std::weak_ptr<ClientConnection> weakConn = conn;
+    conn->timer = loop->RunAfter(delayMs, [this, weakConn]() { OnHeartbeatTimer(weakConn); });
+}
+
+void Serve::OnHeartbeatTimer(std::weak_ptr<ClientConnection> weakConn)
+{
+    std::shared_ptr<ClientConnection> conn = weakConn.lock();
+    if(!conn || conn->closed) return;
+    int64_t now = EventLoop::NowMs();
+    int64_t idleMs = options_.heartbeatIdleSeconds * 1000;
+    int64_t ackTimeoutMs = options_.heartbeatAckTimeoutSeconds * 1000;
+
+    if(conn->heartbeatSentMs == 0) {
+        int64_t idle = now - conn->lastActiveMs;
+        if(idle < idleMs) {
+            // 期间收到过数据，按最近活动时间重新计时
+            ArmHeartbeatTimer(conn, idleMs - idle);
+            return;
+        }
+        // 空闲超时，发送 heartbeat 消息，并启动 ACK 计时
+        static const Frame heartbeat = GenerateReturnMsg("heartbeat");
+        SendMessage(conn, heartbeat);
+        LOG_DEBUG << "发送心跳检测给[" << conn->username << "]成功";
+        conn->heartbeatSentMs = now;
+        ArmHeartbeatTimer(conn, ackTimeoutMs);
+        return;
+    }
+    if(now - conn->heartbeatSentMs >= ackTimeoutMs) {
+        LOG_WARN << "Heartbeat ACK 超时，断开连接: " << conn->username;
+        CloseConnection(conn);
+        return;
+    }
+    ArmHeartbeatTimer(conn, ackTimeoutMs - (now - conn->heartbeatSentMs));
 }
 
-void Serve::HandleMessage(MessageType msgType, std::string& dataStr, int client_fd)
+void Serve::CloseConnection(std::shared_ptr<ClientConnection> conn)
+{
+    if(conn->closed) return;
+    conn->closed = true;
+    Metrics::Increment(Metrics::kConnectionsClosed);
+    Reactor *reactor = conn->reactor;
+    reactor->loop->CancelTimer(conn->timer);
+    conn->timer.reset();
+    reactor->loop->RemoveFd(conn->fd);
+    reactor->connections.erase(conn->fd);
+
+    if(!conn->username.empty()) {
+        // 下线通知由 OnPresenceChange 发出
+        online_.Remove(conn->username, conn);
+        rooms_.Detach(conn->username, conn);
+        // 补发的离线消息已全部写入内核时确认送达，否则留到下次登录重发
+        if(conn->mailboxSeq != 0 && conn->output.QueuedBytes() == 0) {
+            mailbox_.Fetch(conn->username, conn->mailboxSeq, 0,
+                           [](OfflineMailbox::Result, std::vector<OfflineMailbox::Message>&) {});
+        }
+    }
+    shutdown(conn->fd, SHUT_RDWR);
+    close(conn->fd);
+}
+
+void Serve::OnPresenceChange(const std::string &username, bool online)
+{
+    // 窗口内的第一条变化负责在主循环上安排一次刷新；增量的发布与订阅都在主循环上串行进行
+    if(!presence_.Record(username, online)) return;
+    if(options_.presenceWindowMs > 0) {
+        accept_loop_->QueueInLoop([this]() {
+            accept_loop_->RunAfter(options_.presenceWindowMs, [this]() { FlushPresence(); });
+        });
+    } else {
+        accept_loop_->QueueInLoop([this]() { FlushPresence(); });
+    }
+}
+
+void Serve::FlushPresence()
+{
+    PresenceAggregator::Delta delta = presence_.TakeDelta();
+    if(delta.empty()) return;
+    // 一个增量帧编码一次，共享给所有订阅者
+    Frame notification = presence_feed_.Publish(delta);
+    // 未订阅的旧客户端仍按原协议逐个收到 user_online/user_offline，每条通知同样只编码一次
+    std::vector<std::pair<std::string, Frame>> legacy;
+    legacy.reserve(delta.online.size() + delta.offline.size());
+    for(auto &name : delta.online) {
+        legacy.emplace_back(name, GenerateReturnMsg("user_online:" + name));
+    }
+    for(auto &name : delta.offline) {
+        legacy.emplace_back(name, GenerateReturnMsg("user_offline:" + name));
+    }
+    int64_t startUs = Metrics::NowUs();
+    size_t subscribers = 0;
+    size_t legacyRecipients = 0;
+    size_t frames = 0;
+    for(auto &conn : online_.Snapshot()) {
+        if(conn->presenceSubscribed) {
+            SendMessage(conn, notification);
+            ++subscribers;
+            ++frames;
+            continue;
+        }
+        // 新上线用户自己的 user_online 由登录流程在 login_success 之后单独发送
+        for(auto &change : legacy) {
+            if(change.first == conn->username) continue;
+            SendMessage(conn, change.second);
+            ++frames;
+        }
+        ++legacyRecipients;
+    }
+    Metrics::Record(Metrics::kBroadcastLatency, Metrics::NowUs() - startUs);
+    Metrics::Increment(Metrics::kBroadcastFrames, frames);
+    // 逐条广播需要 rawChanges * 接收者 个帧：订阅者合并后只需 1 个，旧客户端只收净变化
+    Metrics::Increment(Metrics::kPresenceFramesSaved, (delta.rawChanges - 1) * subscribers +
+                                                      (delta.rawChanges - legacy.size()) * legacyRecipients);
+    LOG_DEBUG << "发布在线状态增量 v" << presence_feed_.Version() << ": 上线 " << delta.online.size()
+              << " 下线 " << delta.offline.size() << "，原始变化 " << delta.rawChanges
+              << "，订阅者 " << subscribers << "，旧客户端 " << legacyRecipients;
+}
+
+void Serve::SubscribePresence(std::shared_ptr<ClientConnection> conn, uint64_t sinceVersion)
+{
+    if(conn->closed) return;
+    conn->presenceSubscribed = true;
+    // 版本号为 0 表示首次订阅；历史不足以补齐时改发快照
+    std::vector<Frame> deltas;
+    if(sinceVersion != 0 && presence_feed_.CatchUp(sinceVersion, deltas)) {
+        for(auto &frame : deltas) {
+            SendMessage(conn, frame);
+        }
+        LOG_DEBUG << "客户端[" << conn->username << "]订阅在线状态，从 v" << sinceVersion
+                  << " 补发 " << deltas.size() << " 个增量";
+    } else {
+        SendMessage(conn, presence_feed_.Snapshot());
+        LOG_DEBUG << "客户端[" << conn->username << "]订阅在线状态，发送 v"
+                  << presence_feed_.Version() << " 快照";
+    }
+}
+
+void Serve::FetchHistory(std::shared_ptr<ClientConnection> conn, const std::string &payload)
+{
+    // 查询与响应都按二进制字段编码，未协商编码的旧客户端不支持
+    if(conn->wireVersion < 1) {
+        SendMessage(conn, GenerateReturnMsg("fetch history unsupported"));
+        return;
+    }
+    std::string peer;
+    uint64_t before = 0;
+    uint64_t beforeTime = 0;
+    uint64_t limit = 50;
+    WireReader reader(payload);
+    WireReader::Field field;
+    while(reader.Next(field)) {
+        if(field.number == kHistoryPeer && field.type == kBytes) peer = field.bytes.str();
+        else if(field.number == kHistoryBefore && field.type == kVarint) before = field.value;
+        else if(field.number == kHistoryLimit && field.type == kVarint) limit = field.value;
+        else if(field.number == kHistoryBeforeTime && field.type == kVarint) beforeTime = field.value;
+    }
+    // 会话目录名由用户名拼成，先校验，避免非法名字落到文件系统
+    if(reader.Error() || !CredentialValidator::IsValidUsername(peer)) {
+        SendMessage(conn, GenerateReturnMsg("fetch history failed"));
+        return;
+    }
+    limit = std::min<uint64_t>(std::max<uint64_t>(limit, 1), options_.historyPageLimit);
+    conn->storePending = true;
+    int64_t startUs = Metrics::NowUs();
+    history_.FetchPage(conn->username, peer, before, static_cast<int64_t>(beforeTime), static_cast<size_t>(limit),
+                       options_.historyPageBytes,
+        [this, conn, peer, startUs](HistoryStore::Result result, HistoryStore::Page &page) {
+            Metrics::Record(Metrics::kStoreLatency, Metrics::NowUs() - startUs);
+            Frame reply;
+            if(result == HistoryStore::kOk) {
+                // 在历史线程上编码整页，循环线程只负责入队
+                WireWriter writer;
+                writer.PutString(kHistoryPagePeer, peer);
+                writer.PutVarint(kHistoryPageCursor, page.cursor);
+                for(auto &entry : page.entries) {
+                    WireWriter item;
+                    item.PutVarint(kHistoryEntrySeq, entry.seq);
+                    item.PutVarint(kHistoryEntryTime, static_cast<uint64_t>(entry.timeMs));
+                    item.PutString(kHistoryEntrySender, entry.sender);
+                    item.PutString(kHistoryEntryBody, entry.body);
+                    writer.PutString(kHistoryPageEntry, item.str());
+                }
+                reply = Frame::Encode(static_cast<uint8_t>(MessageType::history_msg), writer.Take());
+            } else {
+                reply = GenerateReturnMsg("fetch history failed");
+            }
+            CompleteInLoop(conn, [this, conn, reply]() { SendMessage(conn, reply); });
+        });
+}
+
+void Serve::HandleRoomInstruction(std::shared_ptr<ClientConnection> conn, InstructionType instruction, const std::string &room)
+{
+    std::string action = instruction == InstructionType::create_room ? "create_room"
+                       : instruction == InstructionType::join_room ? "join_room" : "leave_room";
+    // 聊天室名与用户名规则相同：只含中文、英文或数字
+    if(!CredentialValidator::IsValidUsername(room)) {
+        SendMessage(conn, GenerateReturnMsg(action + ":invalid_name"));
+        return;
+    }
+    RoomRegistry::Result result;
+    if(instruction == InstructionType::create_room) result = rooms_.Create(room, conn->username);
+    else if(instruction == InstructionType::join_room) result = rooms_.Join(room, conn->username);
+    else result = rooms_.Leave(room, conn->username);
+    // 与 RoomRegistry::Result 一一对应
+    static const char *kResultNames[] = {"success", "exists", "not_found", "already_member", "not_member", "full"};
+    LOG_INFO << "客户端[" << conn->username << "] " << action << " " << room << ": " << kResultNames[result];
+    SendMessage(conn, GenerateReturnMsg(action + ":" + kResultNames[result] + ":" + room));
+}
+
+void Serve::SendRoomMessage(std::shared_ptr<ClientConnection> conn, const std::string &payload)
+{
+    // 聊天室消息格式： "room|message"，或协商后的二进制聊天室载荷
+    std::string room;
+    std::string body;
+    if(!ParsePair(*conn, payload, kRoomName, kRoomBody, room, body)) {
+        // 解码器已按帧长度取走这一帧，只丢弃它，之后已缓冲的帧照常解析
+        LOG_INFO << "客户端[" << conn->username << "]发送未知格式的聊天室消息";
+        return;
+    }
+    int64_t startUs = Metrics::NowUs();
+    std::vector<std::shared_ptr<ClientConnection>> members;
+    RoomRegistry::Result result = rooms_.Collect(room, conn->username, members);
+    if(result != RoomRegistry::kOk) {
+        SendMessage(conn, GenerateReturnMsg(result == RoomRegistry::kNoRoom ? "room_msg:not_found:" + room
+                                                                            : "room_msg:not_member:" + room));
+        return;
+    }
+    // 每种载荷编码最多编码一次，同一帧共享给所有成员的发送队列
+    uint8_t msgType = static_cast<uint8_t>(MessageType::room_msg);
+    Frame textFrame;
+    Frame wireFrame;
+    for(auto &member : members) {
+        if(member->wireVersion >= 1) {
+            if(wireFrame.empty()) {
+                WireWriter writer;
+                writer.PutString(kRoomName, room);
+                writer.PutString(kRoomSender, conn->username);
+                writer.PutString(kRoomBody, body);
+                wireFrame = Frame::Encode(msgType, writer.Take());
+            }
+            SendMessage(member, wireFrame);
+        } else {
+            if(textFrame.empty()) textFrame = Frame::Encode(msgType, room + "|" + conn->username + "|" + body);
+            SendMessage(member, textFrame);
+        }
+    }
+    Metrics::Record(Metrics::kBroadcastLatency, Metrics::NowUs() - startUs);
+    Metrics::Increment(Metrics::kRoomMessages);
+    Metrics::Increment(Metrics::kBroadcastFrames, members.size());
+    static const Frame roomSuccess = GenerateReturnMsg("room_msg:success");
+    SendMessage(conn, roomSuccess);
+}
+
+int Serve::CreateMetricsSocket()
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        LOG_ERROR << "socket: metrics: " << LogErrno();
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(options_.metricsPort);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        LOG_ERROR << "bind: metrics: " << LogErrno();
+        close(fd);
+        return -1;
+    }
+    LOG_INFO << "metrics on 127.0.0.1:" << options_.metricsPort;
+    return fd;
+}
+
+void Serve::HandleMetricsAccept()
+{
+    while(true) {
+        int fd = accept4(metrics_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        metrics_clients_[fd] = std::make_pair(EventLoop::NowMs(), std::string());
+        accept_loop_->AddFd(fd, EPOLLIN | EPOLLRDHUP, [this, fd](uint32_t) { HandleMetricsRequest(fd); });
+        // 一秒内没有发完请求头的连接直接关闭；按接入时间判断，fd 被复用时不会误关新连接
+        int64_t acceptedMs = EventLoop::NowMs();
+        accept_loop_->RunAfter(1000, [this, fd, acceptedMs]() {
+            auto it = metrics_clients_.find(fd);
+            if(it != metrics_clients_.end() && it->second.first == acceptedMs) CloseMetricsClient(fd);
+        });
+    }
+}
+
+void Serve::HandleMetricsRequest(int fd)
+{
+    auto it = metrics_clients_.find(fd);
+    if(it == metrics_clients_.end()) return;
+    std::string &request = it->second.second;
+    char buf[1024];
+    while(true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n > 0) {
+            request.append(buf, n);
+            if(request.size() > 8192) break;
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // 请求头尚未读完，等下一次可读
+            if(request.find("\r\n\r\n") == std::string::npos) return;
+        }
+        break;
+    }
+    if(request.find("\r\n\r\n") != std::string::npos) {
+        // 不区分路径，任何 GET 都返回全部指标；响应只有几 KB，一次写入内核发送缓冲区
+        std::string body = RenderMetrics();
+        std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                             + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+    }
+    CloseMetricsClient(fd);
+}
+
+void Serve::CloseMetricsClient(int fd)
+{
+    accept_loop_->RemoveFd(fd);
+    metrics_clients_.erase(fd);
+    close(fd);
+}
+
+std::string Serve::RenderMetrics()
+{
+    std::string out;
+    Metrics::Render(out);
+    // 发送队列深度：逐个读取已登录连接的原子计数，不影响热路径
+    size_t queued = 0;
+    size_t maxQueued = 0;
+    for(auto &conn : online_.Snapshot()) {
+        size_t bytes = conn->output.QueuedBytes();
+        queued += bytes;
+        maxQueued = std::max(maxQueued, bytes);
+    }
+    uint64_t opened = Metrics::CounterValue(Metrics::kConnectionsOpened);
+    uint64_t closed = Metrics::CounterValue(Metrics::kConnectionsClosed);
+    Metrics::RenderGauge(out, "chatserve_online_users", "Logged-in users", online_.Size());
+    Metrics::RenderGauge(out, "chatserve_open_connections", "Open client connections, including handshakes",
+                         static_cast<double>(opened - closed));
+    Metrics::RenderGauge(out, "chatserve_send_queue_bytes", "Bytes queued for logged-in connections", queued);
+    Metrics::RenderGauge(out, "chatserve_send_queue_max_bytes", "Largest per-connection send queue", maxQueued);
+    Metrics::RenderGauge(out, "chatserve_user_store_queue_depth", "Requests waiting for the user store thread",
+                         store_.QueueDepth());
+    UserStore::BatchStats batches = store_.Stats();
+    Metrics::RenderCounter(out, "chatserve_user_store_batches_total", "Account mutation transactions committed",
+                           batches.batches);
+    Metrics::RenderCounter(out, "chatserve_user_store_mutations_total", "Account mutations in committed transactions",
+                           batches.mutations);
+    Metrics::RenderGauge(out, "chatserve_user_store_max_batch", "Largest account mutation batch",
+                         static_cast<double>(batches.maxBatchSize));
+    Metrics::RenderGauge(out, "chatserve_user_store_max_commit_us", "Slowest account mutation COMMIT in microseconds",
+                         static_cast<double>(batches.maxCommitUs));
+    Metrics::RenderGauge(out, "chatserve_password_queue_depth", "Password hash tasks waiting for a worker",
+                         password_pool_.QueueDepth());
+    Metrics::RenderGauge(out, "chatserve_rate_limit_buckets", "Token buckets that are not full, users and addresses",
+                         user_limits_.Size() + address_limits_.Size() + handshake_limits_.Size());
+    Metrics::RenderGauge(out, "chatserve_mailbox_queue_depth", "Requests waiting for the mailbox thread",
+                         mailbox_.QueueDepth());
+    Metrics::RenderGauge(out, "chatserve_history_queue_depth", "Requests waiting for the history thread",
+                         history_.QueueDepth());
+    Metrics::RenderGauge(out, "chatserve_rooms", "Rooms with at least one member", rooms_.RoomCount());
+    Metrics::RenderCounter(out, "chatserve_log_dropped_total", "Log records dropped because a thread's log ring was full",
+                           Logger::Dropped());
+    return out;
+}
+
+void Serve::SendMessage(std::shared_ptr<ClientConnection> conn, const Frame &msg)
+{
+    if(conn->closed) return;
+    switch(conn->output.Push(msg, conn->reactor->loop->IsInLoopThread())) {
+        case OutputBuffer::kPushedNeedFlush:
+            // 由连接所属的循环线程负责实际写出：跨线程时通过 eventfd 立即唤醒，
+            // 本线程内则延后到本轮事件处理结束，同一批回复合并为一次 writev
+            conn->reactor->loop->QueueInLoop([this, conn]() { FlushSendQueue(conn); });
+            break;
+        case OutputBuffer::kPushed:
+            break;
+        case OutputBuffer::kRejected:
+            Metrics::Increment(Metrics::kSlowConsumer);
+            if(options_.disconnectSlowConsumer) {
+                LOG_WARN << "客户端[" << conn->username << "]发送队列超过高水位("
+                         << conn->output.QueuedBytes() << " 字节)，断开连接";
+                conn->reactor->loop->RunInLoop([this, conn]() { CloseConnection(conn); });
+            } else {
+                LOG_ERROR << "客户端[" << conn->username << "]发送队列超过高水位，丢弃消息";
+            }
+            break;
+    }
+}
+
+void Serve::FlushSendQueue(std::shared_ptr<ClientConnection> conn)
+{
+    if(conn->closed) return;
+    EventLoop *loop = conn->reactor->loop.get();
+    if(loop->UsesUring()) {
+        // 同一连接同时只有一条发送链在途，其间入队的帧在完成后一并提交
+        if(conn->sendInFlight) return;
+        struct iovec iov[kUringSendIov];
+        int iovcnt = conn->output.Gather(iov, kUringSendIov);
+        if(iovcnt == 0) {
+            if(conn->closeAfterFlush) CloseConnection(conn);
+            return;
+        }
+        conn->sendInFlight = true;
+        loop->Send(conn->fd, iov, iovcnt, [this, conn](ssize_t sent) { OnSendComplete(conn, sent); });
+        return;
+    }
+    OutputBuffer::WriteResult result = conn->output.WriteTo(conn->fd);
+    // kWouldBlock：内核发送缓冲区已满，等待 EPOLLOUT 后继续发送
+    if(result == OutputBuffer::kError || (result == OutputBuffer::kDrained && conn->closeAfterFlush)) {
+        CloseConnection(conn);
+    }
+}
+
+void Serve::OnSendComplete(std::shared_ptr<ClientConnection> conn, ssize_t sent)
+{
+    conn->sendInFlight = false;
+    if(conn->closed) return;
+    if(sent < 0) {
+        CloseConnection(conn);
+        return;
+    }
+    conn->output.Consume(static_cast<size_t>(sent));
+    FlushSendQueue(conn);
+}
+
+void Serve::SendAndClose(std::shared_ptr<ClientConnection> conn, const std::string &msg)
+{
+    conn->closeAfterFlush = true;
+    SendMessage(conn, GenerateReturnMsg(msg));
+}
+
+void Serve::CompleteInLoop(std::shared_ptr<ClientConnection> conn, std::function<void()> fn)
+{
+    // 存储层的完成回调在数据库线程上调用，切回连接所属的循环线程处理结果，
+    // 之后继续解析请求期间暂停的后续帧
+    conn->reactor->loop->RunInLoop([this, conn, fn]() {
+        conn->storePending = false;
+        if(conn->closed) return;
+        fn();
+        ProcessInput(conn);
+        ResumeRead(conn);
+    });
+}
+
+bool Serve::SubmitPasswordTask(std::shared_ptr<ClientConnection> conn, std::function<void()> task)
+{
+    // 与存储层请求一样暂停解析后续帧，任务最终经 CompleteInLoop 回到循环线程
+    conn->storePending = true;
+    int64_t startUs = Metrics::NowUs();
+    bool queued = password_pool_.TrySubmit([task, startUs]() {
+        task();
+        Metrics::Record(Metrics::kPasswordLatency, Metrics::NowUs() - startUs);
+    });
+    if(!queued) {
+        conn->storePending = false;
+        Metrics::Increment(Metrics::kPasswordRejected);
+        LOG_WARN << "口令哈希队列已满，拒绝 client_fd " << conn->fd << " 的请求";
+    }
+    return queued;
+}
+
+void Serve::MigratePassword(const std::string &username, const std::string &password, const std::string &stored)
+{
+    // 在哈希线程上调用：重新哈希后比较并替换，期间口令已被修改则放弃
+    std::string replacement = PasswordHasher::Hash(password, options_.passwordIterations);
+    if(replacement.empty()) return;
+    store_.UpdatePassword(username, stored, replacement, [this, username, replacement](UserStore::Result result) {
+        if(result != UserStore::kOk) return;
+        credentials_.Put(username, replacement);
+        Metrics::Increment(Metrics::kPasswordMigrated);
+        LOG_DEBUG << "用户[" << username << "]的口令已迁移为哈希存储";
+    });
+}
+
+void Serve::HandleMessage(MessageType msgType, std::string& dataStr, std::shared_ptr<ClientConnection> conn)
 {
     std::string response = "";
-    int rc = 0; // 添加 rc 变量，便于 SQLite API 调用
     // 根据消息类型分别处理
     switch(msgType) {
         case MessageType::register_user:
             {
-                // 预期数据格式： "username|password"
-                std::vector<std::string> tokens;
-                size_t pos = 0;
-                while((pos = dataStr.find("|")) != std::string::npos)
+                // 预期数据格式： "username|password"，或协商后的二进制凭据载荷
+                std::string username;
+                std::string password;
+                if(ParsePair(*conn, dataStr, kCredentialUsername, kCredentialPassword, username, password))
                 {
-                    tokens.push_back(dataStr.substr(0, pos));
-                    dataStr.erase(0, pos + 1);
-                }
-                tokens.push_back(dataStr);
-                
-                if(tokens.size() >= 2)
-                {
-                    std::string username = tokens[0];
-                    std::string password = tokens[1];
 
                     // 限制1：用户名只能为中文或英文或数字
                     // 限制2：密码只能由英文大小写字母和数字组成
-                    std::regex usernameRegex("^[A-Za-z0-9一-龥]+$");
-                    std::regex passwordRegex("^[A-Za-z0-9]+$");
-                    if(!std::regex_match(username, usernameRegex))
+                    if(!CredentialValidator::IsValidUsername(username))
                     {
                         response = "register:invalid_username";
-                        std::vector<char> returnMsg = GenerateReturnMsg(response);
-                        send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                        close(client_fd);
+                        SendAndClose(conn, response);
                         return;
                     }
-                    if(!std::regex_match(password, passwordRegex))
+                    if(!CredentialValidator::IsValidPassword(password))
                     {
                         response = "register:invalid_password";
-                        std::vector<char> returnMsg = GenerateReturnMsg(response);
-                        send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                        close(client_fd);
-                        return;
-                    }
-                    std::cout << "username: " << username << std::endl;
-                    std::cout << "password: " << password << std::endl;
-                    // 限制3：注册用户总数不超过20个
-                    std::string count_sql = "SELECT COUNT(*) FROM users;";
-                    sqlite3_stmt* stmt = nullptr;
-                    rc = sqlite3_prepare_v2(db_, count_sql.c_str(), -1, &stmt, nullptr);
-                    int userCount = 0;
-                    if(rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
-                        userCount = sqlite3_column_int(stmt, 0);
-                    }
-                    sqlite3_finalize(stmt);
-                    if(userCount >= 20) {
-                        response = "register:user_limit_reached";
-                        std::cout << "user limit reached" << std::endl;
-                        std::vector<char> returnMsg = GenerateReturnMsg(response);
-                        send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                        close(client_fd);
+                        SendAndClose(conn, response);
                         return;
                     }
-
-                    // 插入用户信息（对输入进行转义建议使用 SQLite API 自带功能或手工构造）
-                    std::string insert_sql = "INSERT INTO users (username, password) VALUES ('" +
-                                                username + "', '" + password + "');";
-                    char* errMsg = nullptr;
-                    rc = sqlite3_exec(db_, insert_sql.c_str(), nullptr, nullptr, &errMsg);
-                    if(rc != SQLITE_OK)
-                    {
-                        std::string error = errMsg;
-                        std::cerr << "用户注册失败: " << error << std::endl;
-                        sqlite3_free(errMsg);
-                        if(error.find("UNIQUE constraint failed") != std::string::npos) {
-                            response = "register:username_exists";
-                        } else {
-                            response = "register:register_failed";
+                    LOG_DEBUG << "注册请求: " << username;
+                    // 先在哈希线程池上计算口令存储值，再交给存储层；
+                    // 限制3：注册用户总数不超过上限；计数与插入由存储层在数据库线程上完成
+                    bool queued = SubmitPasswordTask(conn, [this, conn, username, password]() {
+                        std::string stored = PasswordHasher::Hash(password, options_.passwordIterations);
+                        if(stored.empty()) {
+                            LOG_ERROR << "口令哈希失败: " << username;
+                            CompleteInLoop(conn, [this, conn]() { SendAndClose(conn, "register:register_failed"); });
+                            return;
                         }
-                        std::vector<char> returnMsg = GenerateReturnMsg(response);
-                        send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                        close(client_fd);
-                        return;
-                    }
-                    else
-                    {
-                        std::cout << "用户注册成功: " << username << std::endl;
-                        response = "register:register_success";
-                        std::vector<char> returnMsg = GenerateReturnMsg(response);
-                        send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                        close(client_fd);
-                        return;
-                    }
+                        int64_t startUs = Metrics::NowUs();
+                        store_.Register(username, stored, [this, conn, username, stored, startUs](UserStore::Result result) {
+                            Metrics::Record(Metrics::kStoreLatency, Metrics::NowUs() - startUs);
+                            // 落库成功后同步更新内存账号表（写穿）
+                            if(result == UserStore::kOk) credentials_.Put(username, stored);
+                            CompleteInLoop(conn, [this, conn, username, result]() {
+                                switch(result) {
+                                    case UserStore::kOk:
+                                        LOG_INFO << "用户注册成功: " << username;
+                                        SendAndClose(conn, "register:register_success");
+                                        break;
+                                    case UserStore::kLimitReached:
+                                        LOG_WARN << "user limit reached";
+                                        SendAndClose(conn, "register:user_limit_reached");
+                                        break;
+                                    case UserStore::kExists:
+                                        SendAndClose(conn, "register:username_exists");
+                                        break;
+                                    default:
+                                        SendAndClose(conn, "register:register_failed");
+                                        break;
+                                }
+                            });
+                        });
+                    });
+                    if(!queued) SendAndClose(conn, "register:server_busy");
+                    return;
                 }
                 else
                 {
-                    std::cerr << "注册消息格式错误。" << std::endl;
+                    LOG_WARN << "注册消息格式错误。";
                     response = "register:register_failed";
-                    std::vector<char> returnMsg = GenerateReturnMsg(response);
-                    send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                    close(client_fd);
+                    SendAndClose(conn, response);
                     return;
                 }
             }
@@ -253,505 +1587,380 @@ void Serve::HandleMessage(MessageType msgType, std::string& dataStr, int client_
 
         case MessageType::login:
             {
-                // 预期数据格式： "username|password"
-                std::vector<std::string> tokens;
-                size_t pos = 0;
-                while((pos = dataStr.find("|")) != std::string::npos)
-                {
-                    tokens.push_back(dataStr.substr(0, pos));
-                    dataStr.erase(0, pos + 1);
-                }
-                tokens.push_back(dataStr);
-                if(tokens.size() >= 2)
+                int64_t startUs = Metrics::NowUs();
+                // 预期数据格式： "username|password"，或协商后的二进制凭据载荷
+                std::string username;
+                std::string password;
+                if(ParsePair(*conn, dataStr, kCredentialUsername, kCredentialPassword, username, password))
                 {
-                    std::string username = tokens[0];
-                    std::string password = tokens[1];
 
-                    std::string select_sql = "SELECT password FROM users WHERE username = '" + username + "';";
-                    sqlite3_stmt* stmt = nullptr;
-                    rc = sqlite3_prepare_v2(db_, select_sql.c_str(), -1, &stmt, nullptr);
-                    if(rc != SQLITE_OK)
-                    {
-                        response = "login:login_failed, user_not_exist";
-                        std::cout << "用户登录失败，用户不存在: " << username << std::endl;
-                        std::vector<char> returnMsg = GenerateReturnMsg(response);
-                        send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                        close(client_fd);
+                    // 格式不合法的用户名/密码不可能注册过，直接拒绝；否则在内存账号表中取口令存储值，不访问数据库
+                    UserStore::Result result = UserStore::kOk;
+                    std::string stored;
+                    if(!CredentialValidator::IsValidUsername(username)) {
+                        result = UserStore::kNotFound;
+                    } else if(!CredentialValidator::IsValidPassword(password)) {
+                        result = UserStore::kWrongPassword;
+                    } else if(!credentials_.Lookup(username, stored)) {
+                        result = UserStore::kNotFound;
+                    }
+                    if(result != UserStore::kOk) {
+                        OnLoginChecked(conn, username, result);
+                        Metrics::Record(Metrics::kLoginLatency, Metrics::NowUs() - startUs);
                         return;
                     }
-                    else
-                    {
-                        if(sqlite3_step(stmt) == SQLITE_ROW)
-                        {
-                            if(password == reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)))
-                            {
-                                if(onlineClients.find(username) != onlineClients.end()) {
-                                    response = "login:login_failed, user_already_online";
-                                    std::cout << "用户登录失败，用户已在线: " << username << std::endl;
-                                    std::vector<char> returnMsg = GenerateReturnMsg(response);
-                                    send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                                    close(client_fd);
-                                    return;
-                                }
-                                std::cout << "用户登录成功: " << username << std::endl;
-                                response = "login:login_success";
-                                std::vector<char> returnMsg = GenerateReturnMsg(response);
-                                send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                                {
-                                    auto conn = std::make_shared<ClientConnection>();
-                                    conn->fd = client_fd;
-                                    {
-                                        std::lock_guard<std::mutex> lock(clientsMutex);
-                                        // 存入在线客户端列表
-                                        onlineClients[username] = conn;
-                                    }
-                                    // 启动处理线程，该线程负责收发消息
-                                    std::thread(&Serve::HandleClient, this, conn, username).detach();
-                                }
-                                std::vector<char> notification = GenerateReturnMsg("user_online:" + username);
-                                BroadcastNotification(notification);
-                                std::cout << "用户登录成功，通知所有在线用户" << std::endl;
-                                return;
-                            }
-                            else
-                            {
-                                std::cout << "用户登录失败，密码错误: " << username << std::endl;
-                                response = "login:login_failed, password_error"; 
-                                std::vector<char> returnMsg = GenerateReturnMsg(response);
-                                send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                                close(client_fd);
-                                return;
-                            }
-                        }
-                        else
-                        {
-                            std::cout << "用户登录失败，用户不存在: " << username << std::endl;
-                            response = "login:login_failed, user_not_exist";
-                            std::vector<char> returnMsg = GenerateReturnMsg(response);
-                            send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                            close(client_fd);
-                            return;
-                        }
+                    // 口令校验在哈希线程池上进行；明文或旧参数的存储值在回复之后重新哈希
+                    bool queued = SubmitPasswordTask(conn, [this, conn, username, password, stored, startUs]() {
+                        bool needsRehash = false;
+                        bool match = PasswordHasher::Verify(password, stored, options_.passwordIterations, needsRehash);
+                        CompleteInLoop(conn, [this, conn, username, match, startUs]() {
+                            OnLoginChecked(conn, username, match ? UserStore::kOk : UserStore::kWrongPassword);
+                            Metrics::Record(Metrics::kLoginLatency, Metrics::NowUs() - startUs);
+                        });
+                        if(match && needsRehash) MigratePassword(username, password, stored);
+                    });
+                    if(!queued) {
+                        Metrics::Increment(Metrics::kLoginFailed);
+                        SendAndClose(conn, "login:login_failed, server_busy");
                     }
-                    sqlite3_finalize(stmt);
+                    return;
                 }
                 else
                 {
-                    std::cerr << "登录消息格式错误。" << std::endl;
+                    LOG_WARN << "登录消息格式错误。";
                     response = "login:login_failed, format_error";
-                    std::vector<char> returnMsg = GenerateReturnMsg(response);
-                    send(client_fd, returnMsg.data(), returnMsg.size(), 0);
-                    close(client_fd);
+                    SendAndClose(conn, response);
                     return;
                 }
             }
             break;
+        default:
+            LOG_WARN << "握手阶段收到未知的消息类型";
+            CloseConnection(conn);
+            break;
     }
     return;
 }
 
-// 用于处理持续连接的客户端
-void Serve::HandleClient(std::shared_ptr<ClientConnection> conn, const std::string &username) {
-    int client_fd = conn->fd;
-    std::cout << "开始处理客户端[" << username << "]的持续连接" << std::endl;
-    bool exitLoop = false; // 用于跳出while循环
-    time_t heartbeatSent = 0; // 记录发送 heartbeat 的时间，0 表示当前未发送
-    while(!exitLoop) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(client_fd, &readfds);
-
-        // 设置超时时间为10秒钟
-        struct timeval timeout;
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
-
-        int activity = select(client_fd + 1, &readfds, NULL, NULL, &timeout);
-
-        if (activity == 0) {
-            if (heartbeatSent == 0) {
-                // 第一次超时，发送 heartbeat 消息，并启动计时
-                std::string heartbeat = "heartbeat";
-                std::vector<char> hbMsg = GenerateReturnMsg(heartbeat);
-                int sent = send(client_fd, hbMsg.data(), hbMsg.size(), 0);
-                if(sent <= 0) {
-                    std::cerr << "发送心跳检测给[" << username << "]失败" << std::endl;
-                    exitLoop = true;
-                    break;
-                } else {
-                    std::cout << "发送心跳检测给[" << username << "]成功" << std::endl;
-                }
-                heartbeatSent = time(NULL);
-            } else {
-                // 已发送 heartbeat，检查是否超过20秒
-                if(time(NULL) - heartbeatSent >= 20) {
-                    std::cerr << "Heartbeat ACK 超时，断开连接: " << username << std::endl;
-                    exitLoop = true;
-                    break;
-                }
-            }
-            continue;
-        } else if (activity < 0) {
-            std::cerr << "select error for " << username << std::endl;
-            exitLoop = true;
-            break;
-        }
+void Serve::OnLoginChecked(std::shared_ptr<ClientConnection> conn, const std::string &username, UserStore::Result result)
+{
+    std::string response;
+    if(result == UserStore::kNotFound || result == UserStore::kFailed)
+    {
+        Metrics::Increment(Metrics::kLoginFailed);
+        LOG_INFO << "用户登录失败，用户不存在: " << username;
+        response = "login:login_failed, user_not_exist";
+        SendAndClose(conn, response);
+        return;
+    }
+    if(result == UserStore::kWrongPassword)
+    {
+        Metrics::Increment(Metrics::kLoginFailed);
+        LOG_INFO << "用户登录失败，密码错误: " << username;
+        response = "login:login_failed, password_error";
+        SendAndClose(conn, response);
+        return;
+    }
+    // 存入在线客户端列表，此后该连接的消息由 HandleClientMessage 处理
+    conn->username = username;
+    if(!online_.Add(username, conn)) {
+        conn->username.clear();
+        response = "login:login_failed, user_already_online";
+        Metrics::Increment(Metrics::kLoginFailed);
+        LOG_INFO << "用户登录失败，用户已在线: " << username;
+        SendAndClose(conn, response);
+        return;
+    }
+    rooms_.Attach(username, conn);
+    Metrics::Increment(Metrics::kLoginSuccess);
+    LOG_INFO << "用户登录成功: " << username;
+    response = "login:login_success";
+    SendMessage(conn, GenerateReturnMsg(response));
+    // 握手完成，握手超时定时器切换为心跳定时器
+    ArmHeartbeatTimer(conn, options_.heartbeatIdleSeconds * 1000);
+    SendMessage(conn, GenerateReturnMsg("user_online:" + username));
+    DrainMailbox(conn);
+}
 
-        if(FD_ISSET(client_fd, &readfds)) {
-            uint8_t msgTypeByte;
-            ssize_t ret = read(client_fd, &msgTypeByte, 1);
-            if(ret <= 0) {
-                std::cout << "客户端[" << username << "]断开连接或读取失败" << std::endl;
-                FlushSocketBuffer(client_fd);
-                exitLoop = true;
-                break;
-            }
-            // 收到数据时，认为客户端有响应，清零 heartbeat 计时变量
-            heartbeatSent = 0;
-            HandleClientMessage(conn, msgTypeByte, username, exitLoop);
-        }
+void Serve::DrainMailbox(std::shared_ptr<ClientConnection> conn)
+{
+    if(conn->closed || draining_) return;
+    if(conn->mailboxDraining) {
+        conn->mailboxDirty = true;
+        return;
+    }
+    conn->mailboxDraining = true;
+    FetchMailbox(conn);
+}
 
-        // 每次循环检查发送队列中是否有待发送的消息
-        {
-            std::unique_lock<std::mutex> lock(conn->sendMutex);
-            while(!conn->sendQueue.empty()) {
-                auto msg = conn->sendQueue.front();
-                conn->sendQueue.pop();
-                // 发送消息
-                send(client_fd, msg.data(), msg.size(), 0);
-            }
+void Serve::FetchMailbox(std::shared_ptr<ClientConnection> conn)
+{
+    // 取下一批的同时确认上一批已送达；连接中途断开时未确认的消息留到下次登录重发
+    mailbox_.Fetch(conn->username, conn->mailboxSeq, std::max<size_t>(options_.mailboxBatch, 1),
+        [this, conn](OfflineMailbox::Result result, std::vector<OfflineMailbox::Message> &messages) {
+            std::shared_ptr<std::vector<OfflineMailbox::Message>> batch =
+                std::make_shared<std::vector<OfflineMailbox::Message>>(std::move(messages));
+            conn->reactor->loop->RunInLoop([this, conn, result, batch]() { OnMailboxBatch(conn, result, *batch); });
+        });
+}
+
+void Serve::OnMailboxBatch(std::shared_ptr<ClientConnection> conn, OfflineMailbox::Result result,
+                           const std::vector<OfflineMailbox::Message> &messages)
+{
+    if(conn->closed) return;
+    // 排空期间丢弃这一批，新进程接管后从已确认的位置重新补发
+    if(draining_) {
+        conn->mailboxDraining = false;
+        return;
+    }
+    if(result != OfflineMailbox::kOk || messages.empty()) {
+        conn->mailboxDraining = false;
+        if(result != OfflineMailbox::kOk) {
+            LOG_ERROR << "读取[" << conn->username << "]的离线消息失败";
+        } else if(conn->mailboxDirty) {
+            conn->mailboxDirty = false;
+            DrainMailbox(conn);
         }
+        return;
     }
-    {
-        std::lock_guard<std::mutex> lock(clientsMutex);
-        onlineClients.erase(username);
+    for(auto &message : messages) {
+        SendMessage(conn, EncodeForward(*conn, message.sender, message.body));
     }
-    std::vector<char> notification = GenerateReturnMsg("user_offline:" + username);
-    BroadcastNotification(notification);
-    std::cout << "用户[" << username << "]下线，通知所有在线用户" << std::endl;
-    shutdown(client_fd, SHUT_RDWR);
-    close(client_fd);
+    conn->mailboxSeq = messages.back().seq;
+    LOG_INFO << "向[" << conn->username << "]补发 " << messages.size() << " 条离线消息";
+    // 等这一批写入内核再取下一批，补发不会挤占发送队列，也不会一次把整个信箱读进内存
+    FlushSendQueue(conn);
+    WaitMailboxFlushed(conn);
 }
 
-std::vector<char> Serve::GenerateReturnMsg(const std::string &msg) {
+void Serve::WaitMailboxFlushed(std::weak_ptr<ClientConnection> weakConn)
+{
+    std::shared_ptr<ClientConnection> conn = weakConn.lock();
+    if(!conn || conn->closed) return;
+    if(draining_) {
+        conn->mailboxDraining = false;
+        return;
+    }
+    if(conn->output.QueuedBytes() == 0) {
+        FetchMailbox(conn);
+        return;
+    }
+    conn->reactor->loop->RunAfter(kMailboxPollMs, [this, weakConn]() { WaitMailboxFlushed(weakConn); });
+}
+
+Frame Serve::GenerateReturnMsg(const std::string &msg) {
     uint8_t msgType = static_cast<uint8_t>(MessageType::return_msg);
-    uint32_t netMsgLength = htonl(msg.size());
-    std::vector<char> buffer(1 + sizeof(netMsgLength) + msg.size());
-    buffer[0] = msgType;
-    memcpy(buffer.data() + 1, &netMsgLength, sizeof(netMsgLength));
-    memcpy(buffer.data() + 1 + sizeof(netMsgLength), msg.c_str(), msg.size());
-    return buffer;
+    return Frame::Encode(msgType, msg);
 }
 
-void Serve::HandleClientMessage(std::shared_ptr<ClientConnection> conn, uint8_t msgTypeByte, const std::string &username, bool &exitLoop) {
-    MessageType msgType = static_cast<MessageType>(msgTypeByte);
-    ssize_t ret = 0;
+void Serve::HandleClientMessage(std::shared_ptr<ClientConnection> conn, MessageType msgType, uint32_t instruction, const std::string &payload, bool &exitLoop) {
+    const std::string &username = conn->username;
     switch(msgType) {
         case MessageType::forward_msg:
             {
-                uint32_t netDataLength;
-                ret = read(conn->fd, &netDataLength, 4);
-                if(ret != 4) {
-                    std::cerr << "read netDataLength failed" << std::endl;
-                    FlushSocketBuffer(conn->fd);
-                    exitLoop = true;
-                    return;
-                }
-                uint32_t dataLength = ntohl(netDataLength);
-                std::vector<char> payload(dataLength);
-                size_t totalRead = 0;
-                while(totalRead < dataLength) {
-                    ssize_t n = read(conn->fd, payload.data() + totalRead, dataLength - totalRead);
-                    if(n <= 0) return;
-                    totalRead += n;
-                }
-                if(totalRead != dataLength) {
-                    std::cerr << "data read incomplete" << std::endl;
-                    FlushSocketBuffer(conn->fd);
-                    exitLoop = true;
-                    return;
-                }
-                std::string msg(payload.begin(), payload.end());
-                // 转发消息格式： "targetUsername|message"
-                size_t pos = msg.find("|");
-                if(pos != std::string::npos) {
-                    std::string target = msg.substr(0, pos);
-                    uint8_t msgType = static_cast<uint8_t>(MessageType::forward_msg);
-                    std::string forwardMsg = username + "|" + msg.substr(pos + 1);
-                    uint32_t netMsgLength = htonl(forwardMsg.size());
-                    size_t totalLength = 1 + sizeof(netMsgLength) + forwardMsg.size();
-                    std::vector<char> buffer(totalLength);
-                    buffer[0] = msgType;
-                    memcpy(buffer.data() + 1, &netMsgLength, sizeof(netMsgLength));
-                    memcpy(buffer.data() + 1 + sizeof(netMsgLength), forwardMsg.c_str(), forwardMsg.size());
-                    std::lock_guard<std::mutex> lock(clientsMutex);
-                    if(onlineClients.find(target) != onlineClients.end()) {
-                        int target_fd = onlineClients[target]->fd;
-                        int totalsend = 0;
-                        while(totalsend < totalLength) {
-                            int send_len = send(target_fd, buffer.data() + totalsend, totalLength - totalsend, 0);
-                            if(send_len <= 0) {
-                                break;
+                const std::string &msg = payload;
+                int64_t startUs = Metrics::NowUs();
+                // 转发消息格式： "targetUsername|message"，或协商后的二进制转发载荷
+                std::string target;
+                std::string body;
+                if(ParsePair(*conn, msg, kForwardPeer, kForwardBody, target, body)) {
+                    // 固定内容的回执只编码一次，所有连接共享
+                    static const Frame forwardSuccess = GenerateReturnMsg("forward success");
+                    std::shared_ptr<ClientConnection> targetConn = online_.Find(target);
+                    if(targetConn) {
+                        // 投递到目标连接的发送队列，由其所属循环线程写出
+                        SendMessage(targetConn, EncodeForward(*targetConn, username, body));
+                        SendMessage(conn, forwardSuccess);
+                        Metrics::Record(Metrics::kForwardLatency, Metrics::NowUs() - startUs);
+                        Metrics::Increment(Metrics::kForwardDelivered);
+                        history_.Append(username, target, body);
+                    } else if(credentials_.Contains(target)) {
+                        // 目标已注册但不在线：落盘到离线信箱后才回执，期间暂停解析后续帧
+                        conn->storePending = true;
+                        mailbox_.Append(target, username, body, [this, conn, username, target, body, startUs](OfflineMailbox::Result result) {
+                            Metrics::Record(Metrics::kStoreLatency, Metrics::NowUs() - startUs);
+                            Metrics::Increment(result == OfflineMailbox::kOk ? Metrics::kForwardStored : Metrics::kForwardRejected);
+                            if(result == OfflineMailbox::kOk) {
+                                history_.Append(username, target, body);
+                                // 写入期间目标可能刚好登录并已取完信箱，补一次取信
+                                std::shared_ptr<ClientConnection> targetConn = online_.Find(target);
+                                if(targetConn) {
+                                    targetConn->reactor->loop->RunInLoop([this, targetConn]() { DrainMailbox(targetConn); });
+                                }
                             }
-                            totalsend += send_len;
-                        }
-                        std::string msg = "forward success";
-                        std::vector<char> returnMsg = GenerateReturnMsg(msg);
-                        std::lock_guard<std::mutex> lock(conn->sendMutex);
-                        conn->sendQueue.push(returnMsg);
+                            CompleteInLoop(conn, [this, conn, target, result]() {
+                                if(result == OfflineMailbox::kOk) {
+                                    SendMessage(conn, forwardSuccess);
+                                } else if(result == OfflineMailbox::kFull) {
+                                    SendMessage(conn, GenerateReturnMsg("用户" + target + "的离线消息已满"));
+                                } else {
+                                    SendMessage(conn, GenerateReturnMsg("用户" + target + "不在线"));
+                                }
+                            });
+                        });
                     } else {
-                        // 如果目标客户端不在线，回馈给发送者提示
+                        // 如果目标客户端不存在，回馈给发送者提示
+                        Metrics::Increment(Metrics::kForwardRejected);
                         std::string err = "用户" + target + "不在线";
-                        std::vector<char> returnMsg = GenerateReturnMsg(err);
-                        std::lock_guard<std::mutex> lock(conn->sendMutex);
-                        conn->sendQueue.push(returnMsg);
+                        SendMessage(conn, GenerateReturnMsg(err));
                     }
                 } else {
                     // 收到其它格式消息，可选择进行处理或忽略
-                    std::cout << "客户端[" << username << "]发送未知格式消息: " << msg << std::endl;
-                    FlushSocketBuffer(conn->fd);
+                    // 只丢弃这一帧，之后已缓冲的帧照常解析
+                    LOG_INFO << "客户端[" << username << "]发送未知格式消息: " << msg;
                 }
             }
             break;
+        case MessageType::room_msg:
+            {
+                SendRoomMessage(conn, payload);
+            }
+            break;
         case MessageType::instruction:
             {
-                uint32_t type;
-                ret = read(conn->fd, &type, 4);
-                if(ret != 4) {
-                    std::cerr << "read instruction type failed" << std::endl;
-                    FlushSocketBuffer(conn->fd);
-                    exitLoop = true;
-                    return;
-                }
-                switch(static_cast<InstructionType>(type)) {
+                switch(static_cast<InstructionType>(instruction)) {
                     case InstructionType::logout:
                         {
-                            std::cout << "收到[" << username << "]退出请求" << std::endl;
+                            LOG_INFO << "收到[" << username << "]退出请求";
                             exitLoop = true;
                             return;
                         }
                         break;
                     case InstructionType::delete_self:
                         {
-                            // 构造 SQL 语句，删除当前用户记录
-                            std::string delete_sql = "DELETE FROM users WHERE username = '" + username + "';";
-                            char* errMsg = nullptr;
-                            int rc = sqlite3_exec(db_, delete_sql.c_str(), nullptr, nullptr, &errMsg);
-                            if(rc != SQLITE_OK) {
-                                std::cerr << "删除用户[" << username << "]失败: " << errMsg << std::endl;
-                                sqlite3_free(errMsg);
-                                std::vector<char> returnMsg = GenerateReturnMsg("delete failed");
-                                std::lock_guard<std::mutex> lock(conn->sendMutex);
-                                conn->sendQueue.push(returnMsg);
-                            } else {
-                                std::cout << "成功删除用户[" << username << "]" << std::endl;
-                                std::vector<char> returnMsg = GenerateReturnMsg("delete success");
-                                std::lock_guard<std::mutex> lock(conn->sendMutex);
-                                conn->sendQueue.push(returnMsg);
-                            }
-                            exitLoop = true; // 跳出while循环
+                            // 删除当前用户记录，发送完回执后断开连接
+                            conn->storePending = true;
+                            int64_t startUs = Metrics::NowUs();
+                            store_.DeleteUser(username, [this, conn, username, startUs](UserStore::Result result) {
+                                Metrics::Record(Metrics::kStoreLatency, Metrics::NowUs() - startUs);
+                                if(result == UserStore::kOk) {
+                                    credentials_.Erase(username);
+                                    mailbox_.Purge(username, nullptr);
+                                    history_.Purge(username);
+                                    size_t rooms = rooms_.RemoveUser(username);
+                                    if(rooms > 0) LOG_INFO << "用户[" << username << "]已移出 " << rooms << " 个聊天室";
+                                }
+                                CompleteInLoop(conn, [this, conn, result]() {
+                                    if(result == UserStore::kOk) {
+                                        LOG_INFO << "成功删除用户[" << conn->username << "]";
+                                        SendMessage(conn, GenerateReturnMsg("delete success"));
+                                    } else {
+                                        SendMessage(conn, GenerateReturnMsg("delete failed"));
+                                    }
+                                    conn->closeAfterFlush = true;
+                                    FlushSendQueue(conn);
+                                });
+                            });
                             return;
                         }
                         break;
                     case InstructionType::change_password:
                         {
-                            // 构造 SQL 语句，更新当前用户密码
-                            uint32_t netDataLength;
-                            ret = read(conn->fd, &netDataLength, 4);
-                            if(ret != 4) {
-                                std::cerr << "read netDataLength failed" << std::endl;
-                                FlushSocketBuffer(conn->fd);
-                                exitLoop = true;
-                                return;
-                            }
-                            uint32_t dataLength = ntohl(netDataLength);
-                            std::vector<char> payload(dataLength);
-                            size_t totalRead = 0;
-                            while(totalRead < dataLength) {
-                                ssize_t n = read(conn->fd, payload.data() + totalRead, dataLength - totalRead);
-                                if(n <= 0) break;
-                                totalRead += n;
-                            }
-                            if(totalRead != dataLength) {
-                                std::cerr << "data read incomplete" << std::endl;
-                                FlushSocketBuffer(conn->fd);
-                                exitLoop = true;
-                                return;
-                            }
-                            std::string password(payload.begin(), payload.end());
-                            size_t pos = password.find("|");
+                            // 更新当前用户密码
                             std::string old_password;
                             std::string new_password;
-                            if(pos != std::string::npos) {
-                                old_password = password.substr(0, pos);
-                                new_password = password.substr(pos + 1);
-                            }
-
-                            std::string get_old_password_sql = "SELECT password FROM users WHERE username = '" + username + "';";
-                            sqlite3_stmt* stmt = nullptr;
-                            int rc = sqlite3_prepare_v2(db_, get_old_password_sql.c_str(), -1, &stmt, nullptr);
-                            if(rc != SQLITE_OK) {
-                                std::cerr << "获取旧密码失败: " << sqlite3_errmsg(db_) << std::endl;
-                                std::vector<char> returnMsg = GenerateReturnMsg("change password failed");
-                                std::lock_guard<std::mutex> lock(conn->sendMutex);
-                                conn->sendQueue.push(returnMsg);
+                            ParsePair(*conn, payload, kPasswordOld, kPasswordNew, old_password, new_password);
+                            if(!CredentialValidator::IsValidPassword(new_password)) {
+                                SendMessage(conn, GenerateReturnMsg("new password invalid"));
                                 return;
                             }
-                            std::regex passwordRegex("^[A-Za-z0-9]+$");
-                            if(!std::regex_match(new_password, passwordRegex)) {
-                                std::vector<char> returnMsg = GenerateReturnMsg("new password invalid");
-                                std::lock_guard<std::mutex> lock(conn->sendMutex);
-                                conn->sendQueue.push(returnMsg);
-                                sqlite3_finalize(stmt);
+                            std::string stored;
+                            if(!credentials_.Lookup(username, stored)) {
+                                SendMessage(conn, GenerateReturnMsg("change password failed"));
                                 return;
                             }
-                            if(sqlite3_step(stmt) == SQLITE_ROW) {
-                                if(old_password == reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))) {
-                                    std::string update_sql = "UPDATE users SET password = '" + new_password + "' WHERE username = '" + username + "';";
-                                    char* errMsg = nullptr;
-                                    rc = sqlite3_exec(db_, update_sql.c_str(), nullptr, nullptr, &errMsg);
-                                    if(rc != SQLITE_OK) {
-                                        std::cerr << "更新密码失败: " << errMsg << std::endl;
-                                        sqlite3_free(errMsg);
-                                        std::vector<char> returnMsg = GenerateReturnMsg("change password failed");
-                                        std::lock_guard<std::mutex> lock(conn->sendMutex);
-                                        conn->sendQueue.push(returnMsg);
-                                    } else {
-                                        std::cout << "密码更新成功: " << username << std::endl;
-                                        std::vector<char> returnMsg = GenerateReturnMsg("change password success");
-                                        std::lock_guard<std::mutex> lock(conn->sendMutex);
-                                        conn->sendQueue.push(returnMsg);
-                                    }
-                                } else {
-                                    std::vector<char> returnMsg = GenerateReturnMsg("old password error");
-                                    std::lock_guard<std::mutex> lock(conn->sendMutex);
-                                    conn->sendQueue.push(returnMsg);
-                                    sqlite3_finalize(stmt);
+                            // 在哈希线程池上校验旧密码并计算新的存储值，存储层按比较并替换更新
+                            bool queued = SubmitPasswordTask(conn, [this, conn, username, old_password, new_password, stored]() {
+                                bool needsRehash = false;
+                                if(!PasswordHasher::Verify(old_password, stored, options_.passwordIterations, needsRehash)) {
+                                    CompleteInLoop(conn, [this, conn]() { SendMessage(conn, GenerateReturnMsg("old password error")); });
                                     return;
                                 }
-                            }
-                            sqlite3_finalize(stmt);
+                                std::string replacement = PasswordHasher::Hash(new_password, options_.passwordIterations);
+                                if(replacement.empty()) {
+                                    CompleteInLoop(conn, [this, conn]() { SendMessage(conn, GenerateReturnMsg("change password failed")); });
+                                    return;
+                                }
+                                int64_t startUs = Metrics::NowUs();
+                                store_.UpdatePassword(username, stored, replacement, [this, conn, username, replacement, startUs](UserStore::Result result) {
+                                    Metrics::Record(Metrics::kStoreLatency, Metrics::NowUs() - startUs);
+                                    if(result == UserStore::kOk) credentials_.Put(username, replacement);
+                                    CompleteInLoop(conn, [this, conn, result]() {
+                                        if(result == UserStore::kOk) {
+                                            LOG_INFO << "密码更新成功: " << conn->username;
+                                            SendMessage(conn, GenerateReturnMsg("change password success"));
+                                        } else {
+                                            // 包括校验期间存储值被并发修改（kWrongPassword）
+                                            SendMessage(conn, GenerateReturnMsg("change password failed"));
+                                        }
+                                    });
+                                });
+                            });
+                            if(!queued) SendMessage(conn, GenerateReturnMsg("change password failed"));
                         }
                         break;
                     case InstructionType::get_all_user:
                         {
-                            std::string get_all_user_sql = "SELECT username FROM users;";
-                            sqlite3_stmt* stmt = nullptr;
-                            int rc = sqlite3_prepare_v2(db_, get_all_user_sql.c_str(), -1, &stmt, nullptr);
-                            std::string all_user = "all_user:";
-                            if(rc == SQLITE_OK) {
-                                while(sqlite3_step(stmt) == SQLITE_ROW) {
-                                    all_user += std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))) + "|";
+                            conn->storePending = true;
+                            int64_t startUs = Metrics::NowUs();
+                            store_.ListUsers([this, conn, startUs](UserStore::Result, const std::vector<std::string> &users) {
+                                Metrics::Record(Metrics::kStoreLatency, Metrics::NowUs() - startUs);
+                                std::string all_user = "all_user:";
+                                for(auto &name : users) {
+                                    all_user += name + "|";
                                 }
-                            }
-                            sqlite3_finalize(stmt);
-                            std::vector<char> returnMsg = GenerateReturnMsg(all_user);
-                            std::lock_guard<std::mutex> lock(conn->sendMutex);
-                            conn->sendQueue.push(returnMsg);
+                                CompleteInLoop(conn, [this, conn, all_user]() {
+                                    SendMessage(conn, GenerateReturnMsg(all_user));
+                                });
+                            });
                         }
                         break;
                     case InstructionType::get_all_online_users:
                         {
                             std::string all_online_users = "all_online_users:";
-                            {
-                            std::lock_guard<std::mutex> lock(clientsMutex);
-                            for(auto &client : onlineClients) {
-                                    all_online_users += client.first + "|";
-                                }
+                            for(auto &name : online_.SnapshotNames()) {
+                                all_online_users += name + "|";
                             }
-                            std::vector<char> returnMsg = GenerateReturnMsg(all_online_users);
-                            std::lock_guard<std::mutex> lock2(conn->sendMutex);
-                            conn->sendQueue.push(returnMsg);
-                            std::cout << "all_online_users: " << all_online_users << std::endl;
+                            SendMessage(conn, GenerateReturnMsg(all_online_users));
+                            LOG_DEBUG << "all_online_users: " << all_online_users;
+                        }
+                        break;
+                    case InstructionType::subscribe_presence:
+                        {
+                            uint64_t sinceVersion = strtoull(payload.c_str(), nullptr, 10);
+                            accept_loop_->RunInLoop([this, conn, sinceVersion]() { SubscribePresence(conn, sinceVersion); });
+                        }
+                        break;
+                    case InstructionType::fetch_history:
+                        {
+                            FetchHistory(conn, payload);
+                        }
+                        break;
+                    case InstructionType::create_room:
+                    case InstructionType::join_room:
+                    case InstructionType::leave_room:
+                        {
+                            HandleRoomInstruction(conn, static_cast<InstructionType>(instruction), payload);
                         }
                         break;
                     case InstructionType::heartbeat_ACK:
                         {
-                            std::cout << "收到[" << username << "]心跳ACK" << std::endl;
+                            LOG_DEBUG << "收到[" << username << "]心跳ACK";
                         }
                         break;
                     default:
-                        std::cerr << "未知的instruction类型" << std::endl;
+                        LOG_WARN << "未知的instruction类型";
                         {
-                            std::vector<char> returnMsg = GenerateReturnMsg("unknown instruction type");
-                            std::lock_guard<std::mutex> lock(conn->sendMutex);
-                            conn->sendQueue.push(returnMsg);
-                            FlushSocketBuffer(conn->fd);
+                            SendMessage(conn, GenerateReturnMsg("unknown instruction type"));
                         }
                         break;
                 }
             }
             break;
         default:
-            std::cerr << "未知的消息类型" << std::endl;
-            std::vector<char> returnMsg = GenerateReturnMsg("unknown message type");
-            {
-                std::lock_guard<std::mutex> lock(conn->sendMutex);
-                conn->sendQueue.push(returnMsg);
-            }
-            FlushSocketBuffer(conn->fd);
+            LOG_WARN << "未知的消息类型";
+            SendMessage(conn, GenerateReturnMsg("unknown message type"));
             break;
     }
 }
 
-void Serve::HandleInitialConnection(int client_fd) {
-    // 设置接收超时机制，读取超时设为5秒
-    struct timeval tv;
-    tv.tv_sec = 5;
-    tv.tv_usec = 0;
-    if (setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-         perror("setsockopt: SO_RCVTIMEO");
-    }
-
-    uint8_t msgTypeByte;
-    ssize_t ret = read(client_fd, &msgTypeByte, 1);
-    if(ret != 1) {
-        if(ret < 0)
-            perror("read msgTypeByte timeout or error");
-        else
-            std::cerr << "read msgTypeByte timeout" << std::endl;
-        FlushSocketBuffer(client_fd);
-        close(client_fd);
-        return;
-    }
-    MessageType msgType = static_cast<MessageType>(msgTypeByte);
-
-    uint32_t netDataLength;
-    ret = read(client_fd, &netDataLength, 4);
-    if(ret != 4) {
-        std::cerr << "read netDataLength failed in HandleInitialConnection" << std::endl;
-        close(client_fd);
-        return;
-    }
-    uint32_t dataLength = ntohl(netDataLength);
-
-    std::vector<char> payload(dataLength);
-    size_t totalRead = 0;
-    while(totalRead < dataLength) {
-        ssize_t n = read(client_fd, payload.data() + totalRead, dataLength - totalRead);
-        if(n <= 0)
-            break;
-        totalRead += n;
-    }
-    if(totalRead != dataLength) {
-        std::cerr << "data read incomplete in HandleInitialConnection" << std::endl;
-        close(client_fd);
-        return;
-    }
-    std::string dataStr(payload.begin(), payload.end());
-    std::cout << "dataStr: " << dataStr << std::endl;
-    // 调用原有的消息处理逻辑
-    HandleMessage(msgType, dataStr, client_fd);
-}
-
-void Serve::BroadcastNotification(const std::vector<char> &notification) {
-    std::lock_guard<std::mutex> lock(clientsMutex);
-    for (auto &pair : onlineClients) {
-        auto conn = pair.second;
-        {
-            std::lock_guard<std::mutex> lock2(conn->sendMutex);
-            conn->sendQueue.push(notification);
-        }
-        conn->cv.notify_one();
-    }
-}
\ No newline at end of file
@@ -3,41 +3,141 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <sqlite3.h>
 #include "ChatApperro.h"
+#include "protocol.h"
+#include "eventloop.h"
+#include "framedecoder.h"
+#include "outputbuffer.h"
+#include "frame.h"
+#include "onlineregistry.h"
+#include "presenceaggregator.h"
+#include "presencefeed.h"
+#include "userstore.h"
+#include "credentialcache.h"
+#include "offlinemailbox.h"
+#include "historystore.h"
+#include "roomregistry.h"
+#include "handoffchannel.h"
+#include "passwordhasher.h"
+#include "workerpool.h"
+#include "ratelimiter.h"
 #include <fcntl.h>
-#include <queue>
+#include <atomic>
 #include <mutex>
-#include <condition_variable>
+#include <thread>
 #include <unordered_map>
+#include <sys/socket.h>
+
+struct Reactor;
 
 struct ClientConnection {
+    ClientConnection(size_t sendHighWaterMark, size_t sendQueueCapacity, size_t maxFrameSize)
+        : decoder(4096, maxFrameSize), output(sendHighWaterMark, sendQueueCapacity) {}
+
     int fd; // 客户端 socket 描述符
-    std::mutex sendMutex; // 保护发送队列的互斥锁
-    std::queue<std::vector<char>> sendQueue; // 待发送的消息队列
-    std::condition_variable cv; // 通知等待发送线程新的消息到来
+    Reactor* reactor; // 所属的反应器，所有读写都在其循环线程中完成
+    std::string username; // 登录成功后设置，为空表示仍处于握手阶段
+    std::string peerAddress; // 来源 IPv4 地址的 4 个原始字节，按地址限流的键；取不到时为空
+    FrameDecoder decoder; // 已读取但尚未解析的数据，仅由循环线程访问
+    uint8_t wireVersion = 0; // 握手时协商的二进制载荷版本，0 表示旧的 '|' 分隔文本载荷
+    OutputBuffer output; // 待发送的消息帧，任意线程追加，循环线程合并写出
+    int64_t lastActiveMs = 0; // 最近一次收到数据的时间（单调时钟毫秒）
+    int64_t heartbeatSentMs = 0; // 发送 heartbeat 的时间，0 表示当前未发送
+    TimerWheel::TimerHandle timer; // 握手超时或心跳定时器，同一时刻只有一个
+    bool closeAfterFlush = false; // 发送队列清空后关闭连接
+    std::atomic<bool> closed{false}; // 其他线程投递消息前会检查
+    bool presenceSubscribed = false; // 已订阅在线状态增量，仅主循环线程访问
+    bool storePending = false; // 存储层请求尚未完成，期间暂停解析后续帧以保持回复顺序，仅循环线程访问
+    bool readPaused = false; // 暂停解析期间已缓冲足够数据，停止从套接字读取，恢复解析后再读，仅循环线程访问
+    // 离线消息补发状态，仅循环线程访问
+    uint64_t mailboxSeq = 0; // 已写入发送队列的最后一条离线消息序号，下次取信时作为送达确认
+    bool mailboxDraining = false; // 正在分批补发
+    bool mailboxDirty = false; // 补发期间又有新的离线消息，结束后再取一轮
+    // io_uring 后端的收发状态，仅循环线程访问
+    bool recvArmed = false; // 多发 recv 尚未结束（排空时取消，结束后才能交接）
+    bool sendInFlight = false; // 有一条发送链在途，完成前不再提交新的发送
 };
 
-enum class MessageType {
-    login = 0,
-    register_user = 1,
-    forward_msg = 2,
-    instruction = 3,
-    return_msg = 4
+struct ServeOptions {
+    int port = 4567;
+    int ioThreads = 0; // I/O 事件循环线程数，0 表示使用 CPU 核数
+    int backlog = SOMAXCONN; // listen() 的全连接队列长度
+    // 为每个反应器创建独立的 SO_REUSEPORT 监听套接字，由内核在各核之间分摊新连接
+    bool reusePort = false;
+    // 心跳参数（秒）：空闲超过 heartbeatIdleSeconds 发送 heartbeat，发送后 heartbeatAckTimeoutSeconds 内无响应则断开
+    int heartbeatIdleSeconds = 5;
+    int heartbeatAckTimeoutSeconds = 20;
+    // 握手阶段（登录/注册消息）的读取超时（秒）
+    int handshakeTimeoutSeconds = 5;
+    // 单个连接排队待发送字节数的高水位；超过后视为慢消费者
+    size_t sendHighWaterMark = 4 * 1024 * 1024;
+    // 单个消息帧数据部分的最大字节数，超过视为协议错误并断开
+    size_t maxFrameBytes = 1024 * 1024;
+    // 单个连接无锁发送队列的槽数，向上取 2 的幂；积压更多帧时改走加锁的溢出队列，不算慢消费者
+    size_t sendQueueCapacity = 256;
+    // 慢消费者处理方式：true 断开连接，false 丢弃新消息
+    bool disconnectSlowConsumer = true;
+    // 注册用户总数上限
+    int maxUsers = 20;
+    // 账号变更组提交的合并窗口（毫秒），窗口内到达的注册/改密/注销合并为一个事务提交
+    int storeBatchWindowMs = 2;
+    // 口令哈希（PBKDF2-HMAC-SHA256）的迭代次数；明文或迭代次数不同的存储值在下次登录成功时重新哈希
+    int passwordIterations = PasswordHasher::kDefaultIterations;
+    // 口令哈希工作线程数（0 表示 CPU 核数的一半，至少 1）与排队上限，队满时注册/登录/改密回复繁忙
+    int passwordThreads = 0;
+    size_t passwordQueueLimit = 1024;
+    // 令牌桶限流（每秒补充的令牌数与桶容量）：已登录的请求按用户名计，握手与已登录的请求同时按来源地址计。
+    // 一般请求 1 个令牌，查询整张用户表或聊天记录的请求更多，心跳确认与退出不计；速率为 0 表示不限。
+    // 同一地址后面可能是 NAT 或负载生成器，按地址限流默认关闭
+    double userRequestRate = 100;
+    double userRequestBurst = 200;
+    double addressRequestRate = 0;
+    double addressRequestBurst = 400;
+    // 握手帧（登录/注册）另按来源地址单独限流，默认开启：每个握手帧都要排一次口令哈希，
+    // 不限时单个客户端反复重连即可占满哈希队列，让所有人的登录失败
+    double handshakeRequestRate = 20;
+    double handshakeRequestBurst = 40;
+    // 在线用户表的条带数
+    size_t onlineShards = 64;
+    // 上线/下线通知的合并窗口（毫秒），窗口内的变化合并为一个 presence_delta 帧；0 表示下一轮循环立即发布
+    int presenceWindowMs = 200;
+    // 保留的在线状态增量个数，订阅者落后更多时改发快照；应小于 sendQueueCapacity，补发时不必走溢出队列
+    size_t presenceHistory = 64;
+    // 单个用户最多保存的离线消息条数，超过后拒收并提示发送者
+    size_t mailboxLimit = 1000;
+    // 登录后补发离线消息时每批的条数；上一批写入内核后才取下一批
+    size_t mailboxBatch = 64;
+    // 单次拉取聊天记录的最大条数与最大正文字节数
+    size_t historyPageLimit = 200;
+    size_t historyPageBytes = 256 * 1024;
+    // 单个聊天室的成员数上限
+    size_t maxRoomMembers = 4096;
+    // 热重启交接通道（Unix 域套接字路径），新进程连接后本进程排空并交出监听套接字与在线连接；空串表示不启用
+    std::string handoffPath = "ChatServe.handoff";
+    // 启动时先从 handoffPath 上的旧进程接管监听套接字与在线连接
+    bool takeover = false;
+    // 交接前等待在途请求完成、发送队列写空的最长时间（毫秒），超时仍未排空的连接直接关闭
+    int drainTimeoutMs = 5000;
+    // restart() 启动新进程的命令行（可执行文件绝对路径 + 参数，应包含 --takeover）；收到 SIGUSR2 时同样触发
+    std::vector<std::string> restartCommand;
+    // Prometheus 文本格式的指标导出端口，只监听 127.0.0.1；0 表示不启用
+    int metricsPort = 9567;
+    // 网络 I/O 后端；kUring 在内核不支持时退回 epoll
+    EventLoop::Backend ioBackend = EventLoop::kEpoll;
 };
 
-enum class InstructionType {
-    delete_self = 0,
-    change_password = 1,
-    get_all_user = 2,
-    get_all_online_users = 3,
-    heartbeat_ACK = 4,
-    logout = 5
+// 一个 I/O 反应器：一个事件循环线程及其名下的所有连接
+struct Reactor {
+    std::unique_ptr<EventLoop> loop;
+    std::thread thread;
+    int listenFd = -1; // reusePort 模式下本反应器独占的监听套接字
+    std::unordered_map<int, std::shared_ptr<ClientConnection>> connections; // 仅在循环线程访问
 };
 
 class Serve {
 public:
     Serve();
+    explicit Serve(const ServeOptions &options);
     ~Serve();
 
     void start();
@@ -45,13 +145,105 @@ public:
     void restart();
 
 private:
+    ServeOptions options_;
     int listen_port_;
-    sqlite3* db_;
-
-    void HandleMessage(MessageType msgType, std::string& dataStr, int client_fd);
-    void HandleClient(std::shared_ptr<ClientConnection> conn, const std::string &username);
-    void HandleInitialConnection(int client_fd);
-    std::vector<char> GenerateReturnMsg(const std::string &msg);
-    void HandleClientMessage(std::shared_ptr<ClientConnection> conn, uint8_t msgTypeByte, const std::string &username, bool &exitLoop);
-    void BroadcastNotification(const std::vector<char> &notification);
-};
\ No newline at end of file
+    int listen_fd_;
+    UserStore store_; // 用户存储层，所有数据库访问在其专用线程上进行
+    CredentialCache credentials_; // 内存账号表，登录时只在这里取口令存储值
+    WorkerPool password_pool_; // 口令哈希与校验，不占用 I/O 线程与数据库线程
+    OfflineMailbox mailbox_; // 离线消息信箱，读写在其专用线程上进行
+    HistoryStore history_; // 聊天记录，读写在其专用线程上进行
+    std::unique_ptr<EventLoop> accept_loop_;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    size_t next_reactor_;
+    OnlineRegistry online_; // 在线用户表：用户名 -> 连接
+    RoomRegistry rooms_; // 聊天室成员表
+    PresenceAggregator presence_; // 上线/下线合并器
+    PresenceFeed presence_feed_; // 带版本号的在线状态订阅源，仅主循环线程访问
+    RateLimiter user_limits_; // 按用户名的请求令牌桶
+    RateLimiter address_limits_; // 按来源地址的请求令牌桶
+    RateLimiter handshake_limits_; // 按来源地址的握手帧令牌桶
+    int handoff_fd_; // 交接通道的监听套接字
+    int signal_fd_; // SIGUSR2 触发热重启
+    std::atomic<bool> draining_; // 正在为交接排空：停止接受新连接、不再解析新的请求
+    std::atomic<size_t> draining_reactors_; // 尚未排空的反应器数
+    std::atomic<size_t> adopting_; // 尚未登记完的接管连接数，全部登记后才发布接管带来的在线状态变化
+    std::unique_ptr<HandoffChannel> successor_; // 已连接的新进程
+    int metrics_fd_; // 指标导出的监听套接字
+    std::unordered_map<int, std::pair<int64_t, std::string>> metrics_clients_; // fd -> (接入时间, 已读请求)，仅主循环线程访问
+
+    // 从旧进程接管的连接，启动后分配给各反应器
+    struct AdoptedConnection {
+        int fd;
+        std::string username; // 为空表示仍处于握手阶段
+        uint8_t wireVersion;
+        bool presenceSubscribed;
+        std::string input; // 旧进程已读取但尚未解析的数据
+    };
+
+    int CreateListenSocket();
+    int TakeListenSocket(std::vector<int> &inherited);
+    void HandleAccept(int listenFd, Reactor *owner);
+    void DispatchConnection(int client_fd, Reactor *owner);
+    void OnNewConnection(Reactor *reactor, int client_fd, int64_t acceptedUs);
+    std::shared_ptr<ClientConnection> RegisterConnection(Reactor *reactor, int client_fd);
+    void HandleConnectionEvent(std::shared_ptr<ClientConnection> conn, uint32_t events);
+    void HandleRead(std::shared_ptr<ClientConnection> conn);
+    void HandleRecv(std::shared_ptr<ClientConnection> conn, const char *data, ssize_t n);
+    bool InputPaused(const ClientConnection &conn) const;
+    void ArmRecv(std::shared_ptr<ClientConnection> conn);
+    void ResumeRead(std::shared_ptr<ClientConnection> conn);
+    void OnPeerActive(std::shared_ptr<ClientConnection> conn);
+    void OnPeerClosed(std::shared_ptr<ClientConnection> conn);
+    void ProcessInput(std::shared_ptr<ClientConnection> conn);
+    bool AllowRequest(std::shared_ptr<ClientConnection> conn, double cost, bool handshake);
+    void RejectRateLimited(std::shared_ptr<ClientConnection> conn, MessageType msgType);
+    void SweepRateLimits();
+    void OnHandshakeTimeout(std::weak_ptr<ClientConnection> weakConn);
+    void OnHeartbeatTimer(std::weak_ptr<ClientConnection> weakConn);
+    void ArmHeartbeatTimer(std::shared_ptr<ClientConnection> conn, int64_t delayMs);
+    void CloseConnection(std::shared_ptr<ClientConnection> conn);
+
+    // 热重启：新进程一侧
+    bool TakeOver(std::vector<int> &listenFds, std::vector<AdoptedConnection> &adopted);
+    void AdoptConnection(Reactor *reactor, const AdoptedConnection &state);
+    // 热重启：旧进程一侧
+    void OnHandoffRequest();
+    void BeginDrain(Reactor *reactor);
+    void CheckDrained(Reactor *reactor, int64_t deadlineMs);
+    void FinishHandoff();
+    bool SendHandoffState();
+
+    void OnPresenceChange(const std::string &username, bool online);
+    void FlushPresence();
+    void SubscribePresence(std::shared_ptr<ClientConnection> conn, uint64_t sinceVersion);
+
+    void DrainMailbox(std::shared_ptr<ClientConnection> conn);
+    void FetchMailbox(std::shared_ptr<ClientConnection> conn);
+    void OnMailboxBatch(std::shared_ptr<ClientConnection> conn, OfflineMailbox::Result result,
+                        const std::vector<OfflineMailbox::Message> &messages);
+    void WaitMailboxFlushed(std::weak_ptr<ClientConnection> weakConn);
+
+    void FetchHistory(std::shared_ptr<ClientConnection> conn, const std::string &payload);
+    void HandleRoomInstruction(std::shared_ptr<ClientConnection> conn, InstructionType instruction, const std::string &room);
+    void SendRoomMessage(std::shared_ptr<ClientConnection> conn, const std::string &payload);
+
+    int CreateMetricsSocket();
+    void HandleMetricsAccept();
+    void HandleMetricsRequest(int fd);
+    void CloseMetricsClient(int fd);
+    std::string RenderMetrics();
+
+    void SendMessage(std::shared_ptr<ClientConnection> conn, const Frame &msg);
+    void FlushSendQueue(std::shared_ptr<ClientConnection> conn);
+    void OnSendComplete(std::shared_ptr<ClientConnection> conn, ssize_t sent);
+    void SendAndClose(std::shared_ptr<ClientConnection> conn, const std::string &msg);
+    void OnLoginChecked(std::shared_ptr<ClientConnection> conn, const std::string &username, UserStore::Result result);
+    void CompleteInLoop(std::shared_ptr<ClientConnection> conn, std::function<void()> fn);
+    bool SubmitPasswordTask(std::shared_ptr<ClientConnection> conn, std::function<void()> task);
+    void MigratePassword(const std::string &username, const std::string &password, const std::string &stored);
+
+    void HandleMessage(MessageType msgType, std::string& dataStr, std::shared_ptr<ClientConnection> conn);
+    Frame GenerateReturnMsg(const std::string &msg);
+    void HandleClientMessage(std::shared_ptr<ClientConnection> conn, MessageType msgType, uint32_t instruction, const std::string &payload, bool &exitLoop);
+};
@@ -0,0 +1,109 @@
+#include "timerwheel.h"
+
+TimerWheel::TimerWheel(int tickMs)
+    : tick_ms_(tickMs > 0 ? tickMs : 1),
+      start_ms_(-1),
+      current_tick_(0),
+      count_(0)
+{
+}
+
+uint64_t TimerWheel::TickOf(int64_t nowMs) const
+{
+    if(start_ms_ < 0 || nowMs <= start_ms_) return 0;
+    return static_cast<uint64_t>((nowMs - start_ms_) / tick_ms_);
+}
+
+TimerWheel::TimerHandle TimerWheel::Add(int64_t nowMs, int64_t delayMs, Callback cb)
+{
+    if(start_ms_ < 0) start_ms_ = nowMs;
+    // 空闲期间时间轮不会被推进，插入前先对齐当前时间
+    if(count_ == 0) current_tick_ = TickOf(nowMs);
+
+    // 向上取整，至少一个 tick 之后触发
+    int64_t ticks = (delayMs + tick_ms_ - 1) / tick_ms_;
+    if(ticks < 1) ticks = 1;
+
+    TimerHandle timer = std::make_shared<Timer>();
+    timer->expireTick = TickOf(nowMs) + static_cast<uint64_t>(ticks);
+    timer->callback = std::move(cb);
+    timer->cancelled = false;
+    Place(timer);
+    ++count_;
+    return timer;
+}
+
+void TimerWheel::Cancel(const TimerHandle &timer)
+{
+    // 惰性删除：槽位推进到时直接丢弃
+    if(timer) {
+        timer->cancelled = true;
+        timer->callback = nullptr;
+    }
+}
+
+void TimerWheel::Place(const TimerHandle &timer)
+{
+    uint64_t expire = timer->expireTick < current_tick_ ? current_tick_ : timer->expireTick;
+    uint64_t delta = expire - current_tick_;
+    for(int level = 0; level < kLevels; ++level) {
+        uint64_t span = 1ULL << (kLevelBits * (level + 1));
+        if(delta < span || level == kLevels - 1) {
+            if(delta >= span) {
+                // 超出最大范围的定时器放在最高层最远的槽中，等待逐层下放
+                expire = current_tick_ + span - 1;
+            }
+            int idx = static_cast<int>((expire >> (kLevelBits * level)) & (kSlots - 1));
+            slots_[level][idx].push_back(timer);
+            return;
+        }
+    }
+}
+
+void TimerWheel::Cascade(int level)
+{
+    int idx = static_cast<int>((current_tick_ >> (kLevelBits * level)) & (kSlots - 1));
+    std::vector<TimerHandle> timers;
+    timers.swap(slots_[level][idx]);
+    for(auto &timer : timers) {
+        if(timer->cancelled) {
+            --count_;
+            continue;
+        }
+        Place(timer);
+    }
+}
+
+void TimerWheel::Advance(int64_t nowMs)
+{
+    uint64_t target = TickOf(nowMs);
+    if(count_ == 0) {
+        current_tick_ = target;
+        return;
+    }
+    while(current_tick_ < target && count_ > 0) {
+        ++current_tick_;
+        // 低层转满一圈时，自高向低把上层对应槽中的定时器下放
+        for(int level = kLevels - 1; level > 0; --level) {
+            uint64_t mask = (1ULL << (kLevelBits * level)) - 1;
+            if((current_tick_ & mask) == 0) Cascade(level);
+        }
+        std::vector<TimerHandle> expired;
+        expired.swap(slots_[0][current_tick_ & (kSlots - 1)]);
+        for(auto &timer : expired) {
+            --count_;
+            if(timer->cancelled) continue;
+            Callback cb = std::move(timer->callback);
+            timer->cancelled = true;
+            if(cb) cb();
+        }
+    }
+    if(count_ == 0) current_tick_ = target;
+}
+
+int64_t TimerWheel::MsUntilNextTick(int64_t nowMs) const
+{
+    if(start_ms_ < 0) return tick_ms_;
+    int64_t next = start_ms_ + static_cast<int64_t>(current_tick_ + 1) * tick_ms_;
+    return next > nowMs ? next - nowMs : 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// 分层时间轮：共 kLevels 层，每层 kSlots 个槽，最底层一个槽代表一个 tick。
+// 插入、取消均为 O(1)，每个 tick 只处理到期槽中的定时器，与定时器总数无关。
+// 非线程安全，由所属事件循环线程独占使用。
+class TimerWheel {
+public:
+    typedef std::function<void()> Callback;
+
+    struct Timer {
+        uint64_t expireTick;
+        Callback callback;
+        bool cancelled;
+    };
+    typedef std::shared_ptr<Timer> TimerHandle;
+
+    explicit TimerWheel(int tickMs);
+
+    // 在 delayMs 毫秒后执行 cb，返回的句柄可用于取消
+    TimerHandle Add(int64_t nowMs, int64_t delayMs, Callback cb);
+    static void Cancel(const TimerHandle &timer);
+
+    // 推进时间轮到 nowMs，依次执行所有到期的定时器
+    void Advance(int64_t nowMs);
+
+    size_t Size() const { return count_; }
+    int TickMs() const { return tick_ms_; }
+    // 距离下一个 tick 的毫秒数，用作 epoll_wait 的超时
+    int64_t MsUntilNextTick(int64_t nowMs) const;
+
+private:
+    static const int kLevelBits = 6;
+    static const int kSlots = 1 << kLevelBits;
+    static const int kLevels = 4;
+
+    void Place(const TimerHandle &timer);
+    void Cascade(int level);
+    uint64_t TickOf(int64_t nowMs) const;
+
+    int tick_ms_;
+    int64_t start_ms_;
+    uint64_t current_tick_;
+    size_t count_;
+    std::vector<TimerHandle> slots_[kLevels][kSlots];
+};
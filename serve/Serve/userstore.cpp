@@ -0,0 +1,306 @@
+#include "userstore.h"
+#include "logger.h"
+#include <future>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+namespace {
+
+const char *kStatementSql[] = {
+    "SELECT COUNT(*) FROM users;",
+    "INSERT INTO users (username, password) VALUES (?1, ?2);",
+    "UPDATE users SET password = ?2 WHERE username = ?1 AND password = ?3;",
+    "DELETE FROM users WHERE username = ?1;",
+    "SELECT username FROM users;",
+    "SELECT username, password FROM users;"
+};
+
+// 语句用完后复位并清除绑定，以便下次复用
+class StatementScope {
+public:
+    explicit StatementScope(sqlite3_stmt *stmt) : stmt_(stmt) {}
+    ~StatementScope()
+    {
+        sqlite3_reset(stmt_);
+        sqlite3_clear_bindings(stmt_);
+    }
+    sqlite3_stmt *get() const { return stmt_; }
+    void Bind(int index, const std::string &value)
+    {
+        sqlite3_bind_text(stmt_, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+    }
+
+private:
+    sqlite3_stmt *stmt_;
+};
+
+} // namespace
+
+UserStore::UserStore()
+    : db_(nullptr),
+      max_users_(0),
+      batch_window_ms_(0),
+      stopping_(false)
+{
+    for(int i = 0; i < kStatementCount; ++i) statements_[i] = nullptr;
+}
+
+UserStore::~UserStore()
+{
+    Close();
+}
+
+bool UserStore::Open(const std::string &path, int maxUsers, int batchWindowMs)
+{
+    max_users_ = maxUsers;
+    batch_window_ms_ = batchWindowMs;
+    // 连接只在数据库线程使用，不需要 SQLite 内部的互斥
+    int rc = sqlite3_open_v2(path.c_str(), &db_,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr);
+    if(rc != SQLITE_OK) {
+        LOG_ERROR << "无法打开数据库: " << sqlite3_errmsg(db_);
+        sqlite3_close(db_);
+        db_ = nullptr;
+        return false;
+    }
+    // WAL 模式下读不阻塞写，提交只追加日志；变更已做组提交，FULL 同步级别的 fsync 由整批分摊，
+    // 回执发出时账号变更一定已经落盘
+    const char *sql_init = "PRAGMA journal_mode=WAL;"
+                           "PRAGMA synchronous=FULL;"
+                           "CREATE TABLE IF NOT EXISTS users ("
+                           "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                           "username TEXT NOT NULL UNIQUE, "
+                           "password TEXT NOT NULL, "
+                           "create_at DATETIME DEFAULT CURRENT_TIMESTAMP);";
+    char *errMsg = nullptr;
+    rc = sqlite3_exec(db_, sql_init, nullptr, nullptr, &errMsg);
+    if(rc != SQLITE_OK) {
+        LOG_ERROR << "创建表出错: " << errMsg;
+        sqlite3_free(errMsg);
+        Close();
+        return false;
+    }
+    for(int i = 0; i < kStatementCount; ++i) {
+        rc = sqlite3_prepare_v3(db_, kStatementSql[i], -1, SQLITE_PREPARE_PERSISTENT, &statements_[i], nullptr);
+        if(rc != SQLITE_OK) {
+            LOG_ERROR << "预编译语句失败: " << sqlite3_errmsg(db_);
+            Close();
+            return false;
+        }
+    }
+    stopping_ = false;
+    thread_ = std::thread([this]() { Run(); });
+    return true;
+}
+
+void UserStore::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_one();
+    if(thread_.joinable()) thread_.join();
+    for(int i = 0; i < kStatementCount; ++i) {
+        sqlite3_finalize(statements_[i]);
+        statements_[i] = nullptr;
+    }
+    if(db_) {
+        sqlite3_close(db_);
+        db_ = nullptr;
+    }
+}
+
+void UserStore::Post(std::function<Result()> run, Callback done, bool mutation)
+{
+    Task task;
+    task.run = std::move(run);
+    task.done = std::move(done);
+    task.mutation = mutation;
+    task.result = kFailed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+}
+
+bool UserStore::Exec(const char *sql)
+{
+    char *errMsg = nullptr;
+    if(sqlite3_exec(db_, sql, nullptr, nullptr, &errMsg) == SQLITE_OK) return true;
+    LOG_ERROR << "执行 " << sql << " 失败: " << errMsg;
+    sqlite3_free(errMsg);
+    return false;
+}
+
+void UserStore::Run()
+{
+    while(true) {
+        std::deque<Task> tasks;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if(tasks_.empty()) return;
+            // 有账号变更时再等一个合并窗口，把随后几毫秒内到达的变更并入同一个事务
+            bool hasMutation = std::any_of(tasks_.begin(), tasks_.end(), [](const Task &t) { return t.mutation; });
+            if(hasMutation && batch_window_ms_ > 0 && !stopping_) {
+                cond_.wait_for(lock, std::chrono::milliseconds(batch_window_ms_), [this]() { return stopping_; });
+            }
+            // 一次取走全部排队的请求，减少加锁次数
+            tasks.swap(tasks_);
+        }
+
+        size_t mutations = 0;
+        for(auto &task : tasks) {
+            if(task.mutation) ++mutations;
+        }
+        bool inTransaction = mutations > 0 && Exec("BEGIN IMMEDIATE;");
+        for(auto &task : tasks) {
+            task.result = task.run();
+        }
+        if(inTransaction) {
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            bool committed = Exec("COMMIT;");
+            int64_t commitUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+            if(!committed) {
+                // 整批回滚，本批所有变更都按失败回复
+                Exec("ROLLBACK;");
+                for(auto &task : tasks) {
+                    if(task.mutation && task.result == kOk) task.result = kFailed;
+                }
+            }
+            RecordBatch(mutations, commitUs);
+            // 每批的规模与耗时由 Stats() 汇总到指标，逐批日志只在调试构建中输出；回滚属于异常，照常告警
+            if(committed) {
+                LOG_DEBUG << "提交账号变更批次: " << mutations << " 个变更，提交耗时 " << commitUs << " us";
+            } else {
+                LOG_WARN << "账号变更批次提交失败，已回滚 " << mutations << " 个变更";
+            }
+        }
+        // 提交之后才回复
+        for(auto &task : tasks) {
+            if(task.done) task.done(task.result);
+        }
+    }
+}
+
+void UserStore::RecordBatch(size_t mutations, int64_t commitUs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.batches;
+    stats_.mutations += mutations;
+    stats_.lastBatchSize = mutations;
+    stats_.maxBatchSize = std::max(stats_.maxBatchSize, mutations);
+    stats_.lastCommitUs = commitUs;
+    stats_.maxCommitUs = std::max(stats_.maxCommitUs, commitUs);
+    stats_.totalCommitUs += commitUs;
+}
+
+UserStore::BatchStats UserStore::Stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+size_t UserStore::QueueDepth() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void UserStore::Register(const std::string &username, const std::string &password, Callback done)
+{
+    Post([this, username, password]() { return DoRegister(username, password); }, done, true);
+}
+
+void UserStore::UpdatePassword(const std::string &username, const std::string &expected,
+                               const std::string &replacement, Callback done)
+{
+    Post([this, username, expected, replacement]() {
+        return DoUpdatePassword(username, expected, replacement);
+    }, done, true);
+}
+
+void UserStore::DeleteUser(const std::string &username, Callback done)
+{
+    Post([this, username]() { return DoDeleteUser(username); }, done, true);
+}
+
+void UserStore::ListUsers(ListCallback done)
+{
+    std::shared_ptr<std::vector<std::string>> users = std::make_shared<std::vector<std::string>>();
+    Post([this, users]() { return DoListUsers(*users); },
+         [users, done](Result result) { done(result, *users); }, false);
+}
+
+UserStore::Result UserStore::ScanCredentials(const CredentialVisitor &visit)
+{
+    std::promise<Result> done;
+    std::future<Result> result = done.get_future();
+    Post([this, &visit]() {
+        StatementScope select(statements_[kSelectCredentials]);
+        int rc;
+        while((rc = sqlite3_step(select.get())) == SQLITE_ROW) {
+            const char *username = reinterpret_cast<const char*>(sqlite3_column_text(select.get(), 0));
+            const char *password = reinterpret_cast<const char*>(sqlite3_column_text(select.get(), 1));
+            visit(username, password ? password : "");
+        }
+        return rc == SQLITE_DONE ? kOk : kFailed;
+    }, [&done](Result r) { done.set_value(r); }, false);
+    return result.get();
+}
+
+UserStore::Result UserStore::DoRegister(const std::string &username, const std::string &password)
+{
+    {
+        StatementScope count(statements_[kCountUsers]);
+        if(sqlite3_step(count.get()) != SQLITE_ROW) return kFailed;
+        if(sqlite3_column_int(count.get(), 0) >= max_users_) return kLimitReached;
+    }
+    StatementScope insert(statements_[kInsertUser]);
+    insert.Bind(1, username);
+    insert.Bind(2, password);
+    int rc = sqlite3_step(insert.get());
+    if(rc == SQLITE_DONE) return kOk;
+    LOG_ERROR << "用户注册失败: " << sqlite3_errmsg(db_);
+    return rc == SQLITE_CONSTRAINT ? kExists : kFailed;
+}
+
+UserStore::Result UserStore::DoUpdatePassword(const std::string &username, const std::string &expected,
+                                              const std::string &replacement)
+{
+    StatementScope update(statements_[kUpdatePassword]);
+    update.Bind(1, username);
+    update.Bind(2, replacement);
+    update.Bind(3, expected);
+    if(sqlite3_step(update.get()) != SQLITE_DONE) {
+        LOG_ERROR << "更新密码失败: " << sqlite3_errmsg(db_);
+        return kFailed;
+    }
+    // 没有更新任何行：用户已注销，或存储值已被并发的改密/迁移替换
+    return sqlite3_changes(db_) > 0 ? kOk : kWrongPassword;
+}
+
+UserStore::Result UserStore::DoDeleteUser(const std::string &username)
+{
+    StatementScope remove(statements_[kDeleteUser]);
+    remove.Bind(1, username);
+    if(sqlite3_step(remove.get()) != SQLITE_DONE) {
+        LOG_ERROR << "删除用户[" << username << "]失败: " << sqlite3_errmsg(db_);
+        return kFailed;
+    }
+    return kOk;
+}
+
+UserStore::Result UserStore::DoListUsers(std::vector<std::string> &users)
+{
+    StatementScope select(statements_[kSelectUsers]);
+    int rc;
+    while((rc = sqlite3_step(select.get())) == SQLITE_ROW) {
+        users.push_back(reinterpret_cast<const char*>(sqlite3_column_text(select.get(), 0)));
+    }
+    return rc == SQLITE_DONE ? kOk : kFailed;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <sqlite3.h>
+
+// 用户存储层：独占一个 SQLite 连接（WAL 模式）并在专用的数据库线程上执行所有请求。
+// 每种 SQL 只在打开时预编译一次，之后按参数绑定复用；
+// 网络线程投递请求后立即返回，完成回调在数据库线程上调用。
+// 注册、改密、注销等账号变更做组提交：数毫秒内到达的变更合并进同一个事务，
+// 一次提交（一次 fsync）之后再逐个调用完成回调，回调返回成功即表示已经落盘。
+class UserStore {
+public:
+    enum Result {
+        kOk,
+        kNotFound,      // 用户不存在
+        kWrongPassword, // 密码不匹配（UpdatePassword：存储值已被其他请求修改）
+        kExists,        // 用户名已被注册
+        kLimitReached,  // 注册用户数已达上限
+        kFailed         // 数据库错误
+    };
+    typedef std::function<void(Result)> Callback;
+    typedef std::function<void(Result, const std::vector<std::string>&)> ListCallback;
+    typedef std::function<void(const std::string &username, const std::string &password)> CredentialVisitor;
+
+    // 组提交统计
+    struct BatchStats {
+        uint64_t batches = 0;       // 提交的事务数
+        uint64_t mutations = 0;     // 其中包含的账号变更总数
+        size_t lastBatchSize = 0;
+        size_t maxBatchSize = 0;
+        int64_t lastCommitUs = 0;   // 最近一次 COMMIT 耗时（微秒）
+        int64_t maxCommitUs = 0;
+        int64_t totalCommitUs = 0;
+    };
+
+    UserStore();
+    ~UserStore();
+
+    // 打开数据库、建表、预编译语句并启动数据库线程；maxUsers 为注册用户数上限，
+    // batchWindowMs 为组提交的合并窗口，0 表示不等待，只合并已经排队的变更
+    bool Open(const std::string &path, int maxUsers, int batchWindowMs = 0);
+    // 执行完已排队的请求后停止数据库线程并关闭连接
+    void Close();
+
+    // 存储层只保存与比较口令的存储值（见 PasswordHasher），哈希与校验由调用方在工作线程池上完成
+    void Register(const std::string &username, const std::string &password, Callback done);
+    // 比较并替换：当前存储值仍为 expected 时才更新为 replacement；用于改密与明文口令的迁移
+    void UpdatePassword(const std::string &username, const std::string &expected,
+                        const std::string &replacement, Callback done);
+    void DeleteUser(const std::string &username, Callback done);
+    void ListUsers(ListCallback done);
+    // 在数据库线程上逐行遍历全部账号，阻塞调用方直到遍历完成；用于启动时加载内存账号表
+    Result ScanCredentials(const CredentialVisitor &visit);
+
+    BatchStats Stats() const;
+    // 排队等待数据库线程执行的请求数
+    size_t QueueDepth() const;
+
+private:
+    enum Statement {
+        kCountUsers,
+        kInsertUser,
+        kUpdatePassword,
+        kDeleteUser,
+        kSelectUsers,
+        kSelectCredentials,
+        kStatementCount
+    };
+
+    struct Task {
+        std::function<Result()> run; // 在数据库线程上执行
+        Callback done;               // 所在批次提交之后调用，可为空
+        bool mutation;               // 账号变更，参与组提交
+        Result result;
+    };
+
+    void Post(std::function<Result()> run, Callback done, bool mutation);
+    void Run();
+    bool Exec(const char *sql);
+    void RecordBatch(size_t mutations, int64_t commitUs);
+    // 以下仅在数据库线程调用
+    Result DoRegister(const std::string &username, const std::string &password);
+    Result DoUpdatePassword(const std::string &username, const std::string &expected,
+                            const std::string &replacement);
+    Result DoDeleteUser(const std::string &username);
+    Result DoListUsers(std::vector<std::string> &users);
+
+    sqlite3 *db_;
+    sqlite3_stmt *statements_[kStatementCount];
+    int max_users_;
+    int batch_window_ms_;
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Task> tasks_;
+    bool stopping_;
+    BatchStats stats_;
+};
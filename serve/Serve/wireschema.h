@@ -0,0 +1,199 @@
+#pragma once
+
+// 二进制消息载荷编码，服务端（Serve）与客户端（socketlearn）共用，只依赖标准库。
+//
+// 连接建立后客户端先发送 1 字节协商字节 kWireHello | 版本号，此后该连接的登录/注册、
+// 转发与修改密码载荷按本文件的字段编码；不发协商字节的旧客户端继续使用 '|' 分隔的文本载荷。
+// 拉取聊天记录只支持二进制编码。消息类型都小于 0x80，协商字节不会与帧头混淆。
+//
+// 载荷由若干字段组成，每个字段为 varint(字段号 << 3 | 线型) 后跟：
+//   kVarint   —— 一个 varint 整数
+//   kBytes    —— varint 长度 + 原始字节
+// 未知字段号按线型跳过，便于以后追加字段。
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+static const uint8_t kWireHello = 0x80;
+static const uint8_t kWireVersion = 1; // 当前支持的最高版本
+
+enum WireType : uint8_t {
+    kVarint = 0,
+    kBytes = 2
+};
+
+// 各载荷的字段号
+enum CredentialField : uint32_t {   // 登录、注册
+    kCredentialUsername = 1,
+    kCredentialPassword = 2
+};
+enum ForwardField : uint32_t {      // 转发：客户端发出时为目标用户，服务端投递时为发送者
+    kForwardPeer = 1,
+    kForwardBody = 2
+};
+enum PasswordChangeField : uint32_t {
+    kPasswordOld = 1,
+    kPasswordNew = 2
+};
+
+enum RoomField : uint32_t {         // 聊天室消息：客户端发出时只带聊天室与消息体，服务端投递时带上发送者
+    kRoomName = 1,
+    kRoomSender = 2,
+    kRoomBody = 3
+};
+
+enum HistoryQueryField : uint32_t { // 拉取聊天记录的请求
+    kHistoryPeer = 1,       // 会话的另一方
+    kHistoryBefore = 2,     // varint，取序号小于它的消息；0 或缺省表示从最新开始
+    kHistoryLimit = 3,      // varint，条数
+    kHistoryBeforeTime = 4  // varint，毫秒时间戳，取早于该时间的消息，优先于 kHistoryBefore
+};
+enum HistoryPageField : uint32_t {  // history_msg 响应
+    kHistoryPagePeer = 1,
+    kHistoryPageCursor = 2, // varint，下一页请求的 kHistoryBefore；0 表示已经到最早
+    kHistoryPageEntry = 3   // 重复字段，每条都是按 HistoryEntryField 编码的嵌套载荷，按序号升序
+};
+enum HistoryEntryField : uint32_t {
+    kHistoryEntrySeq = 1,   // varint
+    kHistoryEntryTime = 2,  // varint，服务端收到消息的毫秒时间戳
+    kHistoryEntrySender = 3,
+    kHistoryEntryBody = 4
+};
+
+// 热重启交接记录（新旧进程之间，不经过客户端）
+enum HandoffField : uint32_t {
+    kHandoffKind = 1,        // varint，HandoffKind
+    kHandoffUsername = 2,    // 连接：登录用户名，握手阶段缺省；聊天室：重复字段，每个成员一个
+    kHandoffWireVersion = 3, // varint
+    kHandoffFlags = 4,       // varint，HandoffFlag 组合
+    kHandoffInput = 5,       // 已读取但尚未解析的数据
+    kHandoffRoom = 6,
+    kHandoffPresenceVersion = 7 // varint，在线状态订阅源的当前版本；成员用重复的 kHandoffUsername
+};
+enum HandoffKind : uint32_t {
+    kHandoffListen = 1,      // 携带全部监听套接字
+    kHandoffConnection = 2,  // 携带一个连接
+    kHandoffRoomMembers = 3,
+    kHandoffEnd = 4,
+    kHandoffPresence = 5     // 在线状态订阅源的版本与成员，新进程沿用，订阅者不必重新订阅
+};
+enum HandoffFlag : uint32_t {
+    kHandoffPresenceSubscribed = 1
+};
+
+// 指向载荷内部的只读视图，解码时不复制字段内容
+struct WireView {
+    const char *data = nullptr;
+    size_t size = 0;
+    std::string str() const { return std::string(data, size); }
+};
+
+class WireWriter {
+public:
+    void PutVarint(uint32_t field, uint64_t value)
+    {
+        PutRaw((static_cast<uint64_t>(field) << 3) | kVarint);
+        PutRaw(value);
+    }
+    void PutBytes(uint32_t field, const char *data, size_t size)
+    {
+        PutRaw((static_cast<uint64_t>(field) << 3) | kBytes);
+        PutRaw(size);
+        out_.append(data, size);
+    }
+    void PutString(uint32_t field, const std::string &value) { PutBytes(field, value.data(), value.size()); }
+
+    const std::string &str() const { return out_; }
+    std::string Take() { std::string out; out.swap(out_); return out; }
+
+private:
+    void PutRaw(uint64_t value)
+    {
+        while(value >= 0x80) {
+            out_.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out_.push_back(static_cast<char>(value));
+    }
+
+    std::string out_;
+};
+
+class WireReader {
+public:
+    struct Field {
+        uint32_t number = 0;
+        WireType type = kVarint;
+        uint64_t value = 0; // kVarint
+        WireView bytes;     // kBytes
+    };
+
+    WireReader(const char *data, size_t size) : pos_(data), end_(data + size), error_(false) {}
+    explicit WireReader(const std::string &payload) : WireReader(payload.data(), payload.size()) {}
+
+    // 读取下一个字段；读完或格式错误时返回 false，用 Error() 区分
+    bool Next(Field &field)
+    {
+        if(pos_ == end_ || error_) return false;
+        uint64_t tag;
+        if(!GetRaw(tag)) return Fail();
+        field.number = static_cast<uint32_t>(tag >> 3);
+        field.type = static_cast<WireType>(tag & 0x07);
+        if(field.type == kVarint) {
+            if(!GetRaw(field.value)) return Fail();
+        } else if(field.type == kBytes) {
+            uint64_t size;
+            if(!GetRaw(size) || size > static_cast<uint64_t>(end_ - pos_)) return Fail();
+            field.bytes.data = pos_;
+            field.bytes.size = static_cast<size_t>(size);
+            pos_ += size;
+        } else {
+            return Fail();
+        }
+        return true;
+    }
+    bool Error() const { return error_; }
+
+private:
+    bool GetRaw(uint64_t &value)
+    {
+        value = 0;
+        for(int shift = 0; shift < 64 && pos_ != end_; shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(*pos_++);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if(!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+    bool Fail()
+    {
+        error_ = true;
+        return false;
+    }
+
+    const char *pos_;
+    const char *end_;
+    bool error_;
+};
+
+// 解码只含两个字节串字段的载荷（登录/注册、转发、修改密码都是这种形状）
+inline bool DecodeWirePair(const std::string &payload, uint32_t firstField, uint32_t secondField,
+                           WireView &first, WireView &second)
+{
+    WireReader reader(payload);
+    WireReader::Field field;
+    bool hasFirst = false;
+    bool hasSecond = false;
+    while(reader.Next(field)) {
+        if(field.type != kBytes) continue;
+        if(field.number == firstField) {
+            first = field.bytes;
+            hasFirst = true;
+        } else if(field.number == secondField) {
+            second = field.bytes;
+            hasSecond = true;
+        }
+    }
+    return !reader.Error() && hasFirst && hasSecond;
+}
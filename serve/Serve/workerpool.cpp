@@ -0,0 +1,71 @@
+#include "workerpool.h"
+
+WorkerPool::WorkerPool()
+    : queue_limit_(0),
+      stopping_(true)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+void WorkerPool::Start(int threads, size_t queueLimit)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_limit_ = queueLimit;
+        stopping_ = false;
+    }
+    if(threads < 1) threads = 1;
+    for(int i = 0; i < threads; ++i) {
+        threads_.emplace_back([this]() { Run(); });
+    }
+}
+
+void WorkerPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    for(auto &thread : threads_) {
+        if(thread.joinable()) thread.join();
+    }
+    threads_.clear();
+}
+
+bool WorkerPool::TrySubmit(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(stopping_ || tasks_.size() >= queue_limit_) return false;
+        tasks_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+    return true;
+}
+
+size_t WorkerPool::QueueDepth() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void WorkerPool::Run()
+{
+    while(true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            // 停止时先把已排队的任务执行完，它们的完成回调会投递给存储层与事件循环
+            if(tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+// 有界的 CPU 工作线程池：执行口令哈希等耗时计算，不占用 I/O 线程与存储线程。
+// 排队任务数达到上限时 TrySubmit 直接拒绝，由调用方回复繁忙，突发请求的代价表现为排队延迟而非阻塞。
+class WorkerPool {
+public:
+    typedef std::function<void()> Task;
+
+    WorkerPool();
+    ~WorkerPool();
+
+    // 启动 threads 个工作线程；queueLimit 为尚未开始执行的任务数上限
+    void Start(int threads, size_t queueLimit);
+    // 执行完已排队的任务后停止全部工作线程
+    void Stop();
+
+    // 任务在某个工作线程上执行；未启动、正在停止或队列已满时返回 false
+    bool TrySubmit(Task task);
+    size_t QueueDepth() const;
+
+private:
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool &operator=(const WorkerPool&) = delete;
+    void Run();
+
+    std::vector<std::thread> threads_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Task> tasks_;
+    size_t queue_limit_;
+    bool stopping_;
+};
@@ -0,0 +1,120 @@
+// 广播扇出基准：对比旧的「全局锁 + 每连接互斥锁队列 + 逐个复制帧」与
+// 「无锁 MPSC 环形队列 + 共享帧」，在 1k / 10k 在线用户下，
+// 多个线程同时广播时单次广播完成入队所需的时间。
+#include "mpscring.h"
+#include "frame.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// 旧实现：ClientConnection::sendMutex + std::queue
+struct LockedQueue {
+    typedef std::vector<char> FrameType;
+    static FrameType MakeFrame() { return std::vector<char>(32, 'x'); }
+
+    std::mutex mutex;
+    std::queue<std::vector<char>> queue;
+
+    bool Push(const std::vector<char> &frame) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push(frame);
+        return true;
+    }
+    size_t Drain() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = queue.size();
+        std::queue<std::vector<char>>().swap(queue);
+        return n;
+    }
+};
+
+// 新实现：OutputBuffer 内部的无锁 MPSC 环形队列，入队的是共享帧
+struct RingQueue {
+    typedef Frame FrameType;
+    static FrameType MakeFrame() { return Frame::Encode(4, std::string(27, 'x')); }
+
+    MpscRing<Frame> ring;
+    RingQueue() : ring(256) {}
+
+    bool Push(const Frame &frame) {
+        Frame shared(frame);
+        return ring.TryPush(shared);
+    }
+    size_t Drain() {
+        size_t n = 0;
+        Frame frame;
+        while(ring.TryPop(frame)) ++n;
+        return n;
+    }
+};
+
+static std::mutex g_clientsMutex; // 旧实现中广播全程持有的在线表锁
+
+template <typename Queue>
+static void RunCase(const char *name, size_t users, int producers, int broadcastsPerProducer, bool globalLock) {
+    std::vector<std::unique_ptr<Queue>> queues;
+    for(size_t i = 0; i < users; ++i) queues.emplace_back(new Queue);
+
+    // 模拟 I/O 线程：不断清空各自负责的连接队列
+    const int consumers = 2;
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> consumerThreads;
+    for(int c = 0; c < consumers; ++c) {
+        consumerThreads.emplace_back([&, c]() {
+            while(!stop.load(std::memory_order_relaxed)) {
+                for(size_t i = c; i < users; i += consumers) queues[i]->Drain();
+            }
+        });
+    }
+
+    typename Queue::FrameType frame = Queue::MakeFrame();
+    std::vector<std::vector<double>> samples(producers);
+    std::atomic<size_t> rejected(0);
+    std::vector<std::thread> producerThreads;
+    for(int p = 0; p < producers; ++p) {
+        producerThreads.emplace_back([&, p]() {
+            for(int b = 0; b < broadcastsPerProducer; ++b) {
+                Clock::time_point t0 = Clock::now();
+                if(globalLock) {
+                    std::lock_guard<std::mutex> lock(g_clientsMutex);
+                    for(auto &q : queues) q->Push(frame);
+                } else {
+                    for(auto &q : queues) if(!q->Push(frame)) rejected.fetch_add(1);
+                }
+                samples[p].push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+            }
+        });
+    }
+    for(auto &t : producerThreads) t.join();
+    stop = true;
+    for(auto &t : consumerThreads) t.join();
+
+    std::vector<double> all;
+    for(auto &s : samples) all.insert(all.end(), s.begin(), s.end());
+    std::sort(all.begin(), all.end());
+    double sum = 0;
+    for(double v : all) sum += v;
+    printf("%-14s users=%-6zu producers=%d  avg=%9.1fus  p50=%9.1fus  p99=%9.1fus  rejected=%zu\n",
+           name, users, producers, sum / all.size(), all[all.size() / 2],
+           all[std::min(all.size() - 1, all.size() * 99 / 100)], rejected.load());
+}
+
+int main(int argc, char *argv[]) {
+    int producers = argc > 1 ? atoi(argv[1]) : 4;
+    int broadcasts = argc > 2 ? atoi(argv[2]) : 200;
+    const size_t userCounts[] = {1000, 10000};
+    for(size_t users : userCounts) {
+        RunCase<LockedQueue>("mutex+queue", users, producers, broadcasts, true);
+        RunCase<RingQueue>("mpsc+frame", users, producers, broadcasts, false);
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+// 账号加载与登录校验基准：生成一个含 N 个账号（默认 100 万，明文口令，即迁移前的旧库）的数据库，
+// 测量服务启动时把整表加载进内存账号表的耗时、在内存账号表中取存储值的单次耗时，
+// 以及按给定迭代次数做一次 PBKDF2 口令校验的耗时（决定哈希线程池每线程每秒能处理的登录数）。
+//   credential_bench [users] [lookups] [iterations]
+#include "userstore.h"
+#include "credentialcache.h"
+#include "passwordhasher.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double ElapsedMs(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+static std::string UserName(size_t i) { return "user" + std::to_string(i); }
+static std::string Password(size_t i) { return "pw" + std::to_string(i * 7919 % 1000003); }
+
+// 用单个事务批量写入测试账号
+static bool Populate(const char *path, size_t users) {
+    sqlite3 *db = nullptr;
+    if(sqlite3_open(path, &db) != SQLITE_OK) return false;
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL;"
+                     "CREATE TABLE IF NOT EXISTS users ("
+                     "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                     "username TEXT NOT NULL UNIQUE, "
+                     "password TEXT NOT NULL, "
+                     "create_at DATETIME DEFAULT CURRENT_TIMESTAMP);"
+                     "BEGIN;", nullptr, nullptr, nullptr);
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(db, "INSERT INTO users (username, password) VALUES (?1, ?2);", -1, &stmt, nullptr);
+    for(size_t i = 0; i < users; ++i) {
+        std::string name = UserName(i);
+        std::string password = Password(i);
+        sqlite3_bind_text(stmt, 1, name.data(), static_cast<int>(name.size()), SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, password.data(), static_cast<int>(password.size()), SQLITE_TRANSIENT);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    bool ok = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK;
+    sqlite3_close(db);
+    return ok;
+}
+
+static void Report(const char *name, std::vector<double> &samples) {
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for(double v : samples) sum += v;
+    printf("%-14s lookups=%-7zu avg=%8.2fus  p50=%8.2fus  p99=%8.2fus\n",
+           name, samples.size(), sum / samples.size(), samples[samples.size() / 2],
+           samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]);
+}
+
+int main(int argc, char *argv[]) {
+    size_t users = argc > 1 ? static_cast<size_t>(atoll(argv[1])) : 1000000;
+    size_t lookups = argc > 2 ? static_cast<size_t>(atoll(argv[2])) : 20000;
+    int iterations = argc > 3 ? atoi(argv[3]) : PasswordHasher::kDefaultIterations;
+    const char *path = "credential_bench.db";
+    remove(path);
+    remove("credential_bench.db-wal");
+    remove("credential_bench.db-shm");
+
+    Clock::time_point t0 = Clock::now();
+    if(!Populate(path, users)) {
+        fprintf(stderr, "populate failed\n");
+        return 1;
+    }
+    printf("populate       users=%zu  %.0f ms\n", users, ElapsedMs(t0));
+
+    // 与 Serve::start() 相同的启动路径：打开存储层并整表加载
+    UserStore store;
+    t0 = Clock::now();
+    if(!store.Open(path, static_cast<int>(users) + 1)) return 1;
+    CredentialCache cache;
+    store.ScanCredentials([&cache](const std::string &username, const std::string &password) {
+        cache.Put(username, password);
+    });
+    printf("startup load   users=%zu  %.0f ms\n", cache.Size(), ElapsedMs(t0));
+
+    std::vector<size_t> keys(lookups);
+    unsigned seed = 12345;
+    for(auto &k : keys) {
+        seed = seed * 1103515245 + 12345;
+        k = (seed >> 8) % users;
+    }
+
+    std::vector<double> samples;
+    samples.reserve(lookups);
+    size_t matched = 0;
+    bool needsRehash = false;
+    for(size_t k : keys) {
+        Clock::time_point t = Clock::now();
+        std::string stored;
+        if(cache.Lookup(UserName(k), stored) && PasswordHasher::Verify(Password(k), stored, iterations, needsRehash)) {
+            ++matched;
+        }
+        samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t).count());
+    }
+    Report("plaintext", samples);
+
+    // 迁移之后的存储值：每次校验都做一次完整的 PBKDF2，样本数相应减少
+    size_t kdfSamples = std::min<size_t>(lookups, 200);
+    std::vector<std::string> hashed(kdfSamples);
+    for(size_t i = 0; i < kdfSamples; ++i) hashed[i] = PasswordHasher::Hash(Password(keys[i]), iterations);
+    samples.clear();
+    for(size_t i = 0; i < kdfSamples; ++i) {
+        Clock::time_point t = Clock::now();
+        if(PasswordHasher::Verify(Password(keys[i]), hashed[i], iterations, needsRehash)) ++matched;
+        samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t).count());
+    }
+    Report("pbkdf2", samples);
+    double avgUs = 0;
+    for(double v : samples) avgUs += v;
+    avgUs /= samples.size();
+    printf("pbkdf2         iterations=%d  %.0f logins/s per hashing thread\n", iterations, 1e6 / avgUs);
+    printf("matched %zu / %zu\n", matched, lookups + kdfSamples);
+
+    store.Close();
+    remove(path);
+    remove("credential_bench.db-wal");
+    remove("credential_bench.db-shm");
+    return 0;
+}
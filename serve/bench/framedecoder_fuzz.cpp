@@ -0,0 +1,204 @@
+// 帧解码器的字节切分模糊测试：随机生成握手阶段与登录后的帧序列，由生成器直接给出预期的解析结果，
+// 再把同一字节流按随机长度（含逐字节）切开，经 PrepareWrite/CommitWrite 或 Append 喂给解码器，
+// 每次写入后解析出所有完整帧，逐帧核对类型、指令与载荷；中途还会用 Pending() 模拟热重启转交。
+// 任一轮不一致时打印种子与切分位置并以非零状态退出。
+//   用法：framedecoder_fuzz [轮数] [种子]
+#include "framedecoder.h"
+#include "protocol.h"
+#include "wireschema.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+
+// 与 ServeOptions::maxFrameBytes 无关，取小值以便用例里能构造超长帧
+static const size_t kMaxFrame = 4096;
+
+struct Expected {
+    FrameDecoder::Status status;
+    FrameDecoder::Message msg;
+};
+
+struct Case {
+    bool handshake;
+    std::string stream;
+    std::vector<Expected> frames; // 最后一项可能是 kTooLarge，之后不再解析
+};
+
+static void PutLength(std::string &out, uint32_t length) {
+    uint32_t net = htonl(length);
+    out.append(reinterpret_cast<const char*>(&net), sizeof(net));
+}
+
+static std::string RandomPayload(std::mt19937 &rng, size_t maxSize) {
+    // 偏向短载荷，偶尔接近上限，覆盖环形缓冲区回绕与扩容
+    size_t size = rng() % 4 == 0 ? rng() % (maxSize + 1) : rng() % 64;
+    std::string payload(size, '\0');
+    for(auto &c : payload) c = static_cast<char>(rng());
+    return payload;
+}
+
+static bool HasPayload(uint32_t instruction) {
+    InstructionType type = static_cast<InstructionType>(instruction);
+    return type == InstructionType::change_password || type == InstructionType::subscribe_presence ||
+           type == InstructionType::fetch_history || type == InstructionType::create_room ||
+           type == InstructionType::join_room || type == InstructionType::leave_room;
+}
+
+static Case MakeCase(std::mt19937 &rng) {
+    Case c;
+    c.handshake = rng() % 2 == 0;
+    int count = 1 + rng() % 40;
+    for(int i = 0; i < count; ++i) {
+        Expected e;
+        e.status = FrameDecoder::kMessage;
+        if(c.handshake) {
+            if(rng() % 8 == 0) {
+                // 协商字节
+                e.status = FrameDecoder::kNegotiate;
+                e.msg.type = static_cast<uint8_t>(kWireHello | (rng() % 0x80));
+                c.stream.push_back(static_cast<char>(e.msg.type));
+            } else {
+                e.msg.type = static_cast<uint8_t>(rng() % 0x80);
+                e.msg.payload = RandomPayload(rng, kMaxFrame);
+                c.stream.push_back(static_cast<char>(e.msg.type));
+                PutLength(c.stream, static_cast<uint32_t>(e.msg.payload.size()));
+                c.stream += e.msg.payload;
+            }
+        } else {
+            int kind = rng() % 4;
+            if(kind == 0) {
+                e.msg.type = static_cast<uint8_t>(rng() % 2 == 0 ? MessageType::forward_msg : MessageType::room_msg);
+                e.msg.payload = RandomPayload(rng, kMaxFrame);
+                c.stream.push_back(static_cast<char>(e.msg.type));
+                PutLength(c.stream, static_cast<uint32_t>(e.msg.payload.size()));
+                c.stream += e.msg.payload;
+            } else if(kind == 1) {
+                // 指令类型以主机字节序发送，未知的指令号也按无载荷处理
+                e.msg.type = static_cast<uint8_t>(MessageType::instruction);
+                e.msg.instruction = rng() % 16;
+                c.stream.push_back(static_cast<char>(e.msg.type));
+                c.stream.append(reinterpret_cast<const char*>(&e.msg.instruction), sizeof(e.msg.instruction));
+                if(HasPayload(e.msg.instruction)) {
+                    e.msg.payload = RandomPayload(rng, kMaxFrame);
+                    PutLength(c.stream, static_cast<uint32_t>(e.msg.payload.size()));
+                    c.stream += e.msg.payload;
+                }
+            } else {
+                // 其余类型（含未知类型）只有 1 字节
+                uint8_t type;
+                do {
+                    type = static_cast<uint8_t>(rng());
+                } while(type == static_cast<uint8_t>(MessageType::forward_msg) ||
+                        type == static_cast<uint8_t>(MessageType::room_msg) ||
+                        type == static_cast<uint8_t>(MessageType::instruction));
+                e.msg.type = type;
+                c.stream.push_back(static_cast<char>(type));
+            }
+        }
+        c.frames.push_back(e);
+    }
+    if(rng() % 8 == 0) {
+        // 以一个超长帧结尾：解码器应在读到长度后立即报告，而不是等待数据
+        Expected e;
+        e.status = FrameDecoder::kTooLarge;
+        c.stream.push_back(static_cast<char>(c.handshake ? MessageType::login : MessageType::forward_msg));
+        PutLength(c.stream, static_cast<uint32_t>(kMaxFrame + 1 + rng() % 1000000));
+        c.frames.push_back(e);
+    }
+    return c;
+}
+
+// 把 stream 按 cuts 切开逐段写入解码器，返回与预期不一致的描述，全部一致时返回空串
+static std::string Replay(const Case &c, const std::vector<size_t> &cuts, bool viaReadv, size_t handoffAt) {
+    std::unique_ptr<FrameDecoder> decoder(new FrameDecoder(64, kMaxFrame));
+    size_t next = 0;
+    size_t pos = 0;
+    for(size_t i = 0; i <= cuts.size(); ++i) {
+        size_t end = i < cuts.size() ? cuts[i] : c.stream.size();
+        const char *data = c.stream.data() + pos;
+        size_t len = end - pos;
+        if(viaReadv) {
+            // 与 Serve::HandleRead 相同：先准备可写空间，再按 readv 的方式分两段拷入
+            struct iovec iov[2];
+            int count = decoder->PrepareWrite(iov, len > 0 ? len : 1);
+            size_t left = len;
+            for(int k = 0; k < count && left > 0; ++k) {
+                size_t n = iov[k].iov_len < left ? iov[k].iov_len : left;
+                memcpy(iov[k].iov_base, data, n);
+                data += n;
+                left -= n;
+            }
+            decoder->CommitWrite(len - left);
+            if(left > 0) return "PrepareWrite 的空间小于请求的字节数";
+        } else {
+            decoder->Append(data, len);
+        }
+        pos = end;
+        while(true) {
+            FrameDecoder::Message msg;
+            FrameDecoder::Status status = decoder->Next(c.handshake, msg);
+            if(status == FrameDecoder::kNeedMore) break;
+            if(next >= c.frames.size()) return "解析出多余的帧";
+            const Expected &e = c.frames[next];
+            if(status != e.status) return "第 " + std::to_string(next) + " 帧状态不一致";
+            if(status == FrameDecoder::kTooLarge) return next + 1 == c.frames.size() ? "" : "超长帧之后还有预期的帧";
+            if(msg.type != e.msg.type || msg.instruction != e.msg.instruction || msg.payload != e.msg.payload) {
+                return "第 " + std::to_string(next) + " 帧内容不一致";
+            }
+            ++next;
+        }
+        if(i == handoffAt) {
+            // 热重启：旧进程取出未解析的数据，新进程的解码器从这些字节继续
+            std::string pending = decoder->Pending();
+            decoder.reset(new FrameDecoder(64, kMaxFrame));
+            decoder->Append(pending.data(), pending.size());
+        }
+    }
+    if(next != c.frames.size()) return "只解析出 " + std::to_string(next) + "/" + std::to_string(c.frames.size()) + " 帧";
+    if(decoder->Readable() != 0) return "解析完后仍有残留数据";
+    return "";
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 5000;
+    unsigned seed = argc > 2 ? static_cast<unsigned>(strtoul(argv[2], nullptr, 10)) : std::random_device()();
+    std::mt19937 rng(seed);
+    size_t frames = 0;
+    size_t bytes = 0;
+    size_t chunks = 0;
+    for(int round = 0; round < rounds; ++round) {
+        Case c = MakeCase(rng);
+        std::vector<size_t> cuts;
+        int mode = rng() % 4;
+        if(mode == 0) {
+            // 逐字节
+            for(size_t i = 1; i < c.stream.size(); ++i) cuts.push_back(i);
+        } else if(mode == 1) {
+            // 整段一次写入
+        } else {
+            size_t maxChunk = mode == 2 ? 8 : 2048;
+            for(size_t at = 1 + rng() % maxChunk; at < c.stream.size(); at += 1 + rng() % maxChunk) {
+                cuts.push_back(at);
+            }
+        }
+        bool viaReadv = rng() % 2 == 0;
+        size_t handoffAt = rng() % 4 == 0 ? rng() % (cuts.size() + 1) : static_cast<size_t>(-1);
+        std::string error = Replay(c, cuts, viaReadv, handoffAt);
+        if(!error.empty()) {
+            printf("FAIL seed=%u round=%d handshake=%d bytes=%zu chunks=%zu readv=%d handoff=%zd: %s\n",
+                   seed, round, c.handshake, c.stream.size(), cuts.size() + 1, viaReadv,
+                   static_cast<ssize_t>(handoffAt), error.c_str());
+            return 1;
+        }
+        frames += c.frames.size();
+        bytes += c.stream.size();
+        chunks += cuts.size() + 1;
+    }
+    printf("ok seed=%u rounds=%d frames=%zu bytes=%zu chunks=%zu\n", seed, rounds, frames, bytes, chunks);
+    return 0;
+}
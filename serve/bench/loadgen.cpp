@@ -0,0 +1,601 @@
+// ChatServe 负载生成器：按现有协议（1 字节类型 + 4 字节网络序长度 + 数据，指令帧为类型 + 4 字节指令）
+// 模拟 N 个用户，先注册、登录，然后在给定时长内按泊松到达以各自的速率发送 forward_msg、
+// get_all_online_users 与 heartbeat_ACK，最后报告各操作的吞吐与 p50/p99/p999 延迟。
+// 转发的正文带有发送时刻，接收方据此统计端到端投递延迟（同一台机器上单调时钟可比）。
+//
+// 服务端默认只允许 20 个注册用户，压测前用 --max-users 调大，例如：
+//   ChatServeApp --max-users 100000 > /dev/null &
+//   loadgen --users 2000 --threads 4 --duration 10 --forward-rate 5 --online-rate 0.2 --heartbeat-rate 1
+// 稳态阶段前后各抓取一次服务端指标端点（--metrics-port，0 关闭），报告每个收到的帧对应的网络系统调用数，
+// 用于比较 --io-backend epoll 与 uring。
+#include "framedecoder.h"
+#include "metrics.h"
+#include "protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 4567;
+    size_t users = 100;
+    int threads = 2;
+    double duration = 10;       // 稳态阶段秒数
+    double forwardRate = 1;     // 每个用户每秒
+    double onlineRate = 0.1;
+    double heartbeatRate = 0.2;
+    size_t payload = 64;        // 转发正文字节数
+    size_t maxOutstanding = 64; // 单个连接未收到回执的请求上限，超过后跳过本次发送
+    std::string prefix = "lg";
+    bool skipRegister = false;
+    int metricsPort = 9567;     // 服务端指标端口，0 不抓取
+};
+
+enum Op { kOpForward, kOpOnline, kOpHeartbeat, kOpCount };
+static const char *kOpNames[kOpCount] = {"forward", "online_users", "heartbeat_ack"};
+
+// 每个线程一份，结束后合并
+struct Stats {
+    Metrics::Snapshot registerLatency;
+    Metrics::Snapshot loginLatency;
+    Metrics::Snapshot latency[kOpCount];
+    Metrics::Snapshot delivery; // 转发从发出到接收方收到
+    uint64_t registerErrors = 0;
+    uint64_t loginErrors = 0;
+    uint64_t sent[kOpCount] = {};
+    uint64_t errors[kOpCount] = {};
+    uint64_t skipped[kOpCount] = {};
+    uint64_t serverHeartbeats = 0;
+    uint64_t disconnects = 0;
+    std::string firstError;
+};
+
+struct Client {
+    Client() : decoder(4096, 16 * 1024 * 1024) {}
+    int fd = -1;
+    size_t index = 0;
+    FrameDecoder decoder;
+    std::string out; // 内核发送缓冲区满时暂存的数据
+    std::deque<std::pair<Op, int64_t>> pending; // 按发送顺序等待回执的请求
+};
+
+static std::string UserName(const Options &options, size_t i) { return options.prefix + std::to_string(i); }
+static std::string Password(size_t i) { return "pw" + std::to_string(i * 7919 % 1000003); }
+
+static std::string EncodeFrame(MessageType type, const std::string &payload) {
+    std::string frame(1, static_cast<char>(type));
+    uint32_t netLength = htonl(static_cast<uint32_t>(payload.size()));
+    frame.append(reinterpret_cast<const char*>(&netLength), sizeof(netLength));
+    return frame + payload;
+}
+
+static std::string EncodeInstruction(InstructionType instruction) {
+    std::string frame(1, static_cast<char>(MessageType::instruction));
+    uint32_t value = static_cast<uint32_t>(instruction); // 指令值为主机序
+    frame.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    return frame;
+}
+
+static void Merge(Metrics::Snapshot &into, const Metrics::Snapshot &from) {
+    into.count += from.count;
+    into.sum += from.sum;
+    for(size_t i = 0; i < Metrics::kBuckets; ++i) into.buckets[i] += from.buckets[i];
+}
+
+static int Connect(const Options &options) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    struct timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+// 从服务端指标端点读取一个无标签计数器的当前值
+static bool ScrapeCounter(const Options &options, const char *name, uint64_t &value) {
+    Options metrics = options;
+    metrics.port = options.metricsPort;
+    int fd = Connect(metrics);
+    if(fd < 0) return false;
+    std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+    std::string response;
+    char buf[16384];
+    ssize_t n = 0;
+    if(send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size())) {
+        while((n = recv(fd, buf, sizeof(buf), 0)) > 0) response.append(buf, static_cast<size_t>(n));
+    }
+    close(fd);
+    std::string key = std::string("\n") + name + " ";
+    size_t pos = response.find(key);
+    if(pos == std::string::npos) return false;
+    value = strtoull(response.c_str() + pos + key.size(), nullptr, 10);
+    return true;
+}
+
+static bool SendAll(int fd, const std::string &data) {
+    size_t done = 0;
+    while(done < data.size()) {
+        ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// 阻塞读取下一个帧（服务端发出的帧都是 类型 + 长度 + 数据）
+static bool ReadFrame(Client &client, FrameDecoder::Message &msg) {
+    while(true) {
+        FrameDecoder::Status status = client.decoder.Next(true, msg);
+        if(status == FrameDecoder::kMessage) return true;
+        if(status != FrameDecoder::kNeedMore) return false;
+        struct iovec iov[2];
+        int iovcnt = client.decoder.PrepareWrite(iov, 4096);
+        ssize_t n = readv(client.fd, iov, iovcnt);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        client.decoder.CommitWrite(static_cast<size_t>(n));
+    }
+}
+
+static void NoteError(Stats &stats, const std::string &error) {
+    if(stats.firstError.empty()) stats.firstError = error;
+}
+
+// 一批连接先全部发出请求再逐个读回复，注册请求可以落在服务端同一个组提交窗口里
+static const size_t kHandshakeBatch = 256;
+
+static void RegisterUsers(const Options &options, const std::vector<size_t> &indexes, Stats &stats) {
+    for(size_t begin = 0; begin < indexes.size(); begin += kHandshakeBatch) {
+        size_t end = std::min(indexes.size(), begin + kHandshakeBatch);
+        std::vector<std::unique_ptr<Client>> batch;
+        std::vector<int64_t> sentUs;
+        for(size_t i = begin; i < end; ++i) {
+            std::unique_ptr<Client> client(new Client);
+            client->fd = Connect(options);
+            client->index = indexes[i];
+            sentUs.push_back(Metrics::NowUs());
+            std::string request = EncodeFrame(MessageType::register_user,
+                                              UserName(options, indexes[i]) + "|" + Password(indexes[i]));
+            if(client->fd < 0 || !SendAll(client->fd, request)) {
+                ++stats.registerErrors;
+                NoteError(stats, "register: connect failed");
+            }
+            batch.push_back(std::move(client));
+        }
+        for(size_t i = 0; i < batch.size(); ++i) {
+            Client &client = *batch[i];
+            if(client.fd < 0) continue;
+            FrameDecoder::Message msg;
+            if(!ReadFrame(client, msg)) {
+                ++stats.registerErrors;
+                NoteError(stats, "register: no reply");
+            } else if(msg.payload == "register:register_success" || msg.payload == "register:username_exists") {
+                stats.registerLatency.Add(static_cast<uint64_t>(Metrics::NowUs() - sentUs[i]));
+            } else {
+                ++stats.registerErrors;
+                NoteError(stats, msg.payload);
+            }
+            close(client.fd);
+        }
+    }
+}
+
+static void LoginUsers(const Options &options, std::vector<std::unique_ptr<Client>> &clients, Stats &stats) {
+    std::vector<std::unique_ptr<Client>> loggedIn;
+    for(size_t begin = 0; begin < clients.size(); begin += kHandshakeBatch) {
+        size_t end = std::min(clients.size(), begin + kHandshakeBatch);
+        std::vector<int64_t> sentUs;
+        for(size_t i = begin; i < end; ++i) {
+            Client &client = *clients[i];
+            client.fd = Connect(options);
+            sentUs.push_back(Metrics::NowUs());
+            std::string request = EncodeFrame(MessageType::login,
+                                              UserName(options, client.index) + "|" + Password(client.index));
+            if(client.fd >= 0 && !SendAll(client.fd, request)) {
+                close(client.fd);
+                client.fd = -1;
+            }
+        }
+        for(size_t i = begin; i < end; ++i) {
+            std::unique_ptr<Client> &client = clients[i];
+            FrameDecoder::Message msg;
+            if(client->fd >= 0 && ReadFrame(*client, msg) && msg.payload == "login:login_success") {
+                stats.loginLatency.Add(static_cast<uint64_t>(Metrics::NowUs() - sentUs[i - begin]));
+                loggedIn.push_back(std::move(client));
+                continue;
+            }
+            ++stats.loginErrors;
+            NoteError(stats, client->fd < 0 ? "login: connect failed" : "login: " + msg.payload);
+            if(client->fd >= 0) close(client->fd);
+        }
+    }
+    clients.swap(loggedIn);
+}
+
+struct Event {
+    int64_t dueUs;
+    uint32_t client;
+    Op op;
+    bool operator>(const Event &other) const { return dueUs > other.dueUs; }
+};
+
+class Worker {
+public:
+    Worker(const Options &options, std::vector<std::unique_ptr<Client>> &clients, Stats &stats, unsigned seed)
+        : options_(options), clients_(clients), stats_(stats), random_(seed), epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {}
+    ~Worker() { close(epoll_fd_); }
+
+    void Run(int64_t startUs, int64_t endUs) {
+        for(uint32_t i = 0; i < clients_.size(); ++i) {
+            fcntl(clients_[i]->fd, F_SETFL, fcntl(clients_[i]->fd, F_GETFL) | O_NONBLOCK);
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.u32 = i;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, clients_[i]->fd, &ev);
+            // 先处理登录阶段已读入但尚未解析的数据（登录回复之后紧跟的 user_online 等）
+            ProcessInput(*clients_[i]);
+            double rates[kOpCount] = {options_.forwardRate, options_.onlineRate, options_.heartbeatRate};
+            for(int op = 0; op < kOpCount; ++op) {
+                if(rates[op] > 0) Schedule(startUs, i, static_cast<Op>(op), rates[op]);
+            }
+        }
+        double rates[kOpCount] = {options_.forwardRate, options_.onlineRate, options_.heartbeatRate};
+        struct epoll_event events[256];
+        while(true) {
+            int64_t now = Metrics::NowUs();
+            while(!events_.empty() && events_.top().dueUs <= now && now < endUs) {
+                Event event = events_.top();
+                events_.pop();
+                Fire(*clients_[event.client], event.op, now);
+                Schedule(event.dueUs, event.client, event.op, rates[event.op]);
+            }
+            int64_t waitUntil = endUs;
+            if(now >= endUs) {
+                // 压测结束后最多再等 2 秒收齐未到的回执
+                if(Outstanding() == 0 || now >= endUs + 2000000) break;
+                waitUntil = endUs + 2000000;
+            } else if(!events_.empty()) {
+                waitUntil = std::min(waitUntil, events_.top().dueUs);
+            }
+            int timeoutMs = static_cast<int>(std::max<int64_t>(0, (waitUntil - now + 999) / 1000));
+            int n = epoll_wait(epoll_fd_, events, 256, timeoutMs);
+            for(int i = 0; i < n; ++i) {
+                Client &client = *clients_[events[i].data.u32];
+                if(client.fd < 0) continue;
+                if(events[i].events & EPOLLOUT) Flush(client);
+                if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) Read(client);
+            }
+        }
+        for(auto &client : clients_) {
+            if(client->fd >= 0) close(client->fd);
+            client->fd = -1;
+        }
+    }
+
+private:
+    void Schedule(int64_t fromUs, uint32_t client, Op op, double rate) {
+        // 泊松到达：间隔服从指数分布
+        std::exponential_distribution<double> interval(rate);
+        events_.push(Event{fromUs + static_cast<int64_t>(interval(random_) * 1e6), client, op});
+    }
+
+    size_t Outstanding() const {
+        size_t total = 0;
+        for(auto &client : clients_) {
+            if(client->fd >= 0) total += client->pending.size();
+        }
+        return total;
+    }
+
+    void Fire(Client &client, Op op, int64_t now) {
+        if(client.fd < 0) return;
+        if(op != kOpHeartbeat && client.pending.size() >= options_.maxOutstanding) {
+            ++stats_.skipped[op];
+            return;
+        }
+        std::string request;
+        if(op == kOpForward) {
+            size_t target = client.index;
+            if(options_.users > 1) {
+                // 目标从所有用户中随机选取，可能落在其他线程或离线用户上
+                std::uniform_int_distribution<size_t> pick(0, options_.users - 1);
+                while(target == client.index) target = pick(random_);
+            }
+            std::string body = std::to_string(now) + " ";
+            if(body.size() < options_.payload) body.append(options_.payload - body.size(), 'x');
+            request = EncodeFrame(MessageType::forward_msg, UserName(options_, target) + "|" + body);
+        } else if(op == kOpOnline) {
+            request = EncodeInstruction(InstructionType::get_all_online_users);
+        } else {
+            request = EncodeInstruction(InstructionType::heartbeat_ACK);
+        }
+        ++stats_.sent[op];
+        // heartbeat_ACK 没有回执，只统计发送
+        if(op != kOpHeartbeat) client.pending.push_back(std::make_pair(op, now));
+        Write(client, request);
+    }
+
+    void Write(Client &client, const std::string &data) {
+        if(!client.out.empty()) {
+            client.out += data;
+            return;
+        }
+        ssize_t n = send(client.fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                Drop(client);
+                return;
+            }
+            n = 0;
+        }
+        if(static_cast<size_t>(n) < data.size()) client.out.assign(data, static_cast<size_t>(n), std::string::npos);
+    }
+
+    void Flush(Client &client) {
+        while(!client.out.empty()) {
+            ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+            if(n < 0) {
+                if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+                if(errno == EINTR) continue;
+                Drop(client);
+                return;
+            }
+            client.out.erase(0, static_cast<size_t>(n));
+        }
+    }
+
+    void Read(Client &client) {
+        while(client.fd >= 0) {
+            struct iovec iov[2];
+            int iovcnt = client.decoder.PrepareWrite(iov, 4096);
+            ssize_t n = readv(client.fd, iov, iovcnt);
+            if(n > 0) {
+                client.decoder.CommitWrite(static_cast<size_t>(n));
+                ProcessInput(client);
+                continue;
+            }
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            Drop(client);
+        }
+    }
+
+    void ProcessInput(Client &client) {
+        FrameDecoder::Message msg;
+        while(client.fd >= 0 && client.decoder.Next(true, msg) == FrameDecoder::kMessage) {
+            int64_t now = Metrics::NowUs();
+            if(msg.type == static_cast<uint8_t>(MessageType::forward_msg)) {
+                // "发送者|发送时刻 填充"
+                size_t pos = msg.payload.find('|');
+                if(pos != std::string::npos) {
+                    int64_t sentUs = strtoll(msg.payload.c_str() + pos + 1, nullptr, 10);
+                    if(sentUs > 0) stats_.delivery.Add(static_cast<uint64_t>(std::max<int64_t>(0, now - sentUs)));
+                }
+                continue;
+            }
+            if(msg.type != static_cast<uint8_t>(MessageType::return_msg)) continue;
+            Op op;
+            bool ok = true;
+            if(msg.payload == "heartbeat") {
+                ++stats_.serverHeartbeats;
+                Write(client, EncodeInstruction(InstructionType::heartbeat_ACK));
+                continue;
+            } else if(msg.payload.compare(0, 17, "all_online_users:") == 0) {
+                op = kOpOnline;
+            } else if(msg.payload == "forward success") {
+                op = kOpForward;
+            } else if(msg.payload.compare(0, 6, "用户") == 0) {
+                // 目标不在线或离线信箱已满
+                op = kOpForward;
+                ok = false;
+            } else {
+                continue; // user_online 等通知
+            }
+            // 服务端按请求顺序回复，队首就是这条回执对应的请求
+            if(client.pending.empty() || client.pending.front().first != op) {
+                ++stats_.errors[op];
+                NoteError(stats_, "unexpected reply: " + msg.payload.substr(0, 64));
+                continue;
+            }
+            int64_t sentUs = client.pending.front().second;
+            client.pending.pop_front();
+            if(ok) {
+                stats_.latency[op].Add(static_cast<uint64_t>(now - sentUs));
+            } else {
+                ++stats_.errors[op];
+                NoteError(stats_, msg.payload);
+            }
+        }
+    }
+
+    void Drop(Client &client) {
+        if(client.fd < 0) return;
+        ++stats_.disconnects;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client.fd, nullptr);
+        close(client.fd);
+        client.fd = -1;
+        for(auto &request : client.pending) ++stats_.errors[request.first];
+        client.pending.clear();
+    }
+
+    const Options &options_;
+    std::vector<std::unique_ptr<Client>> &clients_;
+    Stats &stats_;
+    std::mt19937_64 random_;
+    int epoll_fd_;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+};
+
+static void PrintRow(const char *name, uint64_t count, uint64_t errors, double seconds, const Metrics::Snapshot &latency) {
+    printf("%-14s %10llu %8llu %12.1f %10llu %10llu %10llu\n", name, static_cast<unsigned long long>(count),
+           static_cast<unsigned long long>(errors), seconds > 0 ? count / seconds : 0.0,
+           static_cast<unsigned long long>(latency.Quantile(0.5)), static_cast<unsigned long long>(latency.Quantile(0.99)),
+           static_cast<unsigned long long>(latency.Quantile(0.999)));
+}
+
+static bool ParseOptions(int argc, char *argv[], Options &options) {
+    for(int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--host") == 0 && hasValue) options.host = argv[++i];
+        else if(strcmp(argv[i], "--port") == 0 && hasValue) options.port = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--users") == 0 && hasValue) options.users = static_cast<size_t>(atoll(argv[++i]));
+        else if(strcmp(argv[i], "--threads") == 0 && hasValue) options.threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--duration") == 0 && hasValue) options.duration = atof(argv[++i]);
+        else if(strcmp(argv[i], "--forward-rate") == 0 && hasValue) options.forwardRate = atof(argv[++i]);
+        else if(strcmp(argv[i], "--online-rate") == 0 && hasValue) options.onlineRate = atof(argv[++i]);
+        else if(strcmp(argv[i], "--heartbeat-rate") == 0 && hasValue) options.heartbeatRate = atof(argv[++i]);
+        else if(strcmp(argv[i], "--payload") == 0 && hasValue) options.payload = static_cast<size_t>(atoll(argv[++i]));
+        else if(strcmp(argv[i], "--max-outstanding") == 0 && hasValue) options.maxOutstanding = static_cast<size_t>(atoll(argv[++i]));
+        else if(strcmp(argv[i], "--prefix") == 0 && hasValue) options.prefix = argv[++i];
+        else if(strcmp(argv[i], "--skip-register") == 0) options.skipRegister = true;
+        else if(strcmp(argv[i], "--metrics-port") == 0 && hasValue) options.metricsPort = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "unknown option: %s\n"
+                    "usage: loadgen [--host H] [--port N] [--users N] [--threads N] [--duration s]\n"
+                    "               [--forward-rate r] [--online-rate r] [--heartbeat-rate r] (per user per second)\n"
+                    "               [--payload bytes] [--max-outstanding N] [--prefix name] [--skip-register]\n"
+                    "               [--metrics-port N] (0 disables the syscall report)\n", argv[i]);
+            return false;
+        }
+    }
+    if(options.users == 0 || options.threads <= 0) return false;
+    options.threads = static_cast<int>(std::min<size_t>(options.threads, options.users));
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if(!ParseOptions(argc, argv, options)) return 1;
+
+    // 用户按下标轮流分给各线程，每个线程独立完成注册、登录与稳态阶段
+    std::vector<Stats> stats(options.threads);
+    std::vector<std::vector<std::unique_ptr<Client>>> clients(options.threads);
+    for(size_t i = 0; i < options.users; ++i) {
+        std::unique_ptr<Client> client(new Client);
+        client->index = i;
+        clients[i % options.threads].push_back(std::move(client));
+    }
+
+    std::vector<std::thread> threads;
+    int64_t t0 = Metrics::NowUs();
+    if(!options.skipRegister) {
+        for(int t = 0; t < options.threads; ++t) {
+            threads.emplace_back([&, t]() {
+                std::vector<size_t> indexes;
+                for(auto &client : clients[t]) indexes.push_back(client->index);
+                RegisterUsers(options, indexes, stats[t]);
+            });
+        }
+        for(auto &thread : threads) thread.join();
+        threads.clear();
+    }
+    double registerSeconds = (Metrics::NowUs() - t0) / 1e6;
+
+    t0 = Metrics::NowUs();
+    for(int t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t]() { LoginUsers(options, clients[t], stats[t]); });
+    }
+    for(auto &thread : threads) thread.join();
+    threads.clear();
+    double loginSeconds = (Metrics::NowUs() - t0) / 1e6;
+
+    size_t online = 0;
+    for(auto &group : clients) online += group.size();
+    printf("users=%zu online=%zu threads=%d duration=%.1fs rates(per user/s): forward=%g online_users=%g heartbeat_ack=%g\n",
+           options.users, online, options.threads, options.duration, options.forwardRate, options.onlineRate,
+           options.heartbeatRate);
+
+    uint64_t syscallsBefore = 0, framesBefore = 0;
+    bool scraped = options.metricsPort > 0 &&
+                   ScrapeCounter(options, "chatserve_net_syscalls_total", syscallsBefore) &&
+                   ScrapeCounter(options, "chatserve_frames_in_total", framesBefore);
+
+    int64_t startUs = Metrics::NowUs();
+    int64_t endUs = startUs + static_cast<int64_t>(options.duration * 1e6);
+    for(int t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t]() {
+            Worker worker(options, clients[t], stats[t], 12345u + t);
+            worker.Run(startUs, endUs);
+        });
+    }
+    for(auto &thread : threads) thread.join();
+
+    uint64_t syscallsAfter = 0, framesAfter = 0;
+    scraped = scraped && ScrapeCounter(options, "chatserve_net_syscalls_total", syscallsAfter) &&
+              ScrapeCounter(options, "chatserve_frames_in_total", framesAfter);
+
+    std::unique_ptr<Stats> total(new Stats);
+    for(auto &s : stats) {
+        Merge(total->registerLatency, s.registerLatency);
+        Merge(total->loginLatency, s.loginLatency);
+        Merge(total->delivery, s.delivery);
+        total->registerErrors += s.registerErrors;
+        total->loginErrors += s.loginErrors;
+        total->serverHeartbeats += s.serverHeartbeats;
+        total->disconnects += s.disconnects;
+        for(int op = 0; op < kOpCount; ++op) {
+            Merge(total->latency[op], s.latency[op]);
+            total->sent[op] += s.sent[op];
+            total->errors[op] += s.errors[op];
+            total->skipped[op] += s.skipped[op];
+        }
+        if(total->firstError.empty()) total->firstError = s.firstError;
+    }
+
+    printf("%-14s %10s %8s %12s %10s %10s %10s\n", "op", "count", "errors", "ops/s", "p50(us)", "p99(us)", "p999(us)");
+    if(!options.skipRegister) {
+        PrintRow("register", total->registerLatency.count, total->registerErrors, registerSeconds, total->registerLatency);
+    }
+    PrintRow("login", total->loginLatency.count, total->loginErrors, loginSeconds, total->loginLatency);
+    for(int op = 0; op < kOpCount; ++op) {
+        // heartbeat_ack 没有回执，只统计发送数
+        uint64_t count = op == kOpHeartbeat ? total->sent[op] : total->latency[op].count;
+        PrintRow(kOpNames[op], count, total->errors[op], options.duration, total->latency[op]);
+    }
+    PrintRow("delivery", total->delivery.count, 0, options.duration, total->delivery);
+    printf("skipped(max outstanding): forward=%llu online_users=%llu  server heartbeats=%llu  disconnects=%llu\n",
+           static_cast<unsigned long long>(total->skipped[kOpForward]),
+           static_cast<unsigned long long>(total->skipped[kOpOnline]),
+           static_cast<unsigned long long>(total->serverHeartbeats),
+           static_cast<unsigned long long>(total->disconnects));
+    if(scraped) {
+        // 两次抓取之间也包含服务端的心跳与空闲等待，负载越低每帧摊到的越多
+        uint64_t syscalls = syscallsAfter - syscallsBefore;
+        uint64_t frames = framesAfter - framesBefore;
+        printf("server net syscalls=%llu frames_in=%llu syscalls/frame=%.3f\n",
+               static_cast<unsigned long long>(syscalls), static_cast<unsigned long long>(frames),
+               frames > 0 ? static_cast<double>(syscalls) / frames : 0.0);
+    }
+    if(!total->firstError.empty()) printf("first error: %s\n", total->firstError.c_str());
+    return 0;
+}
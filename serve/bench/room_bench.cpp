@@ -0,0 +1,83 @@
+// 聊天室扇出基准：向 1k 成员的聊天室发一条消息，对比
+// 「按成员名逐个查在线表 + 每个成员单独编码一帧」与「成员编号数组取连接 + 共享一帧」
+// 单次扇出完成入队所需的时间。
+#include "serve.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Members {
+    OnlineRegistry online;
+    RoomRegistry rooms;
+    std::vector<std::string> names;
+};
+
+// 每轮重新建立连接，保证发送队列有足够槽位且不需要写出
+static void Connect(Members &members, size_t rounds) {
+    for(const std::string &name : members.names) {
+        std::shared_ptr<ClientConnection> conn(new ClientConnection(1ULL << 40, rounds + 1, 1024 * 1024));
+        conn->username = name;
+        OnlineRegistry::ConnectionPtr old = members.online.Find(name);
+        if(old) members.online.Remove(name, old);
+        members.online.Add(name, conn);
+        members.rooms.Attach(name, conn);
+    }
+}
+
+static void Report(const char *name, size_t users, std::vector<double> &samples) {
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for(double v : samples) sum += v;
+    printf("%-14s members=%-6zu avg=%9.1fus  p50=%9.1fus  p99=%9.1fus\n", name, users, sum / samples.size(),
+           samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]);
+}
+
+int main(int argc, char *argv[]) {
+    size_t users = argc > 1 ? static_cast<size_t>(atoll(argv[1])) : 1000;
+    size_t rounds = argc > 2 ? static_cast<size_t>(atoll(argv[2])) : 200;
+    std::string body(64, 'x');
+    const std::string room = "bench";
+    const std::string sender = "user0";
+
+    Members members;
+    for(size_t i = 0; i < users; ++i) {
+        members.names.push_back("user" + std::to_string(i));
+        if(i == 0) members.rooms.Create(room, members.names.back());
+        else members.rooms.Join(room, members.names.back());
+    }
+
+    // 旧做法：成员表是用户名列表，逐个查在线表并为每个成员拼接、编码一帧
+    Connect(members, rounds);
+    std::vector<double> samples;
+    for(size_t r = 0; r < rounds; ++r) {
+        Clock::time_point t0 = Clock::now();
+        for(const std::string &name : members.names) {
+            if(name == sender) continue;
+            OnlineRegistry::ConnectionPtr conn = members.online.Find(name);
+            if(!conn) continue;
+            conn->output.Push(Frame::Encode(7, room + "|" + sender + "|" + body));
+        }
+        samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+    }
+    Report("lookup+encode", users, samples);
+
+    // 新做法：RoomRegistry::Collect 按编号取连接，整轮只编码一帧
+    Connect(members, rounds);
+    samples.clear();
+    std::vector<RoomRegistry::ConnectionPtr> targets;
+    for(size_t r = 0; r < rounds; ++r) {
+        Clock::time_point t0 = Clock::now();
+        targets.clear();
+        members.rooms.Collect(room, sender, targets);
+        Frame frame = Frame::Encode(7, room + "|" + sender + "|" + body);
+        for(auto &conn : targets) conn->output.Push(frame);
+        samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+    }
+    Report("room+shared", users, samples);
+    return 0;
+}
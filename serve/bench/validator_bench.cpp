@@ -0,0 +1,80 @@
+// 账号格式校验基准：对比旧实现（每次调用构造 std::regex）、预先构造好的 std::regex
+// 与 CredentialValidator 查表校验，在 ASCII 与中文用户名上的单次耗时，并核对三者结论是否一致。
+#include "credentialvalidator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <regex>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const char *kUsernamePattern = "^[A-Za-z0-9一-龥]+$";
+static const char *kPasswordPattern = "^[A-Za-z0-9]+$";
+
+struct Sample {
+    std::string username;
+    std::string password;
+};
+
+static std::vector<Sample> MakeSamples() {
+    std::vector<Sample> samples;
+    const char *names[] = {"alice", "Bob2024", "张三", "李四user", "用户名很长的中文用户", "bad name", "x!y", "\xE4\xB8", "abc\xC3\xA9"};
+    const char *passwords[] = {"pw123", "Secret99", "longpasswordwithoutsymbols123", "bad pass", "pw!"};
+    for(const char *name : names) {
+        for(const char *password : passwords) {
+            samples.push_back(Sample{name, password});
+        }
+    }
+    return samples;
+}
+
+template <typename Fn>
+static void RunCase(const char *name, const std::vector<Sample> &samples, int rounds, Fn fn) {
+    size_t accepted = 0;
+    Clock::time_point t0 = Clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        for(const Sample &s : samples) {
+            if(fn(s)) ++accepted;
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    printf("%-16s checks=%-8zu avg=%10.1fns  accepted=%zu\n",
+           name, samples.size() * rounds, ns / (samples.size() * rounds), accepted);
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    std::vector<Sample> samples = MakeSamples();
+
+    // 旧实现：HandleMessage 每次注册都重新构造两个正则
+    RunCase("regex-per-call", samples, rounds / 20 > 0 ? rounds / 20 : 1, [](const Sample &s) {
+        std::regex usernameRegex(kUsernamePattern);
+        std::regex passwordRegex(kPasswordPattern);
+        return std::regex_match(s.username, usernameRegex) && std::regex_match(s.password, passwordRegex);
+    });
+
+    std::regex usernameRegex(kUsernamePattern);
+    std::regex passwordRegex(kPasswordPattern);
+    RunCase("regex-prebuilt", samples, rounds, [&](const Sample &s) {
+        return std::regex_match(s.username, usernameRegex) && std::regex_match(s.password, passwordRegex);
+    });
+
+    RunCase("validator", samples, rounds, [](const Sample &s) {
+        return CredentialValidator::IsValidUsername(s.username) && CredentialValidator::IsValidPassword(s.password);
+    });
+
+    // 按字节比较的正则会把不完整或范围外的 UTF-8 字节也当成汉字，逐个列出结论不同的输入
+    std::string last;
+    for(const Sample &s : samples) {
+        if(s.username == last) continue;
+        last = s.username;
+        bool byRegex = std::regex_match(s.username, usernameRegex);
+        bool byValidator = CredentialValidator::IsValidUsername(s.username);
+        if(byRegex != byValidator) {
+            printf("username differs: \"%s\" regex=%d validator=%d\n", s.username.c_str(), byRegex, byValidator);
+        }
+    }
+    return 0;
+}
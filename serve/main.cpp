@@ -1,9 +1,127 @@
 #include "Serve/serve.h"
-#include <iostream>
+#include "Serve/logger.h"
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <unistd.h>
 
-int main() {
-    Serve server;
-    std::cout << "启动服务器..." << std::endl;
-    server.start();
+int main(int argc, char* argv[]) {
+    // 命令行参数：--port N --threads N --backlog N --reuseport
+    //            --heartbeat-idle 秒 --heartbeat-timeout 秒
+    //            --send-hwm 字节 --drop-slow --presence-window 毫秒 --presence-history 个数
+    //            --max-users N --store-batch-window 毫秒 --max-frame 字节
+    //            --mailbox-limit 条数 --mailbox-batch 条数 --history-page 条数
+    //            --room-members 人数
+    //            --handoff 路径 --takeover --drain-timeout 毫秒 --metrics-port N
+    //            --log-level debug|info|warn|error --log-json（debug 日志点需以 -DCHATSERVE_LOG_MIN_LEVEL=0 编译）
+    //            --io-backend epoll|uring（内核不支持 io_uring 时回退到 epoll）
+    //            --password-iterations N --password-threads N --password-queue N
+    //            --user-rate 每秒 --user-burst N --ip-rate 每秒 --ip-burst N
+    //            --handshake-rate 每秒 --handshake-burst N（速率 0 表示不限）
+    ServeOptions options;
+    Logger::Level logLevel = Logger::kInfo;
+    Logger::Format logFormat = Logger::kText;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.ioThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            options.backlog = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--heartbeat-idle") == 0 && i + 1 < argc) {
+            options.heartbeatIdleSeconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--heartbeat-timeout") == 0 && i + 1 < argc) {
+            options.heartbeatAckTimeoutSeconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--send-hwm") == 0 && i + 1 < argc) {
+            options.sendHighWaterMark = static_cast<size_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--drop-slow") == 0) {
+            options.disconnectSlowConsumer = false;
+        } else if (strcmp(argv[i], "--presence-window") == 0 && i + 1 < argc) {
+            options.presenceWindowMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--presence-history") == 0 && i + 1 < argc) {
+            options.presenceHistory = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--max-users") == 0 && i + 1 < argc) {
+            options.maxUsers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--store-batch-window") == 0 && i + 1 < argc) {
+            options.storeBatchWindowMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--password-iterations") == 0 && i + 1 < argc) {
+            options.passwordIterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--password-threads") == 0 && i + 1 < argc) {
+            options.passwordThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--password-queue") == 0 && i + 1 < argc) {
+            options.passwordQueueLimit = static_cast<size_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--user-rate") == 0 && i + 1 < argc) {
+            options.userRequestRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--user-burst") == 0 && i + 1 < argc) {
+            options.userRequestBurst = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ip-rate") == 0 && i + 1 < argc) {
+            options.addressRequestRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ip-burst") == 0 && i + 1 < argc) {
+            options.addressRequestBurst = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--handshake-rate") == 0 && i + 1 < argc) {
+            options.handshakeRequestRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--handshake-burst") == 0 && i + 1 < argc) {
+            options.handshakeRequestBurst = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-frame") == 0 && i + 1 < argc) {
+            options.maxFrameBytes = static_cast<size_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--mailbox-limit") == 0 && i + 1 < argc) {
+            options.mailboxLimit = static_cast<size_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--mailbox-batch") == 0 && i + 1 < argc) {
+            options.mailboxBatch = static_cast<size_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--history-page") == 0 && i + 1 < argc) {
+            options.historyPageLimit = static_cast<size_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--room-members") == 0 && i + 1 < argc) {
+            options.maxRoomMembers = static_cast<size_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--handoff") == 0 && i + 1 < argc) {
+            options.handoffPath = argv[++i];
+        } else if (strcmp(argv[i], "--takeover") == 0) {
+            options.takeover = true;
+        } else if (strcmp(argv[i], "--drain-timeout") == 0 && i + 1 < argc) {
+            options.drainTimeoutMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc) {
+            options.metricsPort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            if (!Logger::ParseLevel(argv[++i], logLevel)) {
+                LOG_ERROR << "未知日志级别: " << argv[i];
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-json") == 0) {
+            logFormat = Logger::kJsonLines;
+        } else if (strcmp(argv[i], "--io-backend") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "epoll") == 0) {
+                options.ioBackend = EventLoop::kEpoll;
+            } else if (strcmp(argv[i], "uring") == 0) {
+                options.ioBackend = EventLoop::kUring;
+            } else {
+                LOG_ERROR << "未知 I/O 后端: " << argv[i];
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--reuseport") == 0) {
+            options.reusePort = true;
+        } else {
+            LOG_ERROR << "未知参数: " << argv[i];
+            return 1;
+        }
+    }
+    // 热重启（SIGUSR2）时以相同参数启动新进程接管连接。记下可执行文件的路径而不是使用 /proc/self/exe，
+    // 部署替换文件后启动的是新版本
+    char exePath[PATH_MAX];
+    ssize_t exeLen = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+    if (exeLen > 0) {
+        options.restartCommand.push_back(std::string(exePath, exeLen));
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--takeover") != 0) options.restartCommand.push_back(argv[i]);
+        }
+        options.restartCommand.push_back("--takeover");
+    }
+    // 日志写入线程在服务的任何线程之前启动，服务退出后写出剩余日志
+    Logger::Start(1, logLevel, logFormat);
+    {
+        Serve server(options);
+        LOG_INFO << "启动服务器...";
+        server.start();
+    }
+    Logger::Stop();
     return 0;
 }
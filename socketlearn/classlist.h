@@ -51,7 +51,9 @@ enum class MessageType {
     forward_msg = 2,
     instruction = 3,
     return_msg = 4,
-    error = 5
+    error = 5,
+    history_msg = 6,
+    room_msg = 7
 };
 
 enum class InstructionType {
@@ -60,5 +62,10 @@ enum class InstructionType {
     get_all_user = 2,
     get_all_online_users = 3,
     heartbeat_ACK = 4,
-    logout = 5
+    logout = 5,
+    subscribe_presence = 6,
+    fetch_history = 7,
+    create_room = 8,
+    join_room = 9,
+    leave_room = 10
 };
@@ -102,82 +102,49 @@ bool socketlearn::ReceiveData(string& Msg, MessageType& type)
 
     MessageType msgtype = static_cast<MessageType>(Msgtype[0]);
     type = msgtype;
-    int leng;
-    switch (msgtype)
+    // 服务端下发的帧除指令外都是 类型 + 4 字节长度 + 载荷（history_msg、room_msg 以及之后新增的类型同样如此），
+    // 必须整帧读完，否则剩下的字节会被当成下一帧的头部
+    if (msgtype == MessageType::instruction)
     {
-		case MessageType::forward_msg:
-		{
-			char MessageLength[4];
-			int res = recv(socket_fd, MessageLength, sizeof(MessageLength), 0);
-			if (res == SOCKET_ERROR)
-			{
-				ErrorMessage = std::to_string(WSAGetLastError());
-				return false;
-			}
-			uint32_t dataLength = ntohl(*reinterpret_cast<uint32_t*>(MessageLength));
-			leng = dataLength;
-			int totalread = 0;
-			char* buffer = new char[dataLength];
-			while (totalread < dataLength)
-			{
-				res = recv(socket_fd, buffer + totalread, dataLength - totalread, 0);
-				if (res == SOCKET_ERROR)
-				{
-					ErrorMessage = std::to_string(WSAGetLastError());
-					delete[] buffer;
-					return false;
-				}
-				totalread += res;
-			}
-			if(totalread != dataLength)
-			{
-				ErrorMessage = "Receive data failed";
-				delete[] buffer;
-				return false;
-			}
-			Msg = std::string(buffer, dataLength);
-			delete[] buffer;
-			break;
-		}
-		case MessageType::return_msg:
-		{
-			char MsgLength[4];
-			int res = recv(socket_fd, MsgLength, sizeof(MsgLength), 0);
-			if (res == SOCKET_ERROR)
-			{
-				ErrorMessage = std::to_string(WSAGetLastError());
-				return false;
-			}
-			uint32_t msgLength = ntohl(*reinterpret_cast<uint32_t*>(MsgLength));
-			leng = msgLength;
-			char* buffer = new char[msgLength];
-			int totalread = 0;
-			while (totalread < msgLength)
-			{
-				res = recv(socket_fd, buffer + totalread, msgLength - totalread, 0);
-				if (res == SOCKET_ERROR)
-				{
-					ErrorMessage = std::to_string(WSAGetLastError());
-					delete[] buffer;
-					return false;
-				}
-				totalread += res;
-			}
-			if(totalread != msgLength)
-			{
-				ErrorMessage = "Receive data failed";
-				delete[] buffer;
-				return false;
-			}
-			Msg = std::string(buffer, msgLength);
-            if(Msg == "heartbeat") {
-                uint32_t inst = static_cast<uint32_t>(InstructionType::heartbeat_ACK);
-                vector<char> data = GenerateMessage(MessageType::instruction, inst);
-                SendData(data);
-            }
-			delete[] buffer;
-			break;
-		}
+        return true;
+    }
+    char MsgLength[4];
+    if (!ReceiveAll(MsgLength, sizeof(MsgLength)))
+    {
+        return false;
+    }
+    uint32_t msgLength = ntohl(*reinterpret_cast<uint32_t*>(MsgLength));
+    Msg.assign(msgLength, '\0');
+    if (msgLength > 0 && !ReceiveAll(&Msg[0], msgLength))
+    {
+        return false;
+    }
+    if (msgtype == MessageType::return_msg && Msg == "heartbeat")
+    {
+        uint32_t inst = static_cast<uint32_t>(InstructionType::heartbeat_ACK);
+        vector<char> data = GenerateMessage(MessageType::instruction, inst);
+        SendData(data);
+    }
+    return true;
+}
+
+bool socketlearn::ReceiveAll(char* buffer, size_t length)
+{
+    size_t totalread = 0;
+    while (totalread < length)
+    {
+        int res = recv(socket_fd, buffer + totalread, static_cast<int>(length - totalread), 0);
+        if (res == SOCKET_ERROR)
+        {
+            ErrorMessage = std::to_string(WSAGetLastError());
+            return false;
+        }
+        if (res == 0)
+        {
+            ErrorMessage = "Connection closed";
+            return false;
+        }
+        totalread += res;
     }
     return true;
 }
@@ -38,6 +38,9 @@ public:
     void startListening();
 
 private:
+    // 读满 length 字节，连接关闭或出错时返回 false
+    bool ReceiveAll(char* buffer, size_t length);
+
     SOCKET socket_fd;
     WSADATA wsaData;
     string ErrorMessage;